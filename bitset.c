@@ -1,14 +1,453 @@
+/*
+pwrite and posix_memalign are POSIX.1-2008. On Linux madvise and the thread affinity calls are GNU extensions on top
+of it, and a bare _POSIX_C_SOURCE would hide them. This has to come before the first system header.
+*/
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#elif (defined(__unix__) || defined(__APPLE__)) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include "bitset.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <errno.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#endif
+
+#if defined(BITSET_THREADS)
+#include <pthread.h>
+#if defined(__linux__)
+#include <sched.h>
+#endif
+#endif
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif
     struct BitSet
     {
+        /* allocated in whole 64-bit words, bytes past the last used byte are kept zero */
         uint8_t *bits;
         /* length in bits */
         size_t bit_len;
+        /* one flag byte per BITSET_DIRTY_PAGE_SIZE bytes of "bits", NULL when neither dirty tracking nor lazy clear is on */
+        uint8_t *dirty;
+        /* flags every write ORs into its page, BITSET_PAGE_DIRTY and/or BITSET_PAGE_TOUCHED */
+        uint8_t page_flags;
+    };
+
+    typedef struct
+    {
+        size_t refs;
+        uint8_t data[BITSET_COW_PAGE_SIZE];
+    } bitset_cow_page;
+
+    struct BitSetCow
+    {
+        /* NULL pages read as zero */
+        bitset_cow_page **pages;
+        size_t num_pages;
+        /* length in bits */
+        size_t bit_len;
+    };
+
+    typedef struct bitset_pnode bitset_pnode;
+    struct bitset_pnode
+    {
+        size_t refs;
+        union
+        {
+            /* internal nodes, NULL children are all zero */
+            bitset_pnode *children[64];
+            /* leaves, 4096 bits */
+            uint64_t words[64];
+        } u;
+    };
+
+    struct BitSetPersistent
+    {
+        /* NULL is an all zero version */
+        bitset_pnode *root;
+        /* number of internal levels above the leaves */
+        unsigned int depth;
+        /* length in bits */
+        size_t bit_len;
+    };
+
+    typedef struct
+    {
+        BitSet bs;
+        /* keeps every shard header on its own cache line */
+        char pad[64 - sizeof(BitSet) % 64];
+    } bitset_shard;
+
+    struct BitSetSharded
+    {
+        BitSet main;
+        /* 64 byte aligned */
+        bitset_shard *shards;
+        size_t num_shards;
+    };
+
+    typedef struct
+    {
+        uint64_t bits;
+        /* epoch of the last write, "bits" is stale and reads as zero when it differs from the current one */
+        uint32_t stamp;
+    } bitset_stamped_word;
+
+    struct BitSetStamped
+    {
+        /* word and stamp side by side, so a lookup touches a single cache line */
+        bitset_stamped_word *words;
+        /* never 0, fresh words carry stamp 0 */
+        uint32_t epoch;
+        /* length in bits */
+        size_t bit_len;
+    };
+
+    struct BitSetRows
+    {
+        /* 64 byte aligned, row "r" is the "stride" words at words + r * stride, padding words are zero */
+        uint64_t *words;
+        /* popcount of every row */
+        uint32_t *counts;
+        /* words per row, a multiple of 8 */
+        size_t stride;
+        /* bits per row */
+        size_t bit_len;
+        size_t num_rows;
+        size_t capacity;
+    };
+
+/* substring width of BitSetHammingIndex tables */
+#define BITSET_MIH_BITS 16
+
+    struct BitSetHammingIndex
+    {
+        const BitSetRows *rows;
+        size_t num_tables;
+        /* per table, the rows with substring value "v" are ids[offsets[v]] to ids[offsets[v + 1]] */
+        uint32_t *offsets;
+        uint32_t *ids;
+        /* rows already checked by the current search */
+        BitSetStamped visited;
+    };
+
+#if defined(BITSET_THREADS)
+    struct BitSetConcurrent
+    {
+        /* every access is atomic */
+        uint64_t *words;
+        /* one sequence counter per BITSET_SEQLOCK_BLOCK_WORDS words, odd while the block is written */
+        size_t *seqs;
+        /* odd while any block is written */
+        size_t seq;
+        /* length in bits */
+        size_t bit_len;
+    };
+
+    struct BitSetNuma
+    {
+        /* partition "p" holds bits [p * part_bits, (p + 1) * part_bits) */
+        BitSet *parts;
+        /* index in node_ids of the node that owns each partition */
+        int *nodes;
+        /* sysfs id of each node, they need not be contiguous */
+        int *node_ids;
+        size_t num_parts;
+        size_t num_nodes;
+        size_t part_bits;
+        /* length in bits */
+        size_t bit_len;
     };
+#endif
+
+#if defined(BITSET_THREADS)
+#define bitset_refs_inc(p) __atomic_add_fetch((p), 1, __ATOMIC_RELAXED)
+#define bitset_refs_dec(p) __atomic_sub_fetch((p), 1, __ATOMIC_ACQ_REL)
+#define bitset_refs_load(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#else
+#define bitset_refs_inc(p) (++*(p))
+#define bitset_refs_dec(p) (--*(p))
+#define bitset_refs_load(p) (*(p))
+#endif
+
+    /* Word helpers. Bit "i" of a word is bit "i % 8" of byte "i / 8", regardless of host byte order. */
+
+    bitset_internal uint64_t bitset_load_word(const uint8_t *p)
+    {
+        uint64_t w;
+        memcpy(&w, p, sizeof(w));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        w = __builtin_bswap64(w);
+#endif
+        return w;
+    }
+
+    bitset_internal void bitset_store_word(uint8_t *p, uint64_t w)
+    {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        w = __builtin_bswap64(w);
+#endif
+        memcpy(p, &w, sizeof(w));
+    }
+
+    bitset_internal unsigned int bitset_popcount64(uint64_t w)
+    {
+#if defined(__GNUC__)
+        return (unsigned int)__builtin_popcountll(w);
+#else
+        w = w - ((w >> 1) & 0x5555555555555555ULL);
+        w = (w & 0x3333333333333333ULL) + ((w >> 2) & 0x3333333333333333ULL);
+        w = (w + (w >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+        return (unsigned int)((w * 0x0101010101010101ULL) >> 56);
+#endif
+    }
+
+    /* Clears the padding bits past "bit_len" in the last word */
+    bitset_internal void bitset_mask_tail(BitSet *bs)
+    {
+        if (bs->bit_len % 64)
+        {
+            uint8_t *last = bs->bits + (bs->bit_len / 64) * 8;
+            bitset_store_word(last, bitset_load_word(last) & (((uint64_t)1 << (bs->bit_len % 64)) - 1));
+        }
+    }
+
+    static BitSetErrorHandler bitset_error_handler = NULL;
+    static void *bitset_error_ctx = NULL;
+
+    bitset_internal BitSetStatus bitset_report(BitSetStatus status, const char *func)
+    {
+        if (bitset_error_handler)
+        {
+            bitset_error_handler(status, func, bitset_error_ctx);
+        }
+        return status;
+    }
+
+#define BITSET_PAGE_DIRTY 1
+#define BITSET_PAGE_TOUCHED 2
+
+    bitset_internal void bitset_mark_dirty(BitSet *bs, size_t byte_index)
+    {
+        if (bs->dirty)
+        {
+            bs->dirty[byte_index / BITSET_DIRTY_PAGE_SIZE] |= bs->page_flags;
+        }
+    }
+
+    /* Marks the pages overlapping bytes [begin, end) */
+    bitset_internal void bitset_mark_dirty_range(BitSet *bs, size_t begin, size_t end)
+    {
+        if (bs->dirty && begin < end)
+        {
+            for (size_t p = begin / BITSET_DIRTY_PAGE_SIZE; p <= (end - 1) / BITSET_DIRTY_PAGE_SIZE; p++)
+            {
+                bs->dirty[p] |= bs->page_flags;
+            }
+        }
+    }
+
+    /* Allocates the page map on first use and starts ORing "flag" into it, "initial" goes into every page */
+    bitset_internal BitSetStatus bitset_enable_page_flag(BitSet *bs, uint8_t flag, uint8_t initial, const char *func)
+    {
+        size_t pages = (BitSet_get_byte_len(bs) + BITSET_DIRTY_PAGE_SIZE - 1) / BITSET_DIRTY_PAGE_SIZE;
+        if (bs->dirty == NULL)
+        {
+            bs->dirty = (uint8_t *)calloc(pages ? pages : 1, sizeof(uint8_t));
+            if (bs->dirty == NULL)
+            {
+                return bitset_report(BITSET_ERR_NO_MEMORY, func);
+            }
+        }
+        for (size_t p = 0; p < pages; p++)
+        {
+            bs->dirty[p] |= initial;
+        }
+        bs->page_flags |= flag;
+        return BITSET_OK;
+    }
+
+    /* Stops ORing "flag" and drops it from every page, the map is released once no flag is left */
+    bitset_internal void bitset_disable_page_flag(BitSet *bs, uint8_t flag)
+    {
+        bs->page_flags &= (uint8_t)~flag;
+        if (bs->dirty == NULL)
+        {
+            return;
+        }
+        if (bs->page_flags == 0)
+        {
+            free(bs->dirty);
+            bs->dirty = NULL;
+            return;
+        }
+        size_t pages = (BitSet_get_byte_len(bs) + BITSET_DIRTY_PAGE_SIZE - 1) / BITSET_DIRTY_PAGE_SIZE;
+        for (size_t p = 0; p < pages; p++)
+        {
+            bs->dirty[p] &= (uint8_t)~flag;
+        }
+    }
+
+#if defined(__AVX__)
+#define BITSET_STREAM_WIDTH 32
+#define bitset_vec __m256i
+#define bitset_vec_set1(b) _mm256_set1_epi8((char)(b))
+#define bitset_vec_loadu(p) _mm256_loadu_si256((const __m256i *)(p))
+#define bitset_vec_stream(p, v) _mm256_stream_si256((__m256i *)(p), (v))
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BITSET_STREAM_WIDTH 16
+#define bitset_vec __m128i
+#define bitset_vec_set1(b) _mm_set1_epi8((char)(b))
+#define bitset_vec_loadu(p) _mm_loadu_si128((const __m128i *)(p))
+#define bitset_vec_stream(p, v) _mm_stream_si128((__m128i *)(p), (v))
+#endif
+
+    /* Resolves BITSET_MEM_AUTO for a buffer of "len" bytes, returns 1 for non-temporal stores */
+    bitset_internal int bitset_use_stream(size_t len, BitSetMemMode mode)
+    {
+        return mode == BITSET_MEM_STREAM || (mode == BITSET_MEM_AUTO && len >= BITSET_STREAM_THRESHOLD);
+    }
+
+    /* Sets "len" bytes to "value", bypassing the cache when "mode" asks for it */
+    bitset_internal void bitset_fill_bytes(uint8_t *p, uint8_t value, size_t len, BitSetMemMode mode)
+    {
+#if defined(BITSET_STREAM_WIDTH)
+        if (bitset_use_stream(len, mode))
+        {
+            size_t head = (BITSET_STREAM_WIDTH - ((uintptr_t)p & (BITSET_STREAM_WIDTH - 1))) & (BITSET_STREAM_WIDTH - 1);
+            head = head < len ? head : len;
+            memset(p, value, head);
+            p += head;
+            len -= head;
+            bitset_vec v = bitset_vec_set1(value);
+            for (; len >= BITSET_STREAM_WIDTH; p += BITSET_STREAM_WIDTH, len -= BITSET_STREAM_WIDTH)
+            {
+                bitset_vec_stream(p, v);
+            }
+            /* non-temporal stores are weakly ordered, publish them before returning */
+            _mm_sfence();
+        }
+#else
+        (void)mode;
+#endif
+        memset(p, value, len);
+    }
+
+    /* Copies "len" bytes, bypassing the cache when "mode" asks for it */
+    bitset_internal void bitset_copy_bytes(uint8_t *dst, const uint8_t *src, size_t len, BitSetMemMode mode)
+    {
+#if defined(BITSET_STREAM_WIDTH)
+        if (bitset_use_stream(len, mode))
+        {
+            size_t head = (BITSET_STREAM_WIDTH - ((uintptr_t)dst & (BITSET_STREAM_WIDTH - 1))) & (BITSET_STREAM_WIDTH - 1);
+            head = head < len ? head : len;
+            memcpy(dst, src, head);
+            dst += head;
+            src += head;
+            len -= head;
+            for (; len >= BITSET_STREAM_WIDTH; dst += BITSET_STREAM_WIDTH, src += BITSET_STREAM_WIDTH, len -= BITSET_STREAM_WIDTH)
+            {
+                bitset_vec_stream(dst, bitset_vec_loadu(src));
+            }
+            _mm_sfence();
+        }
+#else
+        (void)mode;
+#endif
+        memcpy(dst, src, len);
+    }
+
+    /* Zeroes "len" bytes, giving whole pages of large buffers back to the OS under BITSET_MEM_AUTO */
+    bitset_internal void bitset_zero_bytes(uint8_t *p, size_t len, BitSetMemMode mode)
+    {
+#if defined(__linux__) && defined(MADV_DONTNEED)
+        if (mode == BITSET_MEM_AUTO && len >= BITSET_RELEASE_THRESHOLD)
+        {
+            /* only the page aligned interior can be released, the partial pages at both ends are written */
+            size_t page = (size_t)sysconf(_SC_PAGESIZE);
+            uintptr_t begin = ((uintptr_t)p + page - 1) & ~(uintptr_t)(page - 1);
+            uintptr_t end = ((uintptr_t)p + len) & ~(uintptr_t)(page - 1);
+            if (end > begin && madvise((void *)begin, end - begin, MADV_DONTNEED) == 0)
+            {
+                memset(p, 0, begin - (uintptr_t)p);
+                memset((void *)end, 0, (uintptr_t)p + len - end);
+                return;
+            }
+        }
+#endif
+        bitset_fill_bytes(p, 0, len, mode);
+    }
+
+    bitset_internal void *bitset_aligned_alloc(size_t size, size_t align)
+    {
+#if defined(_MSC_VER)
+        return _aligned_malloc(size, align);
+#elif defined(__unix__) || defined(__APPLE__)
+        void *p = NULL;
+        return posix_memalign(&p, align, size) == 0 ? p : NULL;
+#else
+        /* stash the original pointer just below the aligned block */
+        uint8_t *raw = (uint8_t *)malloc(size + align + sizeof(void *));
+        if (raw == NULL)
+        {
+            return NULL;
+        }
+        uintptr_t aligned = ((uintptr_t)(raw + sizeof(void *)) + align - 1) & ~(uintptr_t)(align - 1);
+        ((void **)aligned)[-1] = raw;
+        return (void *)aligned;
+#endif
+    }
+
+    bitset_internal void bitset_aligned_free(void *p)
+    {
+#if defined(_MSC_VER)
+        _aligned_free(p);
+#elif defined(__unix__) || defined(__APPLE__)
+        free(p);
+#else
+        if (p)
+        {
+            free(((void **)p)[-1]);
+        }
+#endif
+    }
+
+#if defined(__GNUC__)
+#define bitset_prefetch(addr, rw) __builtin_prefetch((addr), (rw), 3)
+#else
+#define bitset_prefetch(addr, rw) ((void)(addr))
+#endif
+
+    /* "w" must not be 0 */
+    bitset_internal unsigned int bitset_ctz64(uint64_t w)
+    {
+#if defined(__GNUC__)
+        return (unsigned int)__builtin_ctzll(w);
+#else
+        unsigned int n = 0;
+        while (!(w & 1))
+        {
+            w >>= 1;
+            n++;
+        }
+        return n;
+#endif
+    }
 
     bitset_forced_inline size_t linear_index(size_t num_dims, const size_t *dims, const size_t *indices)
     {
@@ -38,146 +477,717 @@ extern "C"
         return (bs->bit_len + 7) / 8;
     }
 
+    bitset_forced_inline size_t BitSet_get_word_len(const BitSet *bs)
+    {
+        BITSET_ASSERT(bs, "BitSet_get_word_len: BitSet is NULL");
+        return (bs->bit_len + 63) / 64;
+    }
+
+    bitset_forced_inline void BitSet_set_error_handler(BitSetErrorHandler handler, void *ctx)
+    {
+        bitset_error_handler = handler;
+        bitset_error_ctx = ctx;
+    }
+
+    bitset_forced_inline BitSetStatus BitSet_try_init(BitSet *bs, size_t bit_len)
+    {
+        if (bs == NULL)
+        {
+            return BITSET_ERR_NULL;
+        }
+        bs->bit_len = bit_len;
+        bs->dirty = NULL;
+        bs->page_flags = 0;
+        bs->bits = (uint8_t *)calloc(BitSet_get_word_len(bs), sizeof(uint64_t));
+        if (bs->bits == NULL)
+        {
+            bs->bit_len = 0;
+            return bitset_report(BITSET_ERR_NO_MEMORY, "BitSet_try_init");
+        }
+        return BITSET_OK;
+    }
+
     bitset_forced_inline void BitSet_init(BitSet *bs, size_t bit_len)
     {
         BITSET_ASSERT(bs, "BitSet_init: BitSet is NULL");
-        bs->bit_len = bit_len;
-        bs->bits = (uint8_t *)calloc(BitSet_get_byte_len(bs), sizeof(uint8_t));
-        BITSET_ASSERT(bs->bits != NULL, "BitSet_init: Memory allocation failed");
+        BitSetStatus status = BitSet_try_init(bs, bit_len);
+        BITSET_ASSERT(status == BITSET_OK, "BitSet_init: Memory allocation failed");
+        (void)status;
+    }
+
+    bitset_forced_inline void BitSet_set_all_ex(BitSet *bs, BitSetMemMode mode)
+    {
+        BITSET_ASSERT(bs, "BitSet_set_all_ex: BitSet is NULL");
+        size_t byte_len = BitSet_get_byte_len(bs);
+        bitset_fill_bytes(bs->bits, 0xFF, byte_len, mode);
+        bitset_mask_tail(bs);
+        bitset_mark_dirty_range(bs, 0, byte_len);
     }
 
     bitset_forced_inline void BitSet_set_all(BitSet *bs)
     {
         BITSET_ASSERT(bs, "BitSet_set_all: BitSet is NULL");
-        size_t byte_len = BitSet_get_byte_len(bs);
-        for (size_t i = 0; i < byte_len; i++)
-        {
-            bs->bits[i] = 0xFF;
-        }
+        BitSet_set_all_ex(bs, BITSET_MEM_AUTO);
     }
 
     bitset_forced_inline void BitSet_clear_all(BitSet *bs)
     {
         BITSET_ASSERT(bs, "BitSet_clear_all: BitSet is NULL");
+        BitSet_clear_all_ex(bs, BITSET_MEM_AUTO);
+    }
+
+    bitset_forced_inline void BitSet_clear_all_ex(BitSet *bs, BitSetMemMode mode)
+    {
+        BITSET_ASSERT(bs, "BitSet_clear_all_ex: BitSet is NULL");
         size_t byte_len = BitSet_get_byte_len(bs);
-        for (size_t i = 0; i < byte_len; i++)
+        if (bs->page_flags & BITSET_PAGE_TOUCHED)
         {
-            bs->bits[i] = 0;
+            size_t pages = (byte_len + BITSET_DIRTY_PAGE_SIZE - 1) / BITSET_DIRTY_PAGE_SIZE;
+            uint8_t dirty = bs->page_flags & BITSET_PAGE_DIRTY;
+            /* zero each run of touched pages in one call, so "mode" and the page release see the whole run */
+            size_t run = pages;
+            for (size_t p = 0; p <= pages; p++)
+            {
+                if (p < pages && (bs->dirty[p] & BITSET_PAGE_TOUCHED))
+                {
+                    run = run == pages ? p : run;
+                    bs->dirty[p] = (uint8_t)((bs->dirty[p] & ~BITSET_PAGE_TOUCHED) | dirty);
+                }
+                else if (run != pages)
+                {
+                    size_t begin = run * BITSET_DIRTY_PAGE_SIZE;
+                    size_t end = p * BITSET_DIRTY_PAGE_SIZE < byte_len ? p * BITSET_DIRTY_PAGE_SIZE : byte_len;
+                    bitset_zero_bytes(bs->bits + begin, end - begin, mode);
+                    run = pages;
+                }
+            }
+            return;
         }
+        bitset_zero_bytes(bs->bits, byte_len, mode);
+        bitset_mark_dirty_range(bs, 0, byte_len);
+    }
+
+    bitset_forced_inline void BitSet_set_unchecked(BitSet *bs, size_t index)
+    {
+        bs->bits[index / 8] |= 1 << (index % 8);
+    }
+
+    bitset_forced_inline void BitSet_clear_unchecked(BitSet *bs, size_t index)
+    {
+        bs->bits[index / 8] &= ~(1 << (index % 8));
+    }
+
+    bitset_forced_inline unsigned int BitSet_get_unchecked(const BitSet *bs, size_t index)
+    {
+        return (bs->bits[index / 8] >> (index % 8)) & 1;
+    }
+
+    bitset_forced_inline void BitSet_flip_unchecked(BitSet *bs, size_t index)
+    {
+        bs->bits[index / 8] ^= 1 << (index % 8);
     }
 
     bitset_forced_inline void BitSet_set(BitSet *bs, size_t index)
     {
         BITSET_ASSERT(bs, "BitSet_set: BitSet is NULL");
         BITSET_ASSERT(index < bs->bit_len, "BitSet_set: Index out of bounds");
-        bs->bits[index / 8] |= 1 << (index % 8);
+        BitSet_set_unchecked(bs, index);
+        bitset_mark_dirty(bs, index / 8);
     }
 
     bitset_forced_inline void BitSet_clear(BitSet *bs, size_t index)
     {
         BITSET_ASSERT(bs, "BitSet_clear: BitSet is NULL");
         BITSET_ASSERT(index < bs->bit_len, "BitSet_clear: Index out of bounds");
-        bs->bits[index / 8] &= ~(1 << (index % 8));
+        BitSet_clear_unchecked(bs, index);
+        bitset_mark_dirty(bs, index / 8);
     }
 
     bitset_forced_inline unsigned int BitSet_get(const BitSet *bs, size_t index)
     {
         BITSET_ASSERT(bs, "BitSet_get: BitSet is NULL");
         BITSET_ASSERT(index < bs->bit_len, "BitSet_get: Index out of bounds");
-        return (bs->bits[index / 8] >> (index % 8)) & 1;
+        return BitSet_get_unchecked(bs, index);
     }
 
     bitset_forced_inline void BitSet_flip(BitSet *bs, size_t index)
     {
         BITSET_ASSERT(bs, "BitSet_flip: BitSet is NULL");
         BITSET_ASSERT(index < bs->bit_len, "BitSet_flip: Index out of bounds");
-        bs->bits[index / 8] ^= 1 << (index % 8);
-    }
-
-    bitset_forced_inline void BitSet_free(BitSet *bs)
-    {
-        BITSET_ASSERT(bs, "BitSet_free: BitSet is NULL");
-        free(bs->bits);
-        bs->bits = NULL;
-        bs->bit_len = 0;
+        BitSet_flip_unchecked(bs, index);
+        bitset_mark_dirty(bs, index / 8);
     }
 
-    bitset_forced_inline void BitSet_copy_construct(BitSet *dest, const BitSet *src)
+    bitset_forced_inline BitSetStatus BitSet_get_checked(const BitSet *bs, size_t index, unsigned int *out)
     {
-        BITSET_ASSERT(dest && src, "BitSet_copy_construct: BitSet is NULL");
-        /*
-        Expecting dest to be uninitialized
-        if (dest->bits != NULL)
+        if (bs == NULL || out == NULL)
         {
-            free(dest->bits);
+            return BITSET_ERR_NULL;
         }
-        */
-        size_t byte_len = BitSet_get_byte_len(src);
-        dest->bits = (uint8_t *)malloc(byte_len * sizeof(uint8_t));
-        BITSET_ASSERT(dest->bits != NULL, "BitSet_copy_construct: Memory allocation failed");
-        dest->bit_len = src->bit_len;
-        for (size_t i = 0; i < byte_len; i++)
+        if (index >= bs->bit_len)
         {
-            dest->bits[i] = src->bits[i];
+            return BITSET_ERR_OUT_OF_BOUNDS;
         }
+        *out = BitSet_get_unchecked(bs, index);
+        return BITSET_OK;
     }
 
-    bitset_forced_inline void BitSet_or(BitSet *dest, const BitSet *src)
+    bitset_forced_inline BitSetStatus BitSet_set_checked(BitSet *bs, size_t index)
     {
-        BITSET_ASSERT(dest && src, "BitSet_or: BitSet is NULL");
-        size_t byte_len = BitSet_get_byte_len(dest->bit_len < src->bit_len ? dest : src);
-        for (size_t i = 0; i < byte_len; i++)
+        if (bs == NULL)
         {
-            dest->bits[i] |= src->bits[i];
+            return BITSET_ERR_NULL;
         }
+        if (index >= bs->bit_len)
+        {
+            return BITSET_ERR_OUT_OF_BOUNDS;
+        }
+        BitSet_set_unchecked(bs, index);
+        bitset_mark_dirty(bs, index / 8);
+        return BITSET_OK;
     }
 
-    bitset_forced_inline void BitSet_and(BitSet *dest, const BitSet *src)
+    bitset_forced_inline BitSetStatus BitSet_clear_checked(BitSet *bs, size_t index)
     {
-        BITSET_ASSERT(dest && src, "BitSet_and: BitSet is NULL");
-        size_t byte_len = BitSet_get_byte_len(dest->bit_len < src->bit_len ? dest : src);
-        for (size_t i = 0; i < byte_len; i++)
+        if (bs == NULL)
         {
-            dest->bits[i] &= src->bits[i];
+            return BITSET_ERR_NULL;
         }
+        if (index >= bs->bit_len)
+        {
+            return BITSET_ERR_OUT_OF_BOUNDS;
+        }
+        BitSet_clear_unchecked(bs, index);
+        bitset_mark_dirty(bs, index / 8);
+        return BITSET_OK;
     }
 
-    bitset_forced_inline void BitSet_xor(BitSet *dest, const BitSet *src)
+    bitset_forced_inline BitSetStatus BitSet_flip_checked(BitSet *bs, size_t index)
     {
-        BITSET_ASSERT(dest && src, "BitSet_xor: BitSet is NULL");
-        size_t byte_len = BitSet_get_byte_len(dest->bit_len < src->bit_len ? dest : src);
-        for (size_t i = 0; i < byte_len; i++)
+        if (bs == NULL)
         {
-            dest->bits[i] ^= src->bits[i];
+            return BITSET_ERR_NULL;
         }
+        if (index >= bs->bit_len)
+        {
+            return BITSET_ERR_OUT_OF_BOUNDS;
+        }
+        BitSet_flip_unchecked(bs, index);
+        bitset_mark_dirty(bs, index / 8);
+        return BITSET_OK;
     }
 
-    bitset_forced_inline void BitSet_not(BitSet *bs)
+    bitset_forced_inline void BitSet_free(BitSet *bs)
     {
-        BITSET_ASSERT(bs, "BitSet_not: BitSet is NULL");
-        size_t byte_len = BitSet_get_byte_len(bs);
-        for (size_t i = 0; i < byte_len; i++)
-        {
-            bs->bits[i] = ~bs->bits[i];
-        }
+        BITSET_ASSERT(bs, "BitSet_free: BitSet is NULL");
+        free(bs->bits);
+        free(bs->dirty);
+        bs->bits = NULL;
+        bs->dirty = NULL;
+        bs->page_flags = 0;
+        bs->bit_len = 0;
     }
 
-    bitset_forced_inline int BitSet_equals(const BitSet *bs1, const BitSet *bs2)
+    bitset_internal BitSetStatus bitset_try_copy(BitSet *dest, const BitSet *src, BitSetMemMode mode, const char *func)
     {
-        BITSET_ASSERT(bs1 && bs2, "BitSet_equals: BitSet is NULL");
-        if (bs1->bit_len != bs2->bit_len)
+        if (dest == NULL || src == NULL)
         {
-            return 0;
+            return BITSET_ERR_NULL;
         }
-        size_t byte_len = BitSet_get_byte_len(bs1);
-        for (size_t i = 0; i < byte_len; i++)
+        /* Expecting dest to be uninitialized */
+        size_t byte_len = BitSet_get_word_len(src) * sizeof(uint64_t);
+        dest->dirty = NULL;
+        dest->page_flags = 0;
+        dest->bits = (uint8_t *)malloc(byte_len ? byte_len : 1);
+        if (dest->bits == NULL)
         {
-            if (bs1->bits[i] != bs2->bits[i])
-            {
-                return 0;
-            }
+            dest->bit_len = 0;
+            return bitset_report(BITSET_ERR_NO_MEMORY, func);
         }
-        return 1;
+        dest->bit_len = src->bit_len;
+        bitset_copy_bytes(dest->bits, src->bits, byte_len, mode);
+        return BITSET_OK;
+    }
+
+    bitset_forced_inline BitSetStatus BitSet_try_copy(BitSet *dest, const BitSet *src)
+    {
+        return bitset_try_copy(dest, src, BITSET_MEM_AUTO, "BitSet_try_copy");
+    }
+
+    bitset_forced_inline void BitSet_copy_construct(BitSet *dest, const BitSet *src)
+    {
+        BITSET_ASSERT(dest && src, "BitSet_copy_construct: BitSet is NULL");
+        BitSetStatus status = BitSet_try_copy(dest, src);
+        BITSET_ASSERT(status == BITSET_OK, "BitSet_copy_construct: Memory allocation failed");
+        (void)status;
+    }
+
+    bitset_forced_inline void BitSet_copy_construct_ex(BitSet *dest, const BitSet *src, BitSetMemMode mode)
+    {
+        BITSET_ASSERT(dest && src, "BitSet_copy_construct_ex: BitSet is NULL");
+        BitSetStatus status = bitset_try_copy(dest, src, mode, "BitSet_copy_construct_ex");
+        BITSET_ASSERT(status == BITSET_OK, "BitSet_copy_construct_ex: Memory allocation failed");
+        (void)status;
+    }
+
+    bitset_forced_inline BitSetStatus BitSet_try_resize(BitSet *bs, size_t bit_len)
+    {
+        if (bs == NULL)
+        {
+            return BITSET_ERR_NULL;
+        }
+        size_t old_bit_len = bs->bit_len;
+        size_t old_words = BitSet_get_word_len(bs);
+        size_t new_words = (bit_len + 63) / 64;
+        if (new_words > SIZE_MAX / sizeof(uint64_t))
+        {
+            return bitset_report(BITSET_ERR_NO_MEMORY, "BitSet_try_resize");
+        }
+        size_t old_pages = (old_words * sizeof(uint64_t) + BITSET_DIRTY_PAGE_SIZE - 1) / BITSET_DIRTY_PAGE_SIZE;
+        size_t new_pages = (new_words * sizeof(uint64_t) + BITSET_DIRTY_PAGE_SIZE - 1) / BITSET_DIRTY_PAGE_SIZE;
+        if (new_words != old_words)
+        {
+            uint8_t *bits = (uint8_t *)realloc(bs->bits, new_words ? new_words * sizeof(uint64_t) : 1);
+            if (bits == NULL)
+            {
+                return bitset_report(BITSET_ERR_NO_MEMORY, "BitSet_try_resize");
+            }
+            bs->bits = bits;
+        }
+        if (bs->dirty && new_pages > old_pages)
+        {
+            uint8_t *dirty = (uint8_t *)realloc(bs->dirty, new_pages);
+            if (dirty == NULL)
+            {
+                /* the grown buffer is harmless to keep, the length is what the caller sees */
+                return bitset_report(BITSET_ERR_NO_MEMORY, "BitSet_try_resize");
+            }
+            memset(dirty + old_pages, 0, new_pages - old_pages);
+            bs->dirty = dirty;
+        }
+        if (new_words > old_words)
+        {
+            memset(bs->bits + old_words * sizeof(uint64_t), 0, (new_words - old_words) * sizeof(uint64_t));
+        }
+        /* zero the bits in [min(old, new), end of the last kept word) */
+        size_t keep = old_bit_len < bit_len ? old_bit_len : bit_len;
+        size_t keep_words = new_words < old_words ? new_words : old_words;
+        if (keep < keep_words * 64)
+        {
+            size_t byte = keep / 8;
+            if (keep % 8)
+            {
+                bs->bits[byte] &= (uint8_t)((1u << (keep % 8)) - 1);
+                byte++;
+            }
+            memset(bs->bits + byte, 0, keep_words * sizeof(uint64_t) - byte);
+        }
+        bs->bit_len = bit_len;
+        if (bit_len > old_bit_len)
+        {
+            bitset_mark_dirty_range(bs, old_bit_len / 8, BitSet_get_byte_len(bs));
+        }
+        return BITSET_OK;
+    }
+
+    /*
+    Word loop shared by the logical kernels. Writes "expr" of the words "x" of "a", "y" of "b" and "z" of "c" to the
+    first "words" words of "out". An input with fewer words ("aw", "bw", "cw") reads as zero past its end, since its
+    padding bits are zero too. The main loop covers the words every input has and stays branch free, only the
+    zero extended rest pays for the bounds checks. The caller masks the tail of "out".
+    */
+#define BITSET_WORD_LOOP(out, a, aw, b, bw, c, cw, words, expr)                      \
+    do                                                                               \
+    {                                                                                \
+        /* locals, so the byte stores cannot be assumed to modify the pointers */    \
+        uint8_t *o_ = (out);                                                         \
+        const uint8_t *a_ = (a), *b_ = (b), *c_ = (c);                               \
+        size_t aw_ = (aw), bw_ = (bw), cw_ = (cw), words_ = (words);                 \
+        size_t common_ = words_;                                                     \
+        common_ = aw_ < common_ ? aw_ : common_;                                     \
+        common_ = bw_ < common_ ? bw_ : common_;                                     \
+        common_ = cw_ < common_ ? cw_ : common_;                                     \
+        size_t w_ = 0;                                                               \
+        for (; w_ < common_; w_++)                                                   \
+        {                                                                            \
+            uint64_t x = bitset_load_word(a_ + w_ * 8);                              \
+            uint64_t y = bitset_load_word(b_ + w_ * 8);                              \
+            uint64_t z = bitset_load_word(c_ + w_ * 8);                              \
+            (void)x, (void)y, (void)z;                                               \
+            bitset_store_word(o_ + w_ * 8, (expr));                                  \
+        }                                                                            \
+        for (; w_ < words_; w_++)                                                    \
+        {                                                                            \
+            uint64_t x = w_ < aw_ ? bitset_load_word(a_ + w_ * 8) : 0;               \
+            uint64_t y = w_ < bw_ ? bitset_load_word(b_ + w_ * 8) : 0;               \
+            uint64_t z = w_ < cw_ ? bitset_load_word(c_ + w_ * 8) : 0;               \
+            (void)x, (void)y, (void)z;                                               \
+            bitset_store_word(o_ + w_ * 8, (expr));                                  \
+        }                                                                            \
+    } while (0)
+
+    /* Resizes "out" to "bit_len" bits for a kernel that overwrites it, reusing the buffer when it has enough words */
+    bitset_internal int bitset_reserve(BitSet *out, size_t bit_len)
+    {
+        if ((bit_len + 63) / 64 > BitSet_get_word_len(out))
+        {
+            return BitSet_try_resize(out, bit_len) == BITSET_OK;
+        }
+        out->bit_len = bit_len;
+        return 1;
+    }
+
+    /* Marks the bytes of the first "words" words of "bs" */
+    bitset_internal void bitset_mark_dirty_words(BitSet *bs, size_t words)
+    {
+        size_t byte_len = BitSet_get_byte_len(bs);
+        bitset_mark_dirty_range(bs, 0, words * 8 < byte_len ? words * 8 : byte_len);
+    }
+
+    bitset_forced_inline void BitSet_or(BitSet *dest, const BitSet *src)
+    {
+        BITSET_ASSERT(dest && src, "BitSet_or: BitSet is NULL");
+        size_t dw = BitSet_get_word_len(dest);
+        size_t sw = BitSet_get_word_len(src);
+        /* past the end of "src" the result is "dest" itself */
+        size_t words = dw < sw ? dw : sw;
+        BITSET_WORD_LOOP(dest->bits, dest->bits, dw, src->bits, sw, src->bits, sw, words, x | y);
+        bitset_mask_tail(dest);
+        bitset_mark_dirty_words(dest, words);
+    }
+
+    bitset_forced_inline void BitSet_and(BitSet *dest, const BitSet *src)
+    {
+        BITSET_ASSERT(dest && src, "BitSet_and: BitSet is NULL");
+        size_t dw = BitSet_get_word_len(dest);
+        size_t sw = BitSet_get_word_len(src);
+        size_t words = dw;
+        BITSET_WORD_LOOP(dest->bits, dest->bits, dw, src->bits, sw, src->bits, sw, words, x & y);
+        bitset_mask_tail(dest);
+        bitset_mark_dirty_words(dest, words);
+    }
+
+    bitset_forced_inline void BitSet_xor(BitSet *dest, const BitSet *src)
+    {
+        BITSET_ASSERT(dest && src, "BitSet_xor: BitSet is NULL");
+        size_t dw = BitSet_get_word_len(dest);
+        size_t sw = BitSet_get_word_len(src);
+        /* past the end of "src" the result is "dest" itself */
+        size_t words = dw < sw ? dw : sw;
+        BITSET_WORD_LOOP(dest->bits, dest->bits, dw, src->bits, sw, src->bits, sw, words, x ^ y);
+        bitset_mask_tail(dest);
+        bitset_mark_dirty_words(dest, words);
+    }
+
+    bitset_forced_inline void BitSet_not(BitSet *bs)
+    {
+        BITSET_ASSERT(bs, "BitSet_not: BitSet is NULL");
+        size_t words = BitSet_get_word_len(bs);
+        BITSET_WORD_LOOP(bs->bits, bs->bits, words, bs->bits, words, bs->bits, words, words, ~x);
+        bitset_mask_tail(bs);
+        bitset_mark_dirty_words(bs, words);
+    }
+
+    bitset_forced_inline void BitSet_or_into(BitSet *out, const BitSet *a, const BitSet *b)
+    {
+        BITSET_ASSERT(out && a && b, "BitSet_or_into: BitSet is NULL");
+        size_t aw = BitSet_get_word_len(a);
+        size_t bw = BitSet_get_word_len(b);
+        if (!bitset_reserve(out, a->bit_len > b->bit_len ? a->bit_len : b->bit_len))
+        {
+            BITSET_ASSERT(0, "BitSet_or_into: Memory allocation failed");
+            return;
+        }
+        size_t words = BitSet_get_word_len(out);
+        BITSET_WORD_LOOP(out->bits, a->bits, aw, b->bits, bw, b->bits, bw, words, x | y);
+        bitset_mask_tail(out);
+        bitset_mark_dirty_words(out, words);
+    }
+
+    bitset_forced_inline void BitSet_and_into(BitSet *out, const BitSet *a, const BitSet *b)
+    {
+        BITSET_ASSERT(out && a && b, "BitSet_and_into: BitSet is NULL");
+        size_t aw = BitSet_get_word_len(a);
+        size_t bw = BitSet_get_word_len(b);
+        if (!bitset_reserve(out, a->bit_len > b->bit_len ? a->bit_len : b->bit_len))
+        {
+            BITSET_ASSERT(0, "BitSet_and_into: Memory allocation failed");
+            return;
+        }
+        size_t words = BitSet_get_word_len(out);
+        BITSET_WORD_LOOP(out->bits, a->bits, aw, b->bits, bw, b->bits, bw, words, x & y);
+        bitset_mask_tail(out);
+        bitset_mark_dirty_words(out, words);
+    }
+
+    bitset_forced_inline void BitSet_xor_into(BitSet *out, const BitSet *a, const BitSet *b)
+    {
+        BITSET_ASSERT(out && a && b, "BitSet_xor_into: BitSet is NULL");
+        size_t aw = BitSet_get_word_len(a);
+        size_t bw = BitSet_get_word_len(b);
+        if (!bitset_reserve(out, a->bit_len > b->bit_len ? a->bit_len : b->bit_len))
+        {
+            BITSET_ASSERT(0, "BitSet_xor_into: Memory allocation failed");
+            return;
+        }
+        size_t words = BitSet_get_word_len(out);
+        BITSET_WORD_LOOP(out->bits, a->bits, aw, b->bits, bw, b->bits, bw, words, x ^ y);
+        bitset_mask_tail(out);
+        bitset_mark_dirty_words(out, words);
+    }
+
+    bitset_forced_inline void BitSet_not_into(BitSet *out, const BitSet *a)
+    {
+        BITSET_ASSERT(out && a, "BitSet_not_into: BitSet is NULL");
+        if (!bitset_reserve(out, a->bit_len))
+        {
+            BITSET_ASSERT(0, "BitSet_not_into: Memory allocation failed");
+            return;
+        }
+        size_t words = BitSet_get_word_len(out);
+        BITSET_WORD_LOOP(out->bits, a->bits, words, a->bits, words, a->bits, words, words, ~x);
+        bitset_mask_tail(out);
+        bitset_mark_dirty_words(out, words);
+    }
+
+    bitset_forced_inline void BitSet_andnot(BitSet *dest, const BitSet *src)
+    {
+        BITSET_ASSERT(dest && src, "BitSet_andnot: BitSet is NULL");
+        size_t dw = BitSet_get_word_len(dest);
+        size_t sw = BitSet_get_word_len(src);
+        /* past the end of "src" the result is "dest" itself */
+        size_t words = dw < sw ? dw : sw;
+        BITSET_WORD_LOOP(dest->bits, dest->bits, dw, src->bits, sw, src->bits, sw, words, x & ~y);
+        bitset_mask_tail(dest);
+        bitset_mark_dirty_words(dest, words);
+    }
+
+    bitset_forced_inline void BitSet_andnot_into(BitSet *out, const BitSet *a, const BitSet *b)
+    {
+        BITSET_ASSERT(out && a && b, "BitSet_andnot_into: BitSet is NULL");
+        size_t aw = BitSet_get_word_len(a);
+        size_t bw = BitSet_get_word_len(b);
+        if (!bitset_reserve(out, a->bit_len > b->bit_len ? a->bit_len : b->bit_len))
+        {
+            BITSET_ASSERT(0, "BitSet_andnot_into: Memory allocation failed");
+            return;
+        }
+        size_t words = BitSet_get_word_len(out);
+        BITSET_WORD_LOOP(out->bits, a->bits, aw, b->bits, bw, b->bits, bw, words, x & ~y);
+        bitset_mask_tail(out);
+        bitset_mark_dirty_words(out, words);
+    }
+
+    bitset_forced_inline void BitSet_ornot(BitSet *dest, const BitSet *src)
+    {
+        BITSET_ASSERT(dest && src, "BitSet_ornot: BitSet is NULL");
+        size_t dw = BitSet_get_word_len(dest);
+        size_t sw = BitSet_get_word_len(src);
+        size_t words = dw;
+        BITSET_WORD_LOOP(dest->bits, dest->bits, dw, src->bits, sw, src->bits, sw, words, x | ~y);
+        bitset_mask_tail(dest);
+        bitset_mark_dirty_words(dest, words);
+    }
+
+    bitset_forced_inline void BitSet_ornot_into(BitSet *out, const BitSet *a, const BitSet *b)
+    {
+        BITSET_ASSERT(out && a && b, "BitSet_ornot_into: BitSet is NULL");
+        size_t aw = BitSet_get_word_len(a);
+        size_t bw = BitSet_get_word_len(b);
+        if (!bitset_reserve(out, a->bit_len > b->bit_len ? a->bit_len : b->bit_len))
+        {
+            BITSET_ASSERT(0, "BitSet_ornot_into: Memory allocation failed");
+            return;
+        }
+        size_t words = BitSet_get_word_len(out);
+        BITSET_WORD_LOOP(out->bits, a->bits, aw, b->bits, bw, b->bits, bw, words, x | ~y);
+        bitset_mask_tail(out);
+        bitset_mark_dirty_words(out, words);
+    }
+
+    bitset_forced_inline void BitSet_nand(BitSet *dest, const BitSet *src)
+    {
+        BITSET_ASSERT(dest && src, "BitSet_nand: BitSet is NULL");
+        size_t dw = BitSet_get_word_len(dest);
+        size_t sw = BitSet_get_word_len(src);
+        size_t words = dw;
+        BITSET_WORD_LOOP(dest->bits, dest->bits, dw, src->bits, sw, src->bits, sw, words, ~(x & y));
+        bitset_mask_tail(dest);
+        bitset_mark_dirty_words(dest, words);
+    }
+
+    bitset_forced_inline void BitSet_nand_into(BitSet *out, const BitSet *a, const BitSet *b)
+    {
+        BITSET_ASSERT(out && a && b, "BitSet_nand_into: BitSet is NULL");
+        size_t aw = BitSet_get_word_len(a);
+        size_t bw = BitSet_get_word_len(b);
+        if (!bitset_reserve(out, a->bit_len > b->bit_len ? a->bit_len : b->bit_len))
+        {
+            BITSET_ASSERT(0, "BitSet_nand_into: Memory allocation failed");
+            return;
+        }
+        size_t words = BitSet_get_word_len(out);
+        BITSET_WORD_LOOP(out->bits, a->bits, aw, b->bits, bw, b->bits, bw, words, ~(x & y));
+        bitset_mask_tail(out);
+        bitset_mark_dirty_words(out, words);
+    }
+
+    bitset_forced_inline void BitSet_nor(BitSet *dest, const BitSet *src)
+    {
+        BITSET_ASSERT(dest && src, "BitSet_nor: BitSet is NULL");
+        size_t dw = BitSet_get_word_len(dest);
+        size_t sw = BitSet_get_word_len(src);
+        size_t words = dw;
+        BITSET_WORD_LOOP(dest->bits, dest->bits, dw, src->bits, sw, src->bits, sw, words, ~(x | y));
+        bitset_mask_tail(dest);
+        bitset_mark_dirty_words(dest, words);
+    }
+
+    bitset_forced_inline void BitSet_nor_into(BitSet *out, const BitSet *a, const BitSet *b)
+    {
+        BITSET_ASSERT(out && a && b, "BitSet_nor_into: BitSet is NULL");
+        size_t aw = BitSet_get_word_len(a);
+        size_t bw = BitSet_get_word_len(b);
+        if (!bitset_reserve(out, a->bit_len > b->bit_len ? a->bit_len : b->bit_len))
+        {
+            BITSET_ASSERT(0, "BitSet_nor_into: Memory allocation failed");
+            return;
+        }
+        size_t words = BitSet_get_word_len(out);
+        BITSET_WORD_LOOP(out->bits, a->bits, aw, b->bits, bw, b->bits, bw, words, ~(x | y));
+        bitset_mask_tail(out);
+        bitset_mark_dirty_words(out, words);
+    }
+
+    bitset_forced_inline void BitSet_xnor(BitSet *dest, const BitSet *src)
+    {
+        BITSET_ASSERT(dest && src, "BitSet_xnor: BitSet is NULL");
+        size_t dw = BitSet_get_word_len(dest);
+        size_t sw = BitSet_get_word_len(src);
+        size_t words = dw;
+        BITSET_WORD_LOOP(dest->bits, dest->bits, dw, src->bits, sw, src->bits, sw, words, ~(x ^ y));
+        bitset_mask_tail(dest);
+        bitset_mark_dirty_words(dest, words);
+    }
+
+    bitset_forced_inline void BitSet_xnor_into(BitSet *out, const BitSet *a, const BitSet *b)
+    {
+        BITSET_ASSERT(out && a && b, "BitSet_xnor_into: BitSet is NULL");
+        size_t aw = BitSet_get_word_len(a);
+        size_t bw = BitSet_get_word_len(b);
+        if (!bitset_reserve(out, a->bit_len > b->bit_len ? a->bit_len : b->bit_len))
+        {
+            BITSET_ASSERT(0, "BitSet_xnor_into: Memory allocation failed");
+            return;
+        }
+        size_t words = BitSet_get_word_len(out);
+        BITSET_WORD_LOOP(out->bits, a->bits, aw, b->bits, bw, b->bits, bw, words, ~(x ^ y));
+        bitset_mask_tail(out);
+        bitset_mark_dirty_words(out, words);
+    }
+
+    bitset_forced_inline void BitSet_ternary(BitSet *out, const BitSet *a, const BitSet *b, const BitSet *c, uint8_t imm8)
+    {
+        BITSET_ASSERT(out && a && b && c, "BitSet_ternary: BitSet is NULL");
+        size_t aw = BitSet_get_word_len(a);
+        size_t bw = BitSet_get_word_len(b);
+        size_t cw = BitSet_get_word_len(c);
+        size_t n = a->bit_len > b->bit_len ? a->bit_len : b->bit_len;
+        n = n > c->bit_len ? n : c->bit_len;
+        if (!bitset_reserve(out, n))
+        {
+            BITSET_ASSERT(0, "BitSet_ternary: Memory allocation failed");
+            return;
+        }
+        /*
+        Sum of minterms, each selected by an all ones or all zeros mask so the loop has no data dependent
+        branches. vpternlog needs "imm8" as a compile time constant, so this stays portable scalar code that
+        the compiler is free to vectorize.
+        */
+        uint64_t sel[8];
+        for (unsigned int k = 0; k < 8; k++)
+        {
+            sel[k] = (uint64_t)0 - ((imm8 >> k) & 1);
+        }
+        size_t words = BitSet_get_word_len(out);
+        BITSET_WORD_LOOP(out->bits, a->bits, aw, b->bits, bw, c->bits, cw, words,
+                         (sel[0] & ~x & ~y & ~z) | (sel[1] & ~x & ~y & z) | (sel[2] & ~x & y & ~z) |
+                             (sel[3] & ~x & y & z) | (sel[4] & x & ~y & ~z) | (sel[5] & x & ~y & z) |
+                             (sel[6] & x & y & ~z) | (sel[7] & x & y & z));
+        bitset_mask_tail(out);
+        bitset_mark_dirty_words(out, words);
+    }
+
+    bitset_forced_inline void BitSet_or_shifted(BitSet *dest, const BitSet *src, size_t shift)
+    {
+        BITSET_ASSERT(dest && src, "BitSet_or_shifted: BitSet is NULL");
+        size_t dw = BitSet_get_word_len(dest);
+        size_t sw = BitSet_get_word_len(src);
+        size_t ws = shift / 64;
+        unsigned int bs = (unsigned int)(shift % 64);
+        if (ws >= dw)
+        {
+            return;
+        }
+        /* highest word first, so with dest == src every source word is read before it is written */
+        uint8_t *d = dest->bits;
+        const uint8_t *s = src->bits;
+        /* dest words [ws, top) take their low part from a source word, branch free */
+        size_t top = sw < dw - ws ? sw + ws : dw;
+        if (bs == 0)
+        {
+            for (size_t w = top; w-- > ws;)
+            {
+                bitset_store_word(d + w * 8, bitset_load_word(d + w * 8) | bitset_load_word(s + (w - ws) * 8));
+            }
+        }
+        else
+        {
+            if (top < dw && sw > 0)
+            {
+                /* bits carried out of the last source word */
+                bitset_store_word(d + top * 8, bitset_load_word(d + top * 8) | (bitset_load_word(s + (sw - 1) * 8) >> (64 - bs)));
+            }
+            for (size_t w = top; w-- > ws + 1;)
+            {
+                uint64_t v = (bitset_load_word(s + (w - ws) * 8) << bs) | (bitset_load_word(s + (w - ws - 1) * 8) >> (64 - bs));
+                bitset_store_word(d + w * 8, bitset_load_word(d + w * 8) | v);
+            }
+            if (top > ws)
+            {
+                bitset_store_word(d + ws * 8, bitset_load_word(d + ws * 8) | (bitset_load_word(s) << bs));
+            }
+        }
+        bitset_mask_tail(dest);
+        size_t byte_len = BitSet_get_byte_len(dest);
+        bitset_mark_dirty_range(dest, ws * 8 < byte_len ? ws * 8 : byte_len, byte_len);
+    }
+
+    bitset_forced_inline int BitSet_equals(const BitSet *bs1, const BitSet *bs2)
+    {
+        BITSET_ASSERT(bs1 && bs2, "BitSet_equals: BitSet is NULL");
+        if (bs1->bit_len != bs2->bit_len)
+        {
+            return 0;
+        }
+        /* padding bits are always zero, so whole words can be compared */
+        return memcmp(bs1->bits, bs2->bits, BitSet_get_word_len(bs1) * sizeof(uint64_t)) == 0;
+    }
+
+    bitset_forced_inline uint64_t BitSet_hash(const BitSet *bs)
+    {
+        BITSET_ASSERT(bs, "BitSet_hash: BitSet is NULL");
+        size_t word_len = BitSet_get_word_len(bs);
+        uint64_t h = 0x9E3779B97F4A7C15ULL ^ (uint64_t)bs->bit_len;
+        for (size_t i = 0; i < word_len; i++)
+        {
+            h = (h ^ bitset_load_word(bs->bits + i * 8)) * 0xBF58476D1CE4E5B9ULL;
+            h ^= h >> 31;
+        }
+        /* splitmix64 finalizer */
+        h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+        return h ^ (h >> 31);
     }
 
     bitset_forced_inline void BitSet_print(const BitSet *bs, int newline)
@@ -193,6 +1203,4086 @@ extern "C"
         }
         printf("\n");
     }
+
+    bitset_forced_inline size_t BitSet_count(const BitSet *bs)
+    {
+        BITSET_ASSERT(bs, "BitSet_count: BitSet is NULL");
+        size_t word_len = BitSet_get_word_len(bs);
+        size_t count = 0;
+        for (size_t i = 0; i < word_len; i++)
+        {
+            count += bitset_popcount64(bitset_load_word(bs->bits + i * 8));
+        }
+        return count;
+    }
+
+    bitset_forced_inline size_t BitSet_to_indices(const BitSet *bs, size_t *out, size_t max)
+    {
+        BITSET_ASSERT(bs, "BitSet_to_indices: BitSet is NULL");
+        BITSET_ASSERT(out || max == 0, "BitSet_to_indices: Output is NULL");
+        size_t word_len = BitSet_get_word_len(bs);
+        size_t n = 0;
+        for (size_t i = 0; i < word_len && n < max; i++)
+        {
+            uint64_t w = bitset_load_word(bs->bits + i * 8);
+            while (w && n < max)
+            {
+                out[n++] = i * 64 + bitset_ctz64(w);
+                w &= w - 1;
+            }
+        }
+        return n;
+    }
+
+    bitset_forced_inline int BitSet_for_each_set(const BitSet *bs, BitSetIndexFn fn, void *ctx)
+    {
+        BITSET_ASSERT(bs && fn, "BitSet_for_each_set: Argument is NULL");
+        size_t word_len = BitSet_get_word_len(bs);
+        for (size_t i = 0; i < word_len; i++)
+        {
+            uint64_t w = bitset_load_word(bs->bits + i * 8);
+            while (w)
+            {
+                if (fn(i * 64 + bitset_ctz64(w), ctx))
+                {
+                    return 1;
+                }
+                w &= w - 1;
+            }
+        }
+        return 0;
+    }
+
+    bitset_forced_inline void BitSet_get_many(const BitSet *bs, const size_t *idx, size_t n, uint8_t *out)
+    {
+        BITSET_ASSERT(bs && ((idx && out) || n == 0), "BitSet_get_many: Argument is NULL");
+        for (size_t i = 0; i < n; i++)
+        {
+            if (i + BITSET_PREFETCH_DISTANCE < n)
+            {
+                bitset_prefetch(bs->bits + idx[i + BITSET_PREFETCH_DISTANCE] / 8, 0);
+            }
+            BITSET_ASSERT(idx[i] < bs->bit_len, "BitSet_get_many: Index out of bounds");
+            out[i] = (bs->bits[idx[i] / 8] >> (idx[i] % 8)) & 1;
+        }
+    }
+
+    bitset_forced_inline void BitSet_set_many(BitSet *bs, const size_t *idx, size_t n)
+    {
+        BITSET_ASSERT(bs && (idx || n == 0), "BitSet_set_many: Argument is NULL");
+        for (size_t i = 0; i < n; i++)
+        {
+            if (i + BITSET_PREFETCH_DISTANCE < n)
+            {
+                bitset_prefetch(bs->bits + idx[i + BITSET_PREFETCH_DISTANCE] / 8, 1);
+            }
+            BITSET_ASSERT(idx[i] < bs->bit_len, "BitSet_set_many: Index out of bounds");
+            bs->bits[idx[i] / 8] |= 1 << (idx[i] % 8);
+            bitset_mark_dirty(bs, idx[i] / 8);
+        }
+    }
+
+    bitset_forced_inline void BitSet_clear_many(BitSet *bs, const size_t *idx, size_t n)
+    {
+        BITSET_ASSERT(bs && (idx || n == 0), "BitSet_clear_many: Argument is NULL");
+        for (size_t i = 0; i < n; i++)
+        {
+            if (i + BITSET_PREFETCH_DISTANCE < n)
+            {
+                bitset_prefetch(bs->bits + idx[i + BITSET_PREFETCH_DISTANCE] / 8, 1);
+            }
+            BITSET_ASSERT(idx[i] < bs->bit_len, "BitSet_clear_many: Index out of bounds");
+            bs->bits[idx[i] / 8] &= ~(1 << (idx[i] % 8));
+            bitset_mark_dirty(bs, idx[i] / 8);
+        }
+    }
+
+    bitset_forced_inline void BitSet_test_and_set_many(BitSet *bs, const size_t *idx, size_t n, uint8_t *out)
+    {
+        BITSET_ASSERT(bs && ((idx && out) || n == 0), "BitSet_test_and_set_many: Argument is NULL");
+        for (size_t i = 0; i < n; i++)
+        {
+            if (i + BITSET_PREFETCH_DISTANCE < n)
+            {
+                bitset_prefetch(bs->bits + idx[i + BITSET_PREFETCH_DISTANCE] / 8, 1);
+            }
+            BITSET_ASSERT(idx[i] < bs->bit_len, "BitSet_test_and_set_many: Index out of bounds");
+            uint8_t *byte = &bs->bits[idx[i] / 8];
+            out[i] = (*byte >> (idx[i] % 8)) & 1;
+            *byte |= 1 << (idx[i] % 8);
+            bitset_mark_dirty(bs, idx[i] / 8);
+        }
+    }
+
+    bitset_forced_inline void BitSet_sort_indices(size_t *idx, size_t n, size_t *scratch)
+    {
+        BITSET_ASSERT((idx && scratch) || n == 0, "BitSet_sort_indices: Argument is NULL");
+        /* 4 KB of storage holds 2^15 bits */
+        size_t max_page = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            max_page = idx[i] >> 15 > max_page ? idx[i] >> 15 : max_page;
+        }
+        size_t *src = idx;
+        size_t *dst = scratch;
+        for (unsigned int shift = 15; shift < sizeof(size_t) * 8; shift += 8)
+        {
+            if (shift > 15 && (max_page >> (shift - 15)) == 0)
+            {
+                break;
+            }
+            size_t counts[257] = {0};
+            for (size_t i = 0; i < n; i++)
+            {
+                counts[((src[i] >> shift) & 0xFF) + 1]++;
+            }
+            for (size_t d = 0; d < 256; d++)
+            {
+                counts[d + 1] += counts[d];
+            }
+            for (size_t i = 0; i < n; i++)
+            {
+                dst[counts[(src[i] >> shift) & 0xFF]++] = src[i];
+            }
+            size_t *tmp = src;
+            src = dst;
+            dst = tmp;
+        }
+        if (src != idx)
+        {
+            memcpy(idx, src, n * sizeof(size_t));
+        }
+    }
+
+    /*
+    Popcount loop shared by the counting kernels. Sets "count" to the sum of bitset_popcount64("expr") for the word
+    index "w" in [begin, end). Four independent accumulators keep the adds from serializing, and compilers vectorize
+    the loop when a vector popcount instruction is available (for example -mavx512vpopcntdq).
+    */
+#define BITSET_POPCOUNT_LOOP(count, begin, end, w, expr)                              \
+    do                                                                                \
+    {                                                                                 \
+        size_t c0_ = 0, c1_ = 0, c2_ = 0, c3_ = 0;                                    \
+        size_t i_ = (begin), end_ = (end);                                            \
+        size_t quads_end_ = end_ - (end_ - i_) % 4;                                   \
+        for (; i_ < quads_end_; i_ += 4)                                              \
+        {                                                                             \
+            size_t w = i_;                                                            \
+            c0_ += bitset_popcount64(expr);                                           \
+            w = i_ + 1;                                                               \
+            c1_ += bitset_popcount64(expr);                                           \
+            w = i_ + 2;                                                               \
+            c2_ += bitset_popcount64(expr);                                           \
+            w = i_ + 3;                                                               \
+            c3_ += bitset_popcount64(expr);                                           \
+        }                                                                             \
+        for (; i_ < end_; i_++)                                                       \
+        {                                                                             \
+            size_t w = i_;                                                            \
+            c0_ += bitset_popcount64(expr);                                           \
+        }                                                                             \
+        (count) = c0_ + c1_ + c2_ + c3_;                                              \
+    } while (0)
+
+    /* Popcount of words [begin, end) */
+    bitset_internal size_t bitset_count_words(const uint8_t *bits, size_t begin, size_t end)
+    {
+        size_t count;
+        BITSET_POPCOUNT_LOOP(count, begin, end, i, bitset_load_word(bits + i * 8));
+        return count;
+    }
+
+    /* Writes the popcount of block "b" to out[b + 1] for blocks [begin, end). */
+    bitset_internal void bitset_block_counts(const BitSet *bs, size_t block_words, size_t begin, size_t end, size_t *out)
+    {
+        size_t word_len = BitSet_get_word_len(bs);
+        for (size_t b = begin; b < end; b++)
+        {
+            size_t last = (b + 1) * block_words < word_len ? (b + 1) * block_words : word_len;
+            out[b + 1] = bitset_count_words(bs->bits, b * block_words, last);
+        }
+    }
+
+    bitset_forced_inline size_t BitSet_prefix_counts_len(const BitSet *bs, size_t block_bits)
+    {
+        BITSET_ASSERT(bs, "BitSet_prefix_counts_len: BitSet is NULL");
+        BITSET_ASSERT(block_bits && block_bits % 64 == 0, "BitSet_prefix_counts_len: Block size must be a multiple of 64");
+        return (bs->bit_len + block_bits - 1) / block_bits + 1;
+    }
+
+    bitset_forced_inline void BitSet_prefix_counts(const BitSet *bs, size_t block_bits, size_t *out)
+    {
+        BITSET_ASSERT(bs && out, "BitSet_prefix_counts: Argument is NULL");
+        size_t num_blocks = BitSet_prefix_counts_len(bs, block_bits) - 1;
+        bitset_block_counts(bs, block_bits / 64, 0, num_blocks, out);
+        out[0] = 0;
+        for (size_t b = 0; b < num_blocks; b++)
+        {
+            out[b + 1] += out[b];
+        }
+    }
+
+    bitset_forced_inline size_t BitSet_rank(const BitSet *bs, const size_t *counts, size_t block_bits, size_t index)
+    {
+        BITSET_ASSERT(bs && counts, "BitSet_rank: Argument is NULL");
+        BITSET_ASSERT(index <= bs->bit_len, "BitSet_rank: Index out of bounds");
+        size_t block = index / block_bits;
+        size_t rank = counts[block] + bitset_count_words(bs->bits, block * (block_bits / 64), index / 64);
+        if (index % 64)
+        {
+            rank += bitset_popcount64(bitset_load_word(bs->bits + index / 64 * 8) & (((uint64_t)1 << (index % 64)) - 1));
+        }
+        return rank;
+    }
+
+    /* Rows [row_begin, row_end) of the column, "row_begin" must be a multiple of BITSET_INDEX_TILE_ROWS. */
+    bitset_internal BitSetStatus bitset_build_index_range(BitSet *out, size_t num_values, const uint32_t *codes, size_t row_begin, size_t row_end)
+    {
+        size_t shift = 0;
+        while (((num_values - 1) >> shift) >= BITSET_INDEX_RADIX)
+        {
+            shift++;
+        }
+        size_t buckets = ((num_values - 1) >> shift) + 1;
+        size_t *offsets = (size_t *)malloc((buckets + 1) * sizeof(size_t));
+        uint32_t *order = (uint32_t *)malloc(BITSET_INDEX_TILE_ROWS * sizeof(uint32_t));
+        if (offsets == NULL || order == NULL)
+        {
+            free(offsets);
+            free(order);
+            return BITSET_ERR_NO_MEMORY;
+        }
+        for (size_t tile = row_begin; tile < row_end; tile += BITSET_INDEX_TILE_ROWS)
+        {
+            size_t tile_rows = row_end - tile < BITSET_INDEX_TILE_ROWS ? row_end - tile : BITSET_INDEX_TILE_ROWS;
+            const uint32_t *tile_codes = codes + tile;
+
+            /* counting sort of the tile's rows by the high bits of their code */
+            memset(offsets, 0, (buckets + 1) * sizeof(size_t));
+            for (size_t r = 0; r < tile_rows; r++)
+            {
+                BITSET_ASSERT(tile_codes[r] < num_values, "BitSet_build_index: Code out of bounds");
+                offsets[(tile_codes[r] >> shift) + 1]++;
+            }
+            for (size_t b = 0; b < buckets; b++)
+            {
+                offsets[b + 1] += offsets[b];
+            }
+            for (size_t r = 0; r < tile_rows; r++)
+            {
+                order[offsets[tile_codes[r] >> shift]++] = (uint32_t)r;
+            }
+
+            /* rows are now grouped by bucket and ascending within it, merge runs that hit the same word */
+            size_t i = 0;
+            while (i < tile_rows)
+            {
+                uint32_t code = tile_codes[order[i]];
+                size_t word = (tile + order[i]) / 64;
+                uint64_t acc = 0;
+                while (i < tile_rows && tile_codes[order[i]] == code && (tile + order[i]) / 64 == word)
+                {
+                    acc |= (uint64_t)1 << ((tile + order[i]) % 64);
+                    i++;
+                }
+                uint8_t *p = out[code].bits + word * 8;
+                bitset_store_word(p, bitset_load_word(p) | acc);
+            }
+        }
+        free(offsets);
+        free(order);
+        return BITSET_OK;
+    }
+
+    bitset_internal void bitset_free_all(BitSet *out, size_t num_values)
+    {
+        for (size_t v = 0; v < num_values; v++)
+        {
+            BitSet_free(&out[v]);
+        }
+    }
+
+    /* Initializes every output to "num_rows" zero bits, on failure the ones already allocated are freed */
+    bitset_internal BitSetStatus bitset_build_index_init(BitSet *out, size_t num_values, size_t num_rows, const char *func)
+    {
+        size_t word_len = (num_rows + 63) / 64;
+        for (size_t v = 0; v < num_values; v++)
+        {
+            out[v].bit_len = num_rows;
+            out[v].dirty = NULL;
+            out[v].page_flags = 0;
+            out[v].bits = (uint8_t *)calloc(word_len ? word_len : 1, sizeof(uint64_t));
+            if (out[v].bits == NULL)
+            {
+                bitset_free_all(out, v);
+                return bitset_report(BITSET_ERR_NO_MEMORY, func);
+            }
+        }
+        return BITSET_OK;
+    }
+
+    bitset_forced_inline BitSetStatus BitSet_build_index(BitSet *out, size_t num_values, const uint32_t *codes, size_t num_rows)
+    {
+        BITSET_ASSERT(out && (codes || num_rows == 0), "BitSet_build_index: Argument is NULL");
+        if (bitset_build_index_init(out, num_values, num_rows, "BitSet_build_index") != BITSET_OK)
+        {
+            return BITSET_ERR_NO_MEMORY;
+        }
+        if (num_values == 0 || num_rows == 0)
+        {
+            return BITSET_OK;
+        }
+        if (bitset_build_index_range(out, num_values, codes, 0, num_rows) != BITSET_OK)
+        {
+            bitset_free_all(out, num_values);
+            return bitset_report(BITSET_ERR_NO_MEMORY, "BitSet_build_index");
+        }
+        return BITSET_OK;
+    }
+
+#if defined(BITSET_THREADS)
+    /*
+    Runs "fn" on each of the "num_threads" tasks, task 0 on the calling thread. Tasks whose thread cannot be
+    created, or all of them if the thread table cannot be allocated, run on the calling thread after task 0.
+    */
+    bitset_internal void bitset_run_threads(void *(*fn)(void *), void *tasks, size_t task_size, size_t num_threads)
+    {
+        pthread_t *threads = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
+        int *started = (int *)calloc(num_threads, sizeof(int));
+        if (threads == NULL || started == NULL)
+        {
+            free(threads);
+            free(started);
+            for (size_t t = 0; t < num_threads; t++)
+            {
+                fn((uint8_t *)tasks + t * task_size);
+            }
+            return;
+        }
+        for (size_t t = 1; t < num_threads; t++)
+        {
+            started[t] = pthread_create(&threads[t], NULL, fn, (uint8_t *)tasks + t * task_size) == 0;
+        }
+        fn(tasks);
+        for (size_t t = 1; t < num_threads; t++)
+        {
+            if (started[t])
+            {
+                pthread_join(threads[t], NULL);
+            }
+            else
+            {
+                /* could not spawn a thread, do the work here */
+                fn((uint8_t *)tasks + t * task_size);
+            }
+        }
+        free(threads);
+        free(started);
+    }
+
+    typedef struct
+    {
+        BitSet *out;
+        size_t num_values;
+        const uint32_t *codes;
+        size_t row_begin;
+        size_t row_end;
+        BitSetStatus status;
+    } bitset_build_index_task;
+
+    bitset_internal void *bitset_build_index_worker(void *arg)
+    {
+        bitset_build_index_task *task = (bitset_build_index_task *)arg;
+        task->status = bitset_build_index_range(task->out, task->num_values, task->codes, task->row_begin, task->row_end);
+        return NULL;
+    }
+
+    bitset_forced_inline BitSetStatus BitSet_build_index_mt(BitSet *out, size_t num_values, const uint32_t *codes, size_t num_rows, size_t num_threads)
+    {
+        BITSET_ASSERT(out && (codes || num_rows == 0), "BitSet_build_index_mt: Argument is NULL");
+        size_t tiles = (num_rows + BITSET_INDEX_TILE_ROWS - 1) / BITSET_INDEX_TILE_ROWS;
+        if (num_threads > tiles)
+        {
+            num_threads = tiles;
+        }
+        if (num_threads <= 1)
+        {
+            return BitSet_build_index(out, num_values, codes, num_rows);
+        }
+        if (bitset_build_index_init(out, num_values, num_rows, "BitSet_build_index_mt") != BITSET_OK)
+        {
+            return BITSET_ERR_NO_MEMORY;
+        }
+        if (num_values == 0)
+        {
+            return BITSET_OK;
+        }
+        bitset_build_index_task *tasks = (bitset_build_index_task *)malloc(num_threads * sizeof(bitset_build_index_task));
+        if (tasks == NULL)
+        {
+            bitset_free_all(out, num_values);
+            return bitset_report(BITSET_ERR_NO_MEMORY, "BitSet_build_index_mt");
+        }
+        for (size_t t = 0; t < num_threads; t++)
+        {
+            size_t row_begin = tiles * t / num_threads * BITSET_INDEX_TILE_ROWS;
+            size_t row_end = tiles * (t + 1) / num_threads * BITSET_INDEX_TILE_ROWS;
+            tasks[t].out = out;
+            tasks[t].num_values = num_values;
+            tasks[t].codes = codes;
+            tasks[t].row_begin = row_begin;
+            tasks[t].row_end = row_end < num_rows ? row_end : num_rows;
+            tasks[t].status = BITSET_OK;
+        }
+        bitset_run_threads(bitset_build_index_worker, tasks, sizeof(bitset_build_index_task), num_threads);
+        BitSetStatus status = BITSET_OK;
+        for (size_t t = 0; t < num_threads; t++)
+        {
+            if (tasks[t].status != BITSET_OK)
+            {
+                status = BITSET_ERR_NO_MEMORY;
+            }
+        }
+        free(tasks);
+        if (status != BITSET_OK)
+        {
+            bitset_free_all(out, num_values);
+            return bitset_report(status, "BitSet_build_index_mt");
+        }
+        return BITSET_OK;
+    }
+
+    typedef struct
+    {
+        const BitSet *bs;
+        size_t block_words;
+        size_t begin;
+        size_t end;
+        size_t *counts;
+        /* BitSet_to_indices_mt only */
+        size_t *out;
+    } bitset_blocks_task;
+
+    bitset_internal void *bitset_block_counts_worker(void *arg)
+    {
+        bitset_blocks_task *task = (bitset_blocks_task *)arg;
+        bitset_block_counts(task->bs, task->block_words, task->begin, task->end, task->counts);
+        return NULL;
+    }
+
+    /* Splits the blocks between the tasks, runs "fn" on them and frees them. */
+    bitset_internal void bitset_run_blocks(const BitSet *bs, size_t block_bits, size_t *counts, size_t *out, void *(*fn)(void *), size_t num_threads)
+    {
+        size_t num_blocks = BitSet_prefix_counts_len(bs, block_bits) - 1;
+        if (num_threads > num_blocks)
+        {
+            num_threads = num_blocks ? num_blocks : 1;
+        }
+        /* without a task table every block runs as one task on the calling thread */
+        bitset_blocks_task single;
+        bitset_blocks_task *tasks = (bitset_blocks_task *)malloc(num_threads * sizeof(bitset_blocks_task));
+        if (tasks == NULL)
+        {
+            tasks = &single;
+            num_threads = 1;
+        }
+        for (size_t t = 0; t < num_threads; t++)
+        {
+            tasks[t].bs = bs;
+            tasks[t].block_words = block_bits / 64;
+            tasks[t].begin = num_blocks * t / num_threads;
+            tasks[t].end = num_blocks * (t + 1) / num_threads;
+            tasks[t].counts = counts;
+            tasks[t].out = out;
+        }
+        bitset_run_threads(fn, tasks, sizeof(bitset_blocks_task), num_threads);
+        if (tasks != &single)
+        {
+            free(tasks);
+        }
+    }
+
+    bitset_forced_inline void BitSet_prefix_counts_mt(const BitSet *bs, size_t block_bits, size_t *out, size_t num_threads)
+    {
+        BITSET_ASSERT(bs && out, "BitSet_prefix_counts_mt: Argument is NULL");
+        size_t num_blocks = BitSet_prefix_counts_len(bs, block_bits) - 1;
+        bitset_run_blocks(bs, block_bits, out, NULL, bitset_block_counts_worker, num_threads ? num_threads : 1);
+        out[0] = 0;
+        for (size_t b = 0; b < num_blocks; b++)
+        {
+            out[b + 1] += out[b];
+        }
+    }
+
+    bitset_internal void *bitset_to_indices_worker(void *arg)
+    {
+        bitset_blocks_task *task = (bitset_blocks_task *)arg;
+        size_t word_len = BitSet_get_word_len(task->bs);
+        size_t begin = task->begin * task->block_words;
+        size_t end = task->end * task->block_words < word_len ? task->end * task->block_words : word_len;
+        size_t n = task->counts[task->begin];
+        for (size_t i = begin; i < end; i++)
+        {
+            uint64_t w = bitset_load_word(task->bs->bits + i * 8);
+            while (w)
+            {
+                task->out[n++] = i * 64 + bitset_ctz64(w);
+                w &= w - 1;
+            }
+        }
+        return NULL;
+    }
+
+    bitset_forced_inline size_t BitSet_to_indices_mt(const BitSet *bs, size_t *out, size_t num_threads)
+    {
+        BITSET_ASSERT(bs && out, "BitSet_to_indices_mt: Argument is NULL");
+        size_t block_bits = BITSET_COMPACT_BLOCK_BITS;
+        size_t len = BitSet_prefix_counts_len(bs, block_bits);
+        size_t *counts = (size_t *)malloc(len * sizeof(size_t));
+        if (counts == NULL)
+        {
+            /* "out" has room for every set bit */
+            return BitSet_to_indices(bs, out, SIZE_MAX);
+        }
+        BitSet_prefix_counts_mt(bs, block_bits, counts, num_threads);
+        bitset_run_blocks(bs, block_bits, counts, out, bitset_to_indices_worker, num_threads ? num_threads : 1);
+        size_t total = counts[len - 1];
+        free(counts);
+        return total;
+    }
+
+    typedef struct
+    {
+        const BitSet *bs;
+        BitSetIndexFn fn;
+        void *ctx;
+        /* chunk "c" covers words [bounds[c], bounds[c + 1]) */
+        const size_t *bounds;
+        /* per thread range of chunk ids, head in the low and tail in the high 32 bits */
+        uint64_t *deques;
+        size_t num_threads;
+        int cancelled;
+    } bitset_parallel_iter;
+
+    typedef struct
+    {
+        bitset_parallel_iter *iter;
+        size_t id;
+    } bitset_parallel_worker;
+
+    /* Takes the front chunk of "deque", returns 0 if it is empty. */
+    bitset_internal int bitset_deque_pop(uint64_t *deque, uint32_t *chunk)
+    {
+        uint64_t v = __atomic_load_n(deque, __ATOMIC_ACQUIRE);
+        for (;;)
+        {
+            uint32_t head = (uint32_t)v;
+            uint32_t tail = (uint32_t)(v >> 32);
+            if (head >= tail)
+            {
+                return 0;
+            }
+            if (__atomic_compare_exchange_n(deque, &v, ((uint64_t)tail << 32) | (head + 1), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            {
+                *chunk = head;
+                return 1;
+            }
+        }
+    }
+
+    /* Takes the back half of a deque, returns it packed like a deque or 0 if it is empty. */
+    bitset_internal uint64_t bitset_deque_steal(uint64_t *deque)
+    {
+        uint64_t v = __atomic_load_n(deque, __ATOMIC_ACQUIRE);
+        for (;;)
+        {
+            uint32_t head = (uint32_t)v;
+            uint32_t tail = (uint32_t)(v >> 32);
+            if (head >= tail)
+            {
+                return 0;
+            }
+            uint32_t split = tail - (tail - head + 1) / 2;
+            if (__atomic_compare_exchange_n(deque, &v, ((uint64_t)split << 32) | head, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            {
+                return ((uint64_t)tail << 32) | split;
+            }
+        }
+    }
+
+    bitset_internal void *bitset_parallel_for_each_worker(void *arg)
+    {
+        bitset_parallel_worker *worker = (bitset_parallel_worker *)arg;
+        bitset_parallel_iter *iter = worker->iter;
+        uint64_t *own = &iter->deques[worker->id];
+        for (;;)
+        {
+            uint32_t chunk;
+            if (!bitset_deque_pop(own, &chunk))
+            {
+                uint64_t stolen = 0;
+                for (size_t i = 1; i < iter->num_threads && !stolen; i++)
+                {
+                    stolen = bitset_deque_steal(&iter->deques[(worker->id + i) % iter->num_threads]);
+                }
+                if (!stolen)
+                {
+                    return NULL;
+                }
+                __atomic_store_n(own, stolen, __ATOMIC_RELEASE);
+                continue;
+            }
+            for (size_t w = iter->bounds[chunk]; w < iter->bounds[chunk + 1]; w++)
+            {
+                if (__atomic_load_n(&iter->cancelled, __ATOMIC_RELAXED))
+                {
+                    return NULL;
+                }
+                uint64_t word = bitset_load_word(iter->bs->bits + w * 8);
+                while (word)
+                {
+                    if (iter->fn(w * 64 + bitset_ctz64(word), iter->ctx))
+                    {
+                        __atomic_store_n(&iter->cancelled, 1, __ATOMIC_RELAXED);
+                        return NULL;
+                    }
+                    word &= word - 1;
+                }
+            }
+        }
+    }
+
+    bitset_forced_inline int BitSet_parallel_for_each_set(const BitSet *bs, BitSetIndexFn fn, void *ctx, size_t num_threads)
+    {
+        BITSET_ASSERT(bs && fn, "BitSet_parallel_for_each_set: Argument is NULL");
+        size_t word_len = BitSet_get_word_len(bs);
+        size_t total = BitSet_count(bs);
+        if (num_threads > word_len)
+        {
+            num_threads = word_len;
+        }
+        if (num_threads <= 1 || total == 0)
+        {
+            return BitSet_for_each_set(bs, fn, ctx);
+        }
+
+        /* cut chunks where the running popcount crosses each multiple of total / num_chunks */
+        size_t num_chunks = num_threads * BITSET_PARALLEL_CHUNKS_PER_THREAD;
+        size_t *bounds = (size_t *)malloc((num_chunks + 1) * sizeof(size_t));
+        uint64_t *deques = (uint64_t *)malloc(num_threads * sizeof(uint64_t));
+        bitset_parallel_worker *workers = (bitset_parallel_worker *)malloc(num_threads * sizeof(bitset_parallel_worker));
+        if (bounds == NULL || deques == NULL || workers == NULL)
+        {
+            free(bounds);
+            free(deques);
+            free(workers);
+            return BitSet_for_each_set(bs, fn, ctx);
+        }
+        size_t chunk = 0;
+        size_t seen = 0;
+        bounds[0] = 0;
+        for (size_t w = 0; w < word_len && chunk + 1 < num_chunks; w++)
+        {
+            seen += bitset_popcount64(bitset_load_word(bs->bits + w * 8));
+            if (seen * num_chunks >= total * (chunk + 1))
+            {
+                bounds[++chunk] = w + 1;
+            }
+        }
+        bounds[++chunk] = word_len;
+        num_chunks = chunk;
+
+        bitset_parallel_iter iter;
+        iter.bs = bs;
+        iter.fn = fn;
+        iter.ctx = ctx;
+        iter.bounds = bounds;
+        iter.deques = deques;
+        iter.num_threads = num_threads;
+        iter.cancelled = 0;
+        for (size_t t = 0; t < num_threads; t++)
+        {
+            uint64_t head = num_chunks * t / num_threads;
+            uint64_t tail = num_chunks * (t + 1) / num_threads;
+            deques[t] = (tail << 32) | head;
+            workers[t].iter = &iter;
+            workers[t].id = t;
+        }
+        bitset_run_threads(bitset_parallel_for_each_worker, workers, sizeof(bitset_parallel_worker), num_threads);
+        free(bounds);
+        free(deques);
+        free(workers);
+        return iter.cancelled;
+    }
+#endif /* BITSET_THREADS */
+
+    bitset_internal BitSetStatus bitset_cow_init(BitSetCow *cow, size_t bit_len, const char *func)
+    {
+        cow->bit_len = bit_len;
+        cow->num_pages = (bit_len + BITSET_COW_PAGE_SIZE * 8 - 1) / (BITSET_COW_PAGE_SIZE * 8);
+        cow->pages = (bitset_cow_page **)calloc(cow->num_pages ? cow->num_pages : 1, sizeof(bitset_cow_page *));
+        if (cow->pages == NULL)
+        {
+            cow->num_pages = 0;
+            cow->bit_len = 0;
+            return bitset_report(BITSET_ERR_NO_MEMORY, func);
+        }
+        return BITSET_OK;
+    }
+
+    bitset_forced_inline BitSetStatus BitSetCow_init(BitSetCow *cow, size_t bit_len)
+    {
+        BITSET_ASSERT(cow, "BitSetCow_init: BitSetCow is NULL");
+        return bitset_cow_init(cow, bit_len, "BitSetCow_init");
+    }
+
+    bitset_forced_inline BitSetStatus BitSetCow_from_bitset(BitSetCow *cow, const BitSet *src)
+    {
+        BITSET_ASSERT(cow && src, "BitSetCow_from_bitset: Argument is NULL");
+        if (bitset_cow_init(cow, src->bit_len, "BitSetCow_from_bitset") != BITSET_OK)
+        {
+            return BITSET_ERR_NO_MEMORY;
+        }
+        size_t byte_len = BitSet_get_byte_len(src);
+        for (size_t p = 0; p < cow->num_pages; p++)
+        {
+            size_t begin = p * BITSET_COW_PAGE_SIZE;
+            size_t len = byte_len - begin < BITSET_COW_PAGE_SIZE ? byte_len - begin : BITSET_COW_PAGE_SIZE;
+            size_t i = 0;
+            while (i < len && src->bits[begin + i] == 0)
+            {
+                i++;
+            }
+            if (i == len)
+            {
+                continue;
+            }
+            bitset_cow_page *page = (bitset_cow_page *)calloc(1, sizeof(bitset_cow_page));
+            if (page == NULL)
+            {
+                BitSetCow_free(cow);
+                return bitset_report(BITSET_ERR_NO_MEMORY, "BitSetCow_from_bitset");
+            }
+            page->refs = 1;
+            memcpy(page->data, src->bits + begin, len);
+            cow->pages[p] = page;
+        }
+        return BITSET_OK;
+    }
+
+    bitset_forced_inline BitSetStatus BitSetCow_to_bitset(BitSet *dest, const BitSetCow *src)
+    {
+        BITSET_ASSERT(dest && src, "BitSetCow_to_bitset: Argument is NULL");
+        if (BitSet_try_init(dest, src->bit_len) != BITSET_OK)
+        {
+            return BITSET_ERR_NO_MEMORY;
+        }
+        size_t byte_len = BitSet_get_byte_len(dest);
+        for (size_t p = 0; p < src->num_pages; p++)
+        {
+            if (src->pages[p] == NULL)
+            {
+                continue;
+            }
+            size_t begin = p * BITSET_COW_PAGE_SIZE;
+            size_t len = byte_len - begin < BITSET_COW_PAGE_SIZE ? byte_len - begin : BITSET_COW_PAGE_SIZE;
+            memcpy(dest->bits + begin, src->pages[p]->data, len);
+        }
+        return BITSET_OK;
+    }
+
+    bitset_forced_inline void BitSetCow_free(BitSetCow *cow)
+    {
+        BITSET_ASSERT(cow, "BitSetCow_free: BitSetCow is NULL");
+        for (size_t p = 0; p < cow->num_pages; p++)
+        {
+            if (cow->pages[p] && bitset_refs_dec(&cow->pages[p]->refs) == 0)
+            {
+                free(cow->pages[p]);
+            }
+        }
+        free(cow->pages);
+        cow->pages = NULL;
+        cow->num_pages = 0;
+        cow->bit_len = 0;
+    }
+
+    bitset_forced_inline BitSetStatus BitSetCow_snapshot(BitSetCow *dest, const BitSetCow *src)
+    {
+        BITSET_ASSERT(dest && src, "BitSetCow_snapshot: BitSetCow is NULL");
+        dest->pages = (bitset_cow_page **)malloc((src->num_pages ? src->num_pages : 1) * sizeof(bitset_cow_page *));
+        if (dest->pages == NULL)
+        {
+            dest->bit_len = 0;
+            dest->num_pages = 0;
+            return bitset_report(BITSET_ERR_NO_MEMORY, "BitSetCow_snapshot");
+        }
+        dest->bit_len = src->bit_len;
+        dest->num_pages = src->num_pages;
+        for (size_t p = 0; p < src->num_pages; p++)
+        {
+            dest->pages[p] = src->pages[p];
+            if (dest->pages[p])
+            {
+                bitset_refs_inc(&dest->pages[p]->refs);
+            }
+        }
+        return BITSET_OK;
+    }
+
+    /* Returns the writable byte holding "index", cloning or allocating its page as needed, NULL if that fails. */
+    bitset_internal uint8_t *bitset_cow_byte_mut(BitSetCow *cow, size_t index)
+    {
+        size_t p = index / (BITSET_COW_PAGE_SIZE * 8);
+        bitset_cow_page *page = cow->pages[p];
+        if (page == NULL)
+        {
+            page = (bitset_cow_page *)calloc(1, sizeof(bitset_cow_page));
+            if (page == NULL)
+            {
+                return NULL;
+            }
+            page->refs = 1;
+            cow->pages[p] = page;
+        }
+        else if (bitset_refs_load(&page->refs) != 1)
+        {
+            bitset_cow_page *clone = (bitset_cow_page *)malloc(sizeof(bitset_cow_page));
+            if (clone == NULL)
+            {
+                /* the shared page is left as it was */
+                return NULL;
+            }
+            memcpy(clone->data, page->data, BITSET_COW_PAGE_SIZE);
+            clone->refs = 1;
+            if (bitset_refs_dec(&page->refs) == 0)
+            {
+                /* the other owners let go while we were copying */
+                free(page);
+            }
+            cow->pages[p] = page = clone;
+        }
+        return &page->data[(index / 8) % BITSET_COW_PAGE_SIZE];
+    }
+
+    bitset_forced_inline unsigned int BitSetCow_get(const BitSetCow *cow, size_t index)
+    {
+        BITSET_ASSERT(cow, "BitSetCow_get: BitSetCow is NULL");
+        BITSET_ASSERT(index < cow->bit_len, "BitSetCow_get: Index out of bounds");
+        const bitset_cow_page *page = cow->pages[index / (BITSET_COW_PAGE_SIZE * 8)];
+        if (page == NULL)
+        {
+            return 0;
+        }
+        return (page->data[(index / 8) % BITSET_COW_PAGE_SIZE] >> (index % 8)) & 1;
+    }
+
+    bitset_forced_inline BitSetStatus BitSetCow_set(BitSetCow *cow, size_t index)
+    {
+        BITSET_ASSERT(cow, "BitSetCow_set: BitSetCow is NULL");
+        BITSET_ASSERT(index < cow->bit_len, "BitSetCow_set: Index out of bounds");
+        uint8_t *byte = bitset_cow_byte_mut(cow, index);
+        if (byte == NULL)
+        {
+            return bitset_report(BITSET_ERR_NO_MEMORY, "BitSetCow_set");
+        }
+        *byte |= 1 << (index % 8);
+        return BITSET_OK;
+    }
+
+    bitset_forced_inline BitSetStatus BitSetCow_clear(BitSetCow *cow, size_t index)
+    {
+        BITSET_ASSERT(cow, "BitSetCow_clear: BitSetCow is NULL");
+        BITSET_ASSERT(index < cow->bit_len, "BitSetCow_clear: Index out of bounds");
+        if (cow->pages[index / (BITSET_COW_PAGE_SIZE * 8)] == NULL)
+        {
+            return BITSET_OK;
+        }
+        uint8_t *byte = bitset_cow_byte_mut(cow, index);
+        if (byte == NULL)
+        {
+            return bitset_report(BITSET_ERR_NO_MEMORY, "BitSetCow_clear");
+        }
+        *byte &= ~(1 << (index % 8));
+        return BITSET_OK;
+    }
+
+    bitset_forced_inline BitSetStatus BitSetCow_flip(BitSetCow *cow, size_t index)
+    {
+        BITSET_ASSERT(cow, "BitSetCow_flip: BitSetCow is NULL");
+        BITSET_ASSERT(index < cow->bit_len, "BitSetCow_flip: Index out of bounds");
+        uint8_t *byte = bitset_cow_byte_mut(cow, index);
+        if (byte == NULL)
+        {
+            return bitset_report(BITSET_ERR_NO_MEMORY, "BitSetCow_flip");
+        }
+        *byte ^= 1 << (index % 8);
+        return BITSET_OK;
+    }
+
+    bitset_forced_inline size_t BitSetCow_count(const BitSetCow *cow)
+    {
+        BITSET_ASSERT(cow, "BitSetCow_count: BitSetCow is NULL");
+        size_t count = 0;
+        for (size_t p = 0; p < cow->num_pages; p++)
+        {
+            if (cow->pages[p] == NULL)
+            {
+                continue;
+            }
+            for (size_t i = 0; i < BITSET_COW_PAGE_SIZE; i += 8)
+            {
+                count += bitset_popcount64(bitset_load_word(cow->pages[p]->data + i));
+            }
+        }
+        return count;
+    }
+
+    /* Bit shift of the child index at "level", leaves are level 0. */
+    bitset_internal unsigned int bitset_pnode_shift(unsigned int level)
+    {
+        return 12 + 6 * (level - 1);
+    }
+
+    bitset_internal void bitset_pnode_release(bitset_pnode *node, unsigned int level)
+    {
+        if (node == NULL || bitset_refs_dec(&node->refs) != 0)
+        {
+            return;
+        }
+        if (level > 0)
+        {
+            for (size_t c = 0; c < 64; c++)
+            {
+                bitset_pnode_release(node->u.children[c], level - 1);
+            }
+        }
+        free(node);
+    }
+
+    /* Makes "*slot" a node owned only by the caller, copying it if shared. NULL and "*slot" unchanged if that fails. */
+    bitset_internal bitset_pnode *bitset_pnode_own(bitset_pnode **slot, unsigned int level)
+    {
+        bitset_pnode *node = *slot;
+        if (node == NULL)
+        {
+            node = (bitset_pnode *)calloc(1, sizeof(bitset_pnode));
+            if (node == NULL)
+            {
+                return NULL;
+            }
+            node->refs = 1;
+        }
+        else if (bitset_refs_load(&node->refs) != 1)
+        {
+            bitset_pnode *clone = (bitset_pnode *)malloc(sizeof(bitset_pnode));
+            if (clone == NULL)
+            {
+                return NULL;
+            }
+            memcpy(clone, node, sizeof(bitset_pnode));
+            clone->refs = 1;
+            if (level > 0)
+            {
+                for (size_t c = 0; c < 64; c++)
+                {
+                    if (clone->u.children[c])
+                    {
+                        bitset_refs_inc(&clone->u.children[c]->refs);
+                    }
+                }
+            }
+            bitset_pnode_release(node, level);
+            node = clone;
+        }
+        *slot = node;
+        return node;
+    }
+
+    /*
+    Returns the owned leaf word holding "index", or NULL if "create" is 0 and the path does not exist or a node
+    cannot be allocated. The nodes already made private on the way down hold the same bits, so the version is
+    unchanged after a failure.
+    */
+    bitset_internal uint64_t *bitset_persistent_word_mut(BitSetPersistent *p, size_t index, int create)
+    {
+        bitset_pnode **slot = &p->root;
+        for (unsigned int level = p->depth;; level--)
+        {
+            if (*slot == NULL && !create)
+            {
+                return NULL;
+            }
+            bitset_pnode *node = bitset_pnode_own(slot, level);
+            if (node == NULL)
+            {
+                return NULL;
+            }
+            if (level == 0)
+            {
+                return &node->u.words[(index >> 6) & 63];
+            }
+            slot = &node->u.children[(index >> bitset_pnode_shift(level)) & 63];
+        }
+    }
+
+    bitset_forced_inline void BitSetPersistent_init(BitSetPersistent *p, size_t bit_len)
+    {
+        BITSET_ASSERT(p, "BitSetPersistent_init: BitSetPersistent is NULL");
+        p->root = NULL;
+        p->bit_len = bit_len;
+        p->depth = 0;
+        while (bit_len != 0 && p->depth < 9 && (bit_len - 1) >> bitset_pnode_shift(p->depth + 1) != 0)
+        {
+            p->depth++;
+        }
+    }
+
+    bitset_forced_inline void BitSetPersistent_free(BitSetPersistent *p)
+    {
+        BITSET_ASSERT(p, "BitSetPersistent_free: BitSetPersistent is NULL");
+        bitset_pnode_release(p->root, p->depth);
+        p->root = NULL;
+        p->bit_len = 0;
+        p->depth = 0;
+    }
+
+    bitset_forced_inline void BitSetPersistent_copy(BitSetPersistent *dest, const BitSetPersistent *src)
+    {
+        BITSET_ASSERT(dest && src, "BitSetPersistent_copy: BitSetPersistent is NULL");
+        *dest = *src;
+        if (dest->root)
+        {
+            bitset_refs_inc(&dest->root->refs);
+        }
+    }
+
+    bitset_forced_inline unsigned int BitSetPersistent_get(const BitSetPersistent *p, size_t index)
+    {
+        BITSET_ASSERT(p, "BitSetPersistent_get: BitSetPersistent is NULL");
+        BITSET_ASSERT(index < p->bit_len, "BitSetPersistent_get: Index out of bounds");
+        const bitset_pnode *node = p->root;
+        for (unsigned int level = p->depth; level > 0 && node; level--)
+        {
+            node = node->u.children[(index >> bitset_pnode_shift(level)) & 63];
+        }
+        if (node == NULL)
+        {
+            return 0;
+        }
+        return (unsigned int)(node->u.words[(index >> 6) & 63] >> (index & 63)) & 1;
+    }
+
+    bitset_forced_inline BitSetStatus BitSetPersistent_set_mut(BitSetPersistent *p, size_t index)
+    {
+        BITSET_ASSERT(p, "BitSetPersistent_set_mut: BitSetPersistent is NULL");
+        BITSET_ASSERT(index < p->bit_len, "BitSetPersistent_set_mut: Index out of bounds");
+        uint64_t *word = bitset_persistent_word_mut(p, index, 1);
+        if (word == NULL)
+        {
+            return bitset_report(BITSET_ERR_NO_MEMORY, "BitSetPersistent_set_mut");
+        }
+        *word |= (uint64_t)1 << (index & 63);
+        return BITSET_OK;
+    }
+
+    bitset_forced_inline BitSetStatus BitSetPersistent_clear_mut(BitSetPersistent *p, size_t index)
+    {
+        BITSET_ASSERT(p, "BitSetPersistent_clear_mut: BitSetPersistent is NULL");
+        BITSET_ASSERT(index < p->bit_len, "BitSetPersistent_clear_mut: Index out of bounds");
+        if (BitSetPersistent_get(p, index) == 0)
+        {
+            return BITSET_OK;
+        }
+        /* the path exists, so NULL means a shared node could not be copied */
+        uint64_t *word = bitset_persistent_word_mut(p, index, 0);
+        if (word == NULL)
+        {
+            return bitset_report(BITSET_ERR_NO_MEMORY, "BitSetPersistent_clear_mut");
+        }
+        *word &= ~((uint64_t)1 << (index & 63));
+        return BITSET_OK;
+    }
+
+    bitset_forced_inline BitSetStatus BitSetPersistent_set(BitSetPersistent *dest, const BitSetPersistent *src, size_t index)
+    {
+        BITSET_ASSERT(dest && src, "BitSetPersistent_set: BitSetPersistent is NULL");
+        /* "dest" replaces "src", copying it first would leave the old root with a reference nobody owns */
+        if (dest != src)
+        {
+            BitSetPersistent_copy(dest, src);
+        }
+        return BitSetPersistent_set_mut(dest, index);
+    }
+
+    bitset_forced_inline BitSetStatus BitSetPersistent_clear(BitSetPersistent *dest, const BitSetPersistent *src, size_t index)
+    {
+        BITSET_ASSERT(dest && src, "BitSetPersistent_clear: BitSetPersistent is NULL");
+        /* "dest" replaces "src", copying it first would leave the old root with a reference nobody owns */
+        if (dest != src)
+        {
+            BitSetPersistent_copy(dest, src);
+        }
+        return BitSetPersistent_clear_mut(dest, index);
+    }
+
+    bitset_internal int bitset_pnode_diff(const bitset_pnode *a, const bitset_pnode *b, unsigned int level, size_t base, BitSetIndexFn fn, void *ctx)
+    {
+        if (a == b)
+        {
+            return 0;
+        }
+        if (level == 0)
+        {
+            for (size_t w = 0; w < 64; w++)
+            {
+                uint64_t x = (a ? a->u.words[w] : 0) ^ (b ? b->u.words[w] : 0);
+                while (x)
+                {
+                    if (fn(base + w * 64 + bitset_ctz64(x), ctx))
+                    {
+                        return 1;
+                    }
+                    x &= x - 1;
+                }
+            }
+            return 0;
+        }
+        size_t span = (size_t)1 << bitset_pnode_shift(level);
+        for (size_t c = 0; c < 64; c++)
+        {
+            if (bitset_pnode_diff(a ? a->u.children[c] : NULL, b ? b->u.children[c] : NULL, level - 1, base + c * span, fn, ctx))
+            {
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    bitset_forced_inline int BitSetPersistent_diff(const BitSetPersistent *a, const BitSetPersistent *b, BitSetIndexFn fn, void *ctx)
+    {
+        BITSET_ASSERT(a && b && fn, "BitSetPersistent_diff: Argument is NULL");
+        BITSET_ASSERT(a->bit_len == b->bit_len, "BitSetPersistent_diff: Length mismatch");
+        return bitset_pnode_diff(a->root, b->root, a->depth, 0, fn, ctx);
+    }
+
+    typedef struct
+    {
+        uint8_t *data;
+        size_t len;
+        size_t cap;
+    } bitset_buffer;
+
+    /* Returns 0 if the buffer cannot grow, "buf" is left as it was */
+    bitset_internal int bitset_buffer_reserve(bitset_buffer *buf, size_t extra)
+    {
+        if (buf->len + extra <= buf->cap)
+        {
+            return 1;
+        }
+        size_t cap = buf->cap ? buf->cap * 2 : 64;
+        while (cap < buf->len + extra)
+        {
+            cap *= 2;
+        }
+        uint8_t *data = (uint8_t *)realloc(buf->data, cap);
+        if (data == NULL)
+        {
+            return 0;
+        }
+        buf->data = data;
+        buf->cap = cap;
+        return 1;
+    }
+
+    bitset_internal int bitset_buffer_put_varint(bitset_buffer *buf, uint64_t v)
+    {
+        if (!bitset_buffer_reserve(buf, 10))
+        {
+            return 0;
+        }
+        while (v >= 0x80)
+        {
+            buf->data[buf->len++] = (uint8_t)(v | 0x80);
+            v >>= 7;
+        }
+        buf->data[buf->len++] = (uint8_t)v;
+        return 1;
+    }
+
+    /* Returns 0 if the varint runs past "end" or overflows. */
+    bitset_internal int bitset_get_varint(const uint8_t **p, const uint8_t *end, uint64_t *v)
+    {
+        uint64_t result = 0;
+        for (unsigned int shift = 0; shift < 64 && *p < end; shift += 7)
+        {
+            uint8_t byte = *(*p)++;
+            result |= (uint64_t)(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+            {
+                *v = result;
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    bitset_forced_inline size_t BitSet_diff(const BitSet *old_bs, const BitSet *new_bs, uint8_t **patch)
+    {
+        BITSET_ASSERT(old_bs && new_bs && patch, "BitSet_diff: Argument is NULL");
+        BITSET_ASSERT(old_bs->bit_len == new_bs->bit_len, "BitSet_diff: Length mismatch");
+        bitset_buffer buf = {NULL, 0, 0};
+        *patch = NULL;
+        if (!bitset_buffer_put_varint(&buf, new_bs->bit_len))
+        {
+            bitset_report(BITSET_ERR_NO_MEMORY, "BitSet_diff");
+            return SIZE_MAX;
+        }
+        size_t word_len = BitSet_get_word_len(new_bs);
+        size_t last = 0;
+        size_t i = 0;
+        while (i < word_len)
+        {
+            /* skip identical regions a 64 byte block at a time */
+            if (i % 8 == 0 && i + 8 <= word_len && memcmp(old_bs->bits + i * 8, new_bs->bits + i * 8, 64) == 0)
+            {
+                i += 8;
+                continue;
+            }
+            if (bitset_load_word(old_bs->bits + i * 8) == bitset_load_word(new_bs->bits + i * 8))
+            {
+                i++;
+                continue;
+            }
+            size_t run = i;
+            while (run < word_len && bitset_load_word(old_bs->bits + run * 8) != bitset_load_word(new_bs->bits + run * 8))
+            {
+                run++;
+            }
+            if (!bitset_buffer_put_varint(&buf, i - last) || !bitset_buffer_put_varint(&buf, run - i) ||
+                !bitset_buffer_reserve(&buf, (run - i) * 8))
+            {
+                free(buf.data);
+                bitset_report(BITSET_ERR_NO_MEMORY, "BitSet_diff");
+                return SIZE_MAX;
+            }
+            for (; i < run; i++)
+            {
+                uint64_t mask = bitset_load_word(old_bs->bits + i * 8) ^ bitset_load_word(new_bs->bits + i * 8);
+                bitset_store_word(buf.data + buf.len, mask);
+                buf.len += 8;
+            }
+            last = run;
+        }
+        /* an empty run up to the last word ends the patch, so a truncated one is detected */
+        if (!bitset_buffer_put_varint(&buf, word_len - last) || !bitset_buffer_put_varint(&buf, 0))
+        {
+            free(buf.data);
+            bitset_report(BITSET_ERR_NO_MEMORY, "BitSet_diff");
+            return SIZE_MAX;
+        }
+        *patch = buf.data;
+        return buf.len;
+    }
+
+    /* Walks the runs of a patch after its header and XORs them into "bs" when "apply" is set, returns 0 on a
+       truncated varint, a run past the end of "bs" or a missing end run */
+    bitset_internal int bitset_patch_walk(BitSet *bs, const uint8_t *p, const uint8_t *end, int apply)
+    {
+        size_t word_len = BitSet_get_word_len(bs);
+        size_t word = 0;
+        uint64_t run = 1;
+        while (p < end)
+        {
+            uint64_t gap;
+            if (!bitset_get_varint(&p, end, &gap) || !bitset_get_varint(&p, end, &run))
+            {
+                return 0;
+            }
+            if (gap > word_len - word || run > word_len - word - gap || run > (size_t)(end - p) / 8)
+            {
+                return 0;
+            }
+            word += gap;
+            if (!apply)
+            {
+                word += run;
+                p += run * 8;
+                continue;
+            }
+            for (uint64_t r = 0; r < run; r++, word++, p += 8)
+            {
+                uint8_t *w = bs->bits + word * 8;
+                bitset_store_word(w, bitset_load_word(w) ^ bitset_load_word(p));
+            }
+            bitset_mark_dirty_range(bs, (word - run) * 8, word * 8);
+        }
+        return run == 0 && word == word_len;
+    }
+
+    bitset_forced_inline int BitSet_apply_patch(BitSet *bs, const uint8_t *patch, size_t patch_len)
+    {
+        BITSET_ASSERT(bs && (patch || patch_len == 0), "BitSet_apply_patch: Argument is NULL");
+        const uint8_t *p = patch;
+        const uint8_t *end = patch + patch_len;
+        uint64_t bit_len;
+        if (!bitset_get_varint(&p, end, &bit_len) || bit_len != bs->bit_len)
+        {
+            return 0;
+        }
+        if (!bitset_patch_walk(bs, p, end, 0))
+        {
+            return 0;
+        }
+        return bitset_patch_walk(bs, p, end, 1);
+    }
+
+    bitset_forced_inline void BitSet_enable_dirty_tracking(BitSet *bs)
+    {
+        BITSET_ASSERT(bs, "BitSet_enable_dirty_tracking: BitSet is NULL");
+        if (bs->page_flags & BITSET_PAGE_DIRTY)
+        {
+            return;
+        }
+        BitSetStatus status = bitset_enable_page_flag(bs, BITSET_PAGE_DIRTY, 0, "BitSet_enable_dirty_tracking");
+        BITSET_ASSERT(status == BITSET_OK, "BitSet_enable_dirty_tracking: Memory allocation failed");
+        (void)status;
+    }
+
+    bitset_forced_inline void BitSet_disable_dirty_tracking(BitSet *bs)
+    {
+        BITSET_ASSERT(bs, "BitSet_disable_dirty_tracking: BitSet is NULL");
+        bitset_disable_page_flag(bs, BITSET_PAGE_DIRTY);
+    }
+
+    bitset_forced_inline void BitSet_enable_lazy_clear(BitSet *bs)
+    {
+        BITSET_ASSERT(bs, "BitSet_enable_lazy_clear: BitSet is NULL");
+        if (bs->page_flags & BITSET_PAGE_TOUCHED)
+        {
+            return;
+        }
+        BitSetStatus status = bitset_enable_page_flag(bs, BITSET_PAGE_TOUCHED, BITSET_PAGE_TOUCHED, "BitSet_enable_lazy_clear");
+        BITSET_ASSERT(status == BITSET_OK, "BitSet_enable_lazy_clear: Memory allocation failed");
+        (void)status;
+    }
+
+    bitset_forced_inline void BitSet_disable_lazy_clear(BitSet *bs)
+    {
+        BITSET_ASSERT(bs, "BitSet_disable_lazy_clear: BitSet is NULL");
+        bitset_disable_page_flag(bs, BITSET_PAGE_TOUCHED);
+    }
+
+    bitset_forced_inline size_t BitSet_dirty_page_count(const BitSet *bs)
+    {
+        BITSET_ASSERT(bs, "BitSet_dirty_page_count: BitSet is NULL");
+        if (!(bs->page_flags & BITSET_PAGE_DIRTY))
+        {
+            return 0;
+        }
+        size_t pages = (BitSet_get_byte_len(bs) + BITSET_DIRTY_PAGE_SIZE - 1) / BITSET_DIRTY_PAGE_SIZE;
+        size_t count = 0;
+        for (size_t p = 0; p < pages; p++)
+        {
+            count += (bs->dirty[p] & BITSET_PAGE_DIRTY) != 0;
+        }
+        return count;
+    }
+
+#if defined(__unix__) || defined(__APPLE__)
+    bitset_forced_inline int BitSet_flush_dirty(BitSet *bs, int fd, off_t offset)
+    {
+        BITSET_ASSERT(bs, "BitSet_flush_dirty: BitSet is NULL");
+        BITSET_ASSERT(bs->page_flags & BITSET_PAGE_DIRTY, "BitSet_flush_dirty: Dirty tracking is not enabled");
+        size_t byte_len = BitSet_get_byte_len(bs);
+        size_t pages = (byte_len + BITSET_DIRTY_PAGE_SIZE - 1) / BITSET_DIRTY_PAGE_SIZE;
+        size_t p = 0;
+        while (p < pages)
+        {
+            if (!(bs->dirty[p] & BITSET_PAGE_DIRTY))
+            {
+                p++;
+                continue;
+            }
+            /* coalesce adjacent dirty pages into one write */
+            size_t first = p;
+            while (p < pages && (bs->dirty[p] & BITSET_PAGE_DIRTY))
+            {
+                p++;
+            }
+            size_t begin = first * BITSET_DIRTY_PAGE_SIZE;
+            size_t end = p * BITSET_DIRTY_PAGE_SIZE < byte_len ? p * BITSET_DIRTY_PAGE_SIZE : byte_len;
+            while (begin < end)
+            {
+                ssize_t written = pwrite(fd, bs->bits + begin, end - begin, offset + (off_t)begin);
+                if (written < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    return 0;
+                }
+                begin += (size_t)written;
+            }
+            for (size_t q = first; q < p; q++)
+            {
+                bs->dirty[q] &= (uint8_t)~BITSET_PAGE_DIRTY;
+            }
+        }
+        return 1;
+    }
+#endif
+
+    bitset_forced_inline BitSetStatus BitSetSharded_init(BitSetSharded *sh, size_t bit_len, size_t num_shards)
+    {
+        BITSET_ASSERT(sh, "BitSetSharded_init: BitSetSharded is NULL");
+        sh->num_shards = 0;
+        sh->shards = NULL;
+        if (BitSet_try_init(&sh->main, bit_len) != BITSET_OK)
+        {
+            return BITSET_ERR_NO_MEMORY;
+        }
+        sh->shards = (bitset_shard *)bitset_aligned_alloc((num_shards ? num_shards : 1) * sizeof(bitset_shard), 64);
+        if (sh->shards == NULL)
+        {
+            BitSet_free(&sh->main);
+            return bitset_report(BITSET_ERR_NO_MEMORY, "BitSetSharded_init");
+        }
+        for (; sh->num_shards < num_shards; sh->num_shards++)
+        {
+            BitSet *shard = &sh->shards[sh->num_shards].bs;
+            if (BitSet_try_init(shard, bit_len) != BITSET_OK)
+            {
+                BitSetSharded_free(sh);
+                return BITSET_ERR_NO_MEMORY;
+            }
+            /* merge relies on the page map */
+            if (bitset_enable_page_flag(shard, BITSET_PAGE_DIRTY, 0, "BitSetSharded_init") != BITSET_OK)
+            {
+                BitSet_free(shard);
+                BitSetSharded_free(sh);
+                return BITSET_ERR_NO_MEMORY;
+            }
+        }
+        return BITSET_OK;
+    }
+
+    bitset_forced_inline void BitSetSharded_free(BitSetSharded *sh)
+    {
+        BITSET_ASSERT(sh, "BitSetSharded_free: BitSetSharded is NULL");
+        for (size_t i = 0; i < sh->num_shards; i++)
+        {
+            BitSet_free(&sh->shards[i].bs);
+        }
+        bitset_aligned_free(sh->shards);
+        BitSet_free(&sh->main);
+        sh->shards = NULL;
+        sh->num_shards = 0;
+    }
+
+    bitset_forced_inline void BitSetSharded_set(BitSetSharded *sh, size_t shard, size_t index)
+    {
+        BITSET_ASSERT(sh, "BitSetSharded_set: BitSetSharded is NULL");
+        BITSET_ASSERT(shard < sh->num_shards, "BitSetSharded_set: Shard out of bounds");
+        BitSet_set(&sh->shards[shard].bs, index);
+    }
+
+    bitset_forced_inline void BitSetSharded_merge(BitSetSharded *sh)
+    {
+        BITSET_ASSERT(sh, "BitSetSharded_merge: BitSetSharded is NULL");
+        size_t byte_len = BitSet_get_word_len(&sh->main) * 8;
+        size_t pages = (BitSet_get_byte_len(&sh->main) + BITSET_DIRTY_PAGE_SIZE - 1) / BITSET_DIRTY_PAGE_SIZE;
+        for (size_t i = 0; i < sh->num_shards; i++)
+        {
+            BitSet *shard = &sh->shards[i].bs;
+            for (size_t p = 0; p < pages; p++)
+            {
+                if (!(shard->dirty[p] & BITSET_PAGE_DIRTY))
+                {
+                    continue;
+                }
+                size_t begin = p * BITSET_DIRTY_PAGE_SIZE;
+                size_t end = begin + BITSET_DIRTY_PAGE_SIZE < byte_len ? begin + BITSET_DIRTY_PAGE_SIZE : byte_len;
+                for (size_t b = begin; b < end; b += 8)
+                {
+                    bitset_store_word(sh->main.bits + b, bitset_load_word(sh->main.bits + b) | bitset_load_word(shard->bits + b));
+                }
+                memset(shard->bits + begin, 0, end - begin);
+                shard->dirty[p] &= (uint8_t)~BITSET_PAGE_DIRTY;
+                bitset_mark_dirty_range(&sh->main, begin, end);
+            }
+        }
+    }
+
+    bitset_forced_inline const BitSet *BitSetSharded_main(const BitSetSharded *sh)
+    {
+        BITSET_ASSERT(sh, "BitSetSharded_main: BitSetSharded is NULL");
+        return &sh->main;
+    }
+
+    bitset_forced_inline unsigned int BitSetSharded_get(const BitSetSharded *sh, size_t index)
+    {
+        BITSET_ASSERT(sh, "BitSetSharded_get: BitSetSharded is NULL");
+        unsigned int bit = BitSet_get(&sh->main, index);
+        for (size_t i = 0; i < sh->num_shards && !bit; i++)
+        {
+            bit = BitSet_get(&sh->shards[i].bs, index);
+        }
+        return bit;
+    }
+
+    /* Word "w" of the union of the main BitSet and every shard. */
+    bitset_internal uint64_t bitset_sharded_word(const BitSetSharded *sh, size_t w)
+    {
+        uint64_t word = bitset_load_word(sh->main.bits + w * 8);
+        for (size_t i = 0; i < sh->num_shards; i++)
+        {
+            word |= bitset_load_word(sh->shards[i].bs.bits + w * 8);
+        }
+        return word;
+    }
+
+    bitset_forced_inline size_t BitSetSharded_count(const BitSetSharded *sh)
+    {
+        BITSET_ASSERT(sh, "BitSetSharded_count: BitSetSharded is NULL");
+        size_t word_len = BitSet_get_word_len(&sh->main);
+        size_t count = 0;
+        for (size_t w = 0; w < word_len; w++)
+        {
+            count += bitset_popcount64(bitset_sharded_word(sh, w));
+        }
+        return count;
+    }
+
+    bitset_forced_inline int BitSetSharded_for_each_set(const BitSetSharded *sh, BitSetIndexFn fn, void *ctx)
+    {
+        BITSET_ASSERT(sh && fn, "BitSetSharded_for_each_set: Argument is NULL");
+        size_t word_len = BitSet_get_word_len(&sh->main);
+        for (size_t w = 0; w < word_len; w++)
+        {
+            uint64_t word = bitset_sharded_word(sh, w);
+            while (word)
+            {
+                if (fn(w * 64 + bitset_ctz64(word), ctx))
+                {
+                    return 1;
+                }
+                word &= word - 1;
+            }
+        }
+        return 0;
+    }
+
+    bitset_forced_inline BitSetStatus BitSetStamped_init(BitSetStamped *st, size_t bit_len)
+    {
+        BITSET_ASSERT(st, "BitSetStamped_init: BitSetStamped is NULL");
+        size_t word_len = (bit_len + 63) / 64;
+        st->words = (bitset_stamped_word *)calloc(word_len ? word_len : 1, sizeof(bitset_stamped_word));
+        st->epoch = 1;
+        st->bit_len = 0;
+        if (st->words == NULL)
+        {
+            return bitset_report(BITSET_ERR_NO_MEMORY, "BitSetStamped_init");
+        }
+        st->bit_len = bit_len;
+        return BITSET_OK;
+    }
+
+    bitset_forced_inline void BitSetStamped_free(BitSetStamped *st)
+    {
+        BITSET_ASSERT(st, "BitSetStamped_free: BitSetStamped is NULL");
+        free(st->words);
+        st->words = NULL;
+        st->bit_len = 0;
+    }
+
+    bitset_forced_inline unsigned int BitSetStamped_get(const BitSetStamped *st, size_t index)
+    {
+        BITSET_ASSERT(st, "BitSetStamped_get: BitSetStamped is NULL");
+        BITSET_ASSERT(index < st->bit_len, "BitSetStamped_get: Index out of bounds");
+        const bitset_stamped_word *w = &st->words[index / 64];
+        return w->stamp == st->epoch ? (unsigned int)((w->bits >> (index % 64)) & 1) : 0;
+    }
+
+    /* Returns the word holding "index", reset to zero first if it is stale */
+    bitset_internal uint64_t *bitset_stamped_fresh(BitSetStamped *st, size_t index)
+    {
+        bitset_stamped_word *w = &st->words[index / 64];
+        if (w->stamp != st->epoch)
+        {
+            w->bits = 0;
+            w->stamp = st->epoch;
+        }
+        return &w->bits;
+    }
+
+    bitset_forced_inline void BitSetStamped_set(BitSetStamped *st, size_t index)
+    {
+        BITSET_ASSERT(st, "BitSetStamped_set: BitSetStamped is NULL");
+        BITSET_ASSERT(index < st->bit_len, "BitSetStamped_set: Index out of bounds");
+        *bitset_stamped_fresh(st, index) |= (uint64_t)1 << (index % 64);
+    }
+
+    bitset_forced_inline void BitSetStamped_clear(BitSetStamped *st, size_t index)
+    {
+        BITSET_ASSERT(st, "BitSetStamped_clear: BitSetStamped is NULL");
+        BITSET_ASSERT(index < st->bit_len, "BitSetStamped_clear: Index out of bounds");
+        *bitset_stamped_fresh(st, index) &= ~((uint64_t)1 << (index % 64));
+    }
+
+    bitset_forced_inline unsigned int BitSetStamped_test_and_set(BitSetStamped *st, size_t index)
+    {
+        BITSET_ASSERT(st, "BitSetStamped_test_and_set: BitSetStamped is NULL");
+        BITSET_ASSERT(index < st->bit_len, "BitSetStamped_test_and_set: Index out of bounds");
+        uint64_t *w = bitset_stamped_fresh(st, index);
+        uint64_t mask = (uint64_t)1 << (index % 64);
+        unsigned int old = (*w & mask) != 0;
+        *w |= mask;
+        return old;
+    }
+
+    bitset_forced_inline void BitSetStamped_clear_all(BitSetStamped *st)
+    {
+        BITSET_ASSERT(st, "BitSetStamped_clear_all: BitSetStamped is NULL");
+        if (++st->epoch == 0)
+        {
+            /* wrapped around, old stamps could alias new epochs */
+            size_t word_len = (st->bit_len + 63) / 64;
+            for (size_t w = 0; w < word_len; w++)
+            {
+                st->words[w].stamp = 0;
+            }
+            st->epoch = 1;
+        }
+    }
+
+    bitset_forced_inline size_t BitSetStamped_count(const BitSetStamped *st)
+    {
+        BITSET_ASSERT(st, "BitSetStamped_count: BitSetStamped is NULL");
+        size_t word_len = (st->bit_len + 63) / 64;
+        size_t count = 0;
+        for (size_t w = 0; w < word_len; w++)
+        {
+            count += st->words[w].stamp == st->epoch ? bitset_popcount64(st->words[w].bits) : 0;
+        }
+        return count;
+    }
+
+    bitset_forced_inline int BitSetStamped_for_each_set(const BitSetStamped *st, BitSetIndexFn fn, void *ctx)
+    {
+        BITSET_ASSERT(st && fn, "BitSetStamped_for_each_set: Argument is NULL");
+        size_t word_len = (st->bit_len + 63) / 64;
+        for (size_t w = 0; w < word_len; w++)
+        {
+            uint64_t word = st->words[w].stamp == st->epoch ? st->words[w].bits : 0;
+            while (word)
+            {
+                if (fn(w * 64 + bitset_ctz64(word), ctx))
+                {
+                    return 1;
+                }
+                word &= word - 1;
+            }
+        }
+        return 0;
+    }
+
+    /* Shift-Or masks: bit "i" of peq[c] is 0 when row "i" of the packed patterns is byte "c" */
+    bitset_internal uint64_t *bitset_peq_alloc(size_t words, uint64_t fill)
+    {
+        if (words > SIZE_MAX / 256 / sizeof(uint64_t))
+        {
+            return NULL;
+        }
+        uint64_t *peq = (uint64_t *)malloc(256 * words * sizeof(uint64_t));
+        if (peq)
+        {
+            for (size_t i = 0; i < 256 * words; i++)
+            {
+                peq[i] = fill;
+            }
+        }
+        return peq;
+    }
+
+    bitset_forced_inline int BitSet_match_exact(const uint8_t *text, size_t text_len, const uint8_t *const *patterns,
+                                                const size_t *pattern_lens, size_t num_patterns, BitSetMatchFn fn,
+                                                void *ctx)
+    {
+        BITSET_ASSERT((text || text_len == 0) && ((patterns && pattern_lens) || num_patterns == 0) && fn,
+                      "BitSet_match_exact: Argument is NULL");
+        size_t rows = 0;
+        for (size_t p = 0; p < num_patterns; p++)
+        {
+            rows += pattern_lens[p];
+        }
+        if (rows == 0)
+        {
+            return 0;
+        }
+        size_t words = (rows + 63) / 64;
+        uint64_t *peq = bitset_peq_alloc(words, ~(uint64_t)0);
+        /* state, first row of every pattern, last row of every pattern */
+        uint64_t *d = (uint64_t *)malloc(3 * words * sizeof(uint64_t));
+        /* pattern owning each row, only read for the last rows */
+        size_t *owner = (size_t *)malloc(rows * sizeof(size_t));
+        if (peq == NULL || d == NULL || owner == NULL)
+        {
+            free(peq);
+            free(d);
+            free(owner);
+            bitset_report(BITSET_ERR_NO_MEMORY, "BitSet_match_exact");
+            return -1;
+        }
+        uint64_t *first = d + words;
+        uint64_t *last = d + 2 * words;
+        for (size_t w = 0; w < words; w++)
+        {
+            d[w] = ~(uint64_t)0;
+            first[w] = 0;
+            last[w] = 0;
+        }
+        size_t row = 0;
+        for (size_t p = 0; p < num_patterns; p++)
+        {
+            if (pattern_lens[p] == 0)
+            {
+                continue;
+            }
+            first[row / 64] |= (uint64_t)1 << (row % 64);
+            for (size_t i = 0; i < pattern_lens[p]; i++, row++)
+            {
+                peq[patterns[p][i] * words + row / 64] &= ~((uint64_t)1 << (row % 64));
+                owner[row] = p;
+            }
+            last[(row - 1) / 64] |= (uint64_t)1 << ((row - 1) % 64);
+        }
+        /* the padding rows never match */
+        if (rows % 64)
+        {
+            for (size_t c = 0; c < 256; c++)
+            {
+                peq[c * words + words - 1] |= ~(uint64_t)0 << (rows % 64);
+            }
+        }
+        int stopped = 0;
+        for (size_t j = 0; j < text_len && !stopped; j++)
+        {
+            const uint64_t *eq = peq + text[j] * words;
+            uint64_t carry = 0;
+            for (size_t w = 0; w < words; w++)
+            {
+                /* a zero shifted into the first row of a pattern starts a new candidate there */
+                uint64_t next = ((d[w] << 1) | carry) & ~first[w];
+                carry = d[w] >> 63;
+                d[w] = next | eq[w];
+                uint64_t hits = ~d[w] & last[w];
+                while (hits && !stopped)
+                {
+                    stopped = fn(owner[w * 64 + bitset_ctz64(hits)], j, 0, ctx) != 0;
+                    hits &= hits - 1;
+                }
+            }
+        }
+        free(peq);
+        free(d);
+        free(owner);
+        return stopped;
+    }
+
+    /*
+    One column step of Myers' algorithm for a 64 row block. "hin" is the horizontal delta entering the bottom row
+    of the block from the block below, the return value is the delta leaving row "high" at the top.
+    */
+    bitset_internal int bitset_myers_block(uint64_t *pv, uint64_t *mv, uint64_t eq, int hin, uint64_t high)
+    {
+        uint64_t xv = eq | *mv;
+        if (hin < 0)
+        {
+            eq |= 1;
+        }
+        uint64_t xh = (((eq & *pv) + *pv) ^ *pv) | eq;
+        uint64_t ph = *mv | ~(xh | *pv);
+        uint64_t mh = *pv & xh;
+        int hout = (ph & high) ? 1 : (mh & high) ? -1 : 0;
+        ph <<= 1;
+        mh <<= 1;
+        if (hin < 0)
+        {
+            mh |= 1;
+        }
+        else if (hin > 0)
+        {
+            ph |= 1;
+        }
+        *pv = mh | ~(xv | ph);
+        *mv = ph & xv;
+        return hout;
+    }
+
+    /* Runs Myers' algorithm over "text", "top" is the delta of the first DP row: 0 to search, 1 for a global distance */
+    bitset_internal int bitset_myers(const uint8_t *text, size_t text_len, const uint8_t *pattern, size_t pattern_len,
+                                     int top, size_t max_distance, BitSetMatchFn fn, void *ctx, size_t *score_out)
+    {
+        size_t words = (pattern_len + 63) / 64;
+        uint64_t *peq = bitset_peq_alloc(words, 0);
+        uint64_t *pv = (uint64_t *)malloc(2 * words * sizeof(uint64_t));
+        if (peq == NULL || pv == NULL)
+        {
+            free(peq);
+            free(pv);
+            return -1;
+        }
+        uint64_t *mv = pv + words;
+        for (size_t i = 0; i < pattern_len; i++)
+        {
+            peq[pattern[i] * words + i / 64] |= (uint64_t)1 << (i % 64);
+        }
+        for (size_t w = 0; w < words; w++)
+        {
+            pv[w] = ~(uint64_t)0;
+            mv[w] = 0;
+        }
+        uint64_t high = (uint64_t)1 << ((pattern_len - 1) % 64);
+        size_t score = pattern_len;
+        int stopped = 0;
+        for (size_t j = 0; j < text_len && !stopped; j++)
+        {
+            const uint64_t *eq = peq + text[j] * words;
+            int h = top;
+            for (size_t w = 0; w + 1 < words; w++)
+            {
+                h = bitset_myers_block(&pv[w], &mv[w], eq[w], h, (uint64_t)1 << 63);
+            }
+            h = bitset_myers_block(&pv[words - 1], &mv[words - 1], eq[words - 1], h, high);
+            score += h;
+            if (fn && score <= max_distance)
+            {
+                stopped = fn(0, j, score, ctx) != 0;
+            }
+        }
+        free(peq);
+        free(pv);
+        if (score_out)
+        {
+            *score_out = score;
+        }
+        return stopped;
+    }
+
+    bitset_forced_inline int BitSet_match_approx(const uint8_t *text, size_t text_len, const uint8_t *pattern,
+                                                 size_t pattern_len, size_t max_distance, BitSetMatchFn fn, void *ctx)
+    {
+        BITSET_ASSERT((text || text_len == 0) && pattern && fn, "BitSet_match_approx: Argument is NULL");
+        BITSET_ASSERT(pattern_len > 0, "BitSet_match_approx: Pattern is empty");
+        int result = bitset_myers(text, text_len, pattern, pattern_len, 0, max_distance, fn, ctx, NULL);
+        if (result < 0)
+        {
+            bitset_report(BITSET_ERR_NO_MEMORY, "BitSet_match_approx");
+        }
+        return result;
+    }
+
+    bitset_forced_inline size_t BitSet_edit_distance(const uint8_t *a, size_t a_len, const uint8_t *b, size_t b_len)
+    {
+        BITSET_ASSERT((a || a_len == 0) && (b || b_len == 0), "BitSet_edit_distance: Argument is NULL");
+        if (a_len == 0 || b_len == 0)
+        {
+            return a_len + b_len;
+        }
+        /* the shorter string is the pattern, so it spans the fewest words */
+        const uint8_t *pattern = a_len < b_len ? a : b;
+        const uint8_t *text = a_len < b_len ? b : a;
+        size_t pattern_len = a_len < b_len ? a_len : b_len;
+        size_t text_len = a_len < b_len ? b_len : a_len;
+        size_t score = 0;
+        if (bitset_myers(text, text_len, pattern, pattern_len, 1, 0, NULL, NULL, &score) < 0)
+        {
+            bitset_report(BITSET_ERR_NO_MEMORY, "BitSet_edit_distance");
+            return SIZE_MAX;
+        }
+        return score;
+    }
+
+    bitset_forced_inline size_t BitSet_lcs_length(const uint8_t *a, size_t a_len, const uint8_t *b, size_t b_len)
+    {
+        BITSET_ASSERT((a || a_len == 0) && (b || b_len == 0), "BitSet_lcs_length: Argument is NULL");
+        if (a_len == 0 || b_len == 0)
+        {
+            return 0;
+        }
+        /* the shorter string indexes the bits */
+        const uint8_t *pattern = a_len < b_len ? a : b;
+        const uint8_t *text = a_len < b_len ? b : a;
+        size_t m = a_len < b_len ? a_len : b_len;
+        size_t n = a_len < b_len ? b_len : a_len;
+        size_t words = (m + 63) / 64;
+        uint64_t *peq = bitset_peq_alloc(words, 0);
+        uint64_t *v = (uint64_t *)malloc(words * sizeof(uint64_t));
+        if (peq == NULL || v == NULL)
+        {
+            free(peq);
+            free(v);
+            bitset_report(BITSET_ERR_NO_MEMORY, "BitSet_lcs_length");
+            return SIZE_MAX;
+        }
+        for (size_t i = 0; i < m; i++)
+        {
+            peq[pattern[i] * words + i / 64] |= (uint64_t)1 << (i % 64);
+        }
+        for (size_t w = 0; w < words; w++)
+        {
+            v[w] = ~(uint64_t)0;
+        }
+        for (size_t j = 0; j < n; j++)
+        {
+            /* V = (V + (V & M)) | (V & ~M), the add carries across words */
+            const uint64_t *eq = peq + text[j] * words;
+            uint64_t carry = 0;
+            for (size_t w = 0; w < words; w++)
+            {
+                uint64_t u = v[w] & eq[w];
+                uint64_t sum = v[w] + u;
+                uint64_t c1 = sum < u;
+                sum += carry;
+                carry = c1 | (sum < carry);
+                v[w] = sum | (v[w] & ~eq[w]);
+            }
+        }
+        /* every zero among the first "m" bits is one matched position */
+        size_t ones = 0;
+        for (size_t w = 0; w < words; w++)
+        {
+            uint64_t word = v[w];
+            if (w == words - 1 && m % 64)
+            {
+                word &= ((uint64_t)1 << (m % 64)) - 1;
+            }
+            ones += bitset_popcount64(word);
+        }
+        free(peq);
+        free(v);
+        return m - ones;
+    }
+
+    /* 3 * 5 * 7 * 11 * 13, the odd numbers repeat their divisibility by the presieved primes with this period */
+#define BITSET_PRESIEVE_PERIOD 15015
+#define BITSET_PRESIEVE_WORDS (BITSET_PRESIEVE_PERIOD / 64 + 2)
+
+    typedef struct
+    {
+        /* odd primes up to sqrt(hi) */
+        uint32_t *primes;
+        size_t num_primes;
+        /* bit "t" is 1 when 2 * t + 1 has no factor 3..13, continued past the period for unaligned reads */
+        uint64_t pattern[BITSET_PRESIEVE_WORDS];
+    } bitset_sieve_base;
+
+    /* floor(sqrt(n)), digit by digit so it needs neither libm nor a 128 bit square */
+    bitset_internal uint64_t bitset_isqrt64(uint64_t n)
+    {
+        uint64_t r = 0;
+        uint64_t bit = (uint64_t)1 << 62;
+        while (bit > n)
+        {
+            bit >>= 2;
+        }
+        while (bit)
+        {
+            if (n >= r + bit)
+            {
+                n -= r + bit;
+                r = (r >> 1) + bit;
+            }
+            else
+            {
+                r >>= 1;
+            }
+            bit >>= 2;
+        }
+        return r;
+    }
+
+    /* Prepares the primes needed to sieve below "hi", returns 0 if memory allocation failed */
+    bitset_internal int bitset_sieve_base_init(bitset_sieve_base *base, uint64_t hi)
+    {
+        uint64_t limit = hi > 0 ? bitset_isqrt64(hi - 1) : 0;
+        uint8_t *composite = (uint8_t *)calloc((size_t)limit + 1, 1);
+        base->primes = (uint32_t *)malloc(((size_t)limit / 2 + 1) * sizeof(uint32_t));
+        if (composite == NULL || base->primes == NULL)
+        {
+            free(composite);
+            free(base->primes);
+            base->primes = NULL;
+            return 0;
+        }
+        base->num_primes = 0;
+        for (uint64_t p = 3; p <= limit; p += 2)
+        {
+            if (composite[p])
+            {
+                continue;
+            }
+            base->primes[base->num_primes++] = (uint32_t)p;
+            for (uint64_t q = p * p; q <= limit; q += 2 * p)
+            {
+                composite[q] = 1;
+            }
+        }
+        free(composite);
+        memset(base->pattern, 0, sizeof(base->pattern));
+        for (size_t t = 0; t < BITSET_PRESIEVE_WORDS * 64; t++)
+        {
+            uint64_t n = 2 * (t % BITSET_PRESIEVE_PERIOD) + 1;
+            if (n % 3 && n % 5 && n % 7 && n % 11 && n % 13)
+            {
+                base->pattern[t / 64] |= (uint64_t)1 << (t % 64);
+            }
+        }
+        return 1;
+    }
+
+    /* Sieves "nbits" odd numbers starting at the odd "first" into "bits", bits past "nbits" in the last word are 0 */
+    bitset_internal void bitset_sieve_window(uint8_t *bits, size_t nbits, uint64_t first, const bitset_sieve_base *base)
+    {
+        size_t words = (nbits + 63) / 64;
+        size_t off = (size_t)(((first - 1) / 2) % BITSET_PRESIEVE_PERIOD);
+        for (size_t w = 0; w < words; w++)
+        {
+            uint64_t v = base->pattern[off / 64] >> (off % 64);
+            if (off % 64)
+            {
+                v |= base->pattern[off / 64 + 1] << (64 - off % 64);
+            }
+            bitset_store_word(bits + w * 8, v);
+            off += 64;
+            off = off >= BITSET_PRESIEVE_PERIOD ? off - BITSET_PRESIEVE_PERIOD : off;
+        }
+        if (nbits % 64)
+        {
+            uint8_t *last = bits + (words - 1) * 8;
+            bitset_store_word(last, bitset_load_word(last) & (((uint64_t)1 << (nbits % 64)) - 1));
+        }
+        uint64_t end = first + 2 * (uint64_t)nbits;
+        /* the pattern drops the presieved primes themselves and keeps 1 */
+        static const unsigned int small[] = {1, 3, 5, 7, 11, 13};
+        for (size_t i = 0; i < sizeof(small) / sizeof(small[0]); i++)
+        {
+            if (small[i] >= first && small[i] < end)
+            {
+                size_t idx = (size_t)((small[i] - first) / 2);
+                if (small[i] == 1)
+                {
+                    bits[idx / 8] &= (uint8_t)~(1u << (idx % 8));
+                }
+                else
+                {
+                    bits[idx / 8] |= (uint8_t)(1u << (idx % 8));
+                }
+            }
+        }
+        for (size_t i = 0; i < base->num_primes; i++)
+        {
+            uint64_t p = base->primes[i];
+            if (p <= 13)
+            {
+                continue;
+            }
+            if (p * p >= end)
+            {
+                break;
+            }
+            uint64_t m = (first + p - 1) / p * p;
+            m = m < p * p ? p * p : m;
+            m += (m % 2 == 0) ? p : 0;
+            for (uint64_t idx = (m - first) / 2; idx < nbits; idx += p)
+            {
+                bits[idx / 8] &= (uint8_t)~(1u << (idx % 8));
+            }
+        }
+    }
+
+    /* First odd number of [lo, hi) and how many odd numbers the range holds */
+    bitset_internal uint64_t bitset_odd_range(uint64_t lo, uint64_t hi, uint64_t *count)
+    {
+        uint64_t first = lo | 1;
+        *count = hi > first ? (hi - first + 1) / 2 : 0;
+        return first;
+    }
+
+    /* Sieves bits [begin, end) of "bits" a segment at a time, "begin" is a multiple of BITSET_SIEVE_SEGMENT_BITS */
+    bitset_internal void bitset_sieve_odd_range(uint8_t *bits, uint64_t first, size_t begin, size_t end,
+                                                const bitset_sieve_base *base)
+    {
+        for (; begin < end; begin += BITSET_SIEVE_SEGMENT_BITS)
+        {
+            size_t n = end - begin < BITSET_SIEVE_SEGMENT_BITS ? end - begin : BITSET_SIEVE_SEGMENT_BITS;
+            bitset_sieve_window(bits + begin / 8, n, first + 2 * (uint64_t)begin, base);
+        }
+    }
+
+    bitset_forced_inline void BitSet_sieve_odd(BitSet *out, uint64_t lo, uint64_t hi)
+    {
+        BITSET_ASSERT(out, "BitSet_sieve_odd: BitSet is NULL");
+        uint64_t count;
+        uint64_t first = bitset_odd_range(lo, hi, &count);
+        bitset_sieve_base base;
+        if (!bitset_reserve(out, (size_t)count) || !bitset_sieve_base_init(&base, hi))
+        {
+            bitset_report(BITSET_ERR_NO_MEMORY, "BitSet_sieve_odd");
+            BITSET_ASSERT(0, "BitSet_sieve_odd: Memory allocation failed");
+            return;
+        }
+        bitset_sieve_odd_range(out->bits, first, 0, out->bit_len, &base);
+        free(base.primes);
+        bitset_mark_dirty_range(out, 0, BitSet_get_byte_len(out));
+    }
+
+    /* Counts the primes among the odd numbers [first + 2 * begin, first + 2 * end) */
+    bitset_internal uint64_t bitset_prime_count_range(uint64_t first, uint64_t begin, uint64_t end,
+                                                      const bitset_sieve_base *base, uint8_t *scratch)
+    {
+        uint64_t count = 0;
+        for (uint64_t b = begin; b < end; b += BITSET_SIEVE_SEGMENT_BITS)
+        {
+            size_t n = (size_t)(end - b < BITSET_SIEVE_SEGMENT_BITS ? end - b : BITSET_SIEVE_SEGMENT_BITS);
+            bitset_sieve_window(scratch, n, first + 2 * b, base);
+            count += bitset_count_words(scratch, 0, (n + 63) / 64);
+        }
+        return count;
+    }
+
+    bitset_forced_inline uint64_t BitSet_prime_count(uint64_t lo, uint64_t hi)
+    {
+        uint64_t count;
+        uint64_t first = bitset_odd_range(lo, hi, &count);
+        bitset_sieve_base base;
+        uint8_t *scratch = (uint8_t *)malloc(BITSET_SIEVE_SEGMENT_BITS / 8);
+        if (scratch == NULL || !bitset_sieve_base_init(&base, hi))
+        {
+            free(scratch);
+            bitset_report(BITSET_ERR_NO_MEMORY, "BitSet_prime_count");
+            return UINT64_MAX;
+        }
+        uint64_t primes = (lo <= 2 && hi > 2) + bitset_prime_count_range(first, 0, count, &base, scratch);
+        free(scratch);
+        free(base.primes);
+        return primes;
+    }
+
+    bitset_forced_inline int BitSet_for_each_prime(uint64_t lo, uint64_t hi, BitSetIndexFn fn, void *ctx)
+    {
+        BITSET_ASSERT(fn, "BitSet_for_each_prime: Callback is NULL");
+        uint64_t count;
+        uint64_t first = bitset_odd_range(lo, hi, &count);
+        bitset_sieve_base base;
+        uint8_t *scratch = (uint8_t *)malloc(BITSET_SIEVE_SEGMENT_BITS / 8);
+        if (scratch == NULL || !bitset_sieve_base_init(&base, hi))
+        {
+            free(scratch);
+            bitset_report(BITSET_ERR_NO_MEMORY, "BitSet_for_each_prime");
+            return -1;
+        }
+        int stopped = lo <= 2 && hi > 2 ? fn(2, ctx) != 0 : 0;
+        for (uint64_t b = 0; b < count && !stopped; b += BITSET_SIEVE_SEGMENT_BITS)
+        {
+            size_t n = (size_t)(count - b < BITSET_SIEVE_SEGMENT_BITS ? count - b : BITSET_SIEVE_SEGMENT_BITS);
+            uint64_t seg_first = first + 2 * b;
+            bitset_sieve_window(scratch, n, seg_first, &base);
+            for (size_t w = 0; w < (n + 63) / 64 && !stopped; w++)
+            {
+                uint64_t word = bitset_load_word(scratch + w * 8);
+                while (word && !stopped)
+                {
+                    stopped = fn((size_t)(seg_first + 2 * (w * 64 + bitset_ctz64(word))), ctx) != 0;
+                    word &= word - 1;
+                }
+            }
+        }
+        free(scratch);
+        free(base.primes);
+        return stopped;
+    }
+
+#if defined(BITSET_THREADS)
+    typedef struct
+    {
+        const bitset_sieve_base *base;
+        /* bits of the BitSet being sieved, NULL when counting */
+        uint8_t *out;
+        uint64_t first;
+        uint64_t begin;
+        uint64_t end;
+        uint64_t count;
+        int failed;
+    } bitset_prime_task;
+
+    /* Splits the odd numbers into whole segments per thread, so every task starts on a word */
+    bitset_internal void bitset_prime_tasks_init(bitset_prime_task *tasks, size_t num_threads, const bitset_sieve_base *base,
+                                                 uint8_t *out, uint64_t first, uint64_t count)
+    {
+        uint64_t segments = (count + BITSET_SIEVE_SEGMENT_BITS - 1) / BITSET_SIEVE_SEGMENT_BITS;
+        for (size_t t = 0; t < num_threads; t++)
+        {
+            tasks[t].base = base;
+            tasks[t].out = out;
+            tasks[t].first = first;
+            tasks[t].begin = segments * t / num_threads * BITSET_SIEVE_SEGMENT_BITS;
+            tasks[t].end = segments * (t + 1) / num_threads * BITSET_SIEVE_SEGMENT_BITS;
+            tasks[t].end = tasks[t].end < count ? tasks[t].end : count;
+            tasks[t].begin = tasks[t].begin < tasks[t].end ? tasks[t].begin : tasks[t].end;
+        }
+    }
+
+    bitset_internal void *bitset_sieve_odd_worker(void *arg)
+    {
+        bitset_prime_task *task = (bitset_prime_task *)arg;
+        bitset_sieve_odd_range(task->out, task->first, (size_t)task->begin, (size_t)task->end, task->base);
+        return NULL;
+    }
+
+    bitset_forced_inline void BitSet_sieve_odd_mt(BitSet *out, uint64_t lo, uint64_t hi, size_t num_threads)
+    {
+        BITSET_ASSERT(out, "BitSet_sieve_odd_mt: BitSet is NULL");
+        num_threads = num_threads ? num_threads : 1;
+        uint64_t count;
+        uint64_t first = bitset_odd_range(lo, hi, &count);
+        bitset_sieve_base base;
+        bitset_prime_task *tasks = (bitset_prime_task *)calloc(num_threads, sizeof(bitset_prime_task));
+        if (tasks == NULL || !bitset_reserve(out, (size_t)count) || !bitset_sieve_base_init(&base, hi))
+        {
+            free(tasks);
+            bitset_report(BITSET_ERR_NO_MEMORY, "BitSet_sieve_odd_mt");
+            BITSET_ASSERT(0, "BitSet_sieve_odd_mt: Memory allocation failed");
+            return;
+        }
+        /* each thread writes its own words of "out" */
+        bitset_prime_tasks_init(tasks, num_threads, &base, out->bits, first, count);
+        bitset_run_threads(bitset_sieve_odd_worker, tasks, sizeof(bitset_prime_task), num_threads);
+        free(tasks);
+        free(base.primes);
+        bitset_mark_dirty_range(out, 0, BitSet_get_byte_len(out));
+    }
+
+    bitset_internal void *bitset_prime_count_worker(void *arg)
+    {
+        bitset_prime_task *task = (bitset_prime_task *)arg;
+        uint8_t *scratch = (uint8_t *)malloc(BITSET_SIEVE_SEGMENT_BITS / 8);
+        if (scratch == NULL)
+        {
+            task->failed = 1;
+            return NULL;
+        }
+        task->count = bitset_prime_count_range(task->first, task->begin, task->end, task->base, scratch);
+        free(scratch);
+        return NULL;
+    }
+
+    bitset_forced_inline uint64_t BitSet_prime_count_mt(uint64_t lo, uint64_t hi, size_t num_threads)
+    {
+        num_threads = num_threads ? num_threads : 1;
+        uint64_t count;
+        uint64_t first = bitset_odd_range(lo, hi, &count);
+        bitset_sieve_base base;
+        bitset_prime_task *tasks = (bitset_prime_task *)calloc(num_threads, sizeof(bitset_prime_task));
+        if (tasks == NULL || !bitset_sieve_base_init(&base, hi))
+        {
+            free(tasks);
+            bitset_report(BITSET_ERR_NO_MEMORY, "BitSet_prime_count_mt");
+            return UINT64_MAX;
+        }
+        bitset_prime_tasks_init(tasks, num_threads, &base, NULL, first, count);
+        bitset_run_threads(bitset_prime_count_worker, tasks, sizeof(bitset_prime_task), num_threads);
+        uint64_t primes = lo <= 2 && hi > 2;
+        int failed = 0;
+        for (size_t t = 0; t < num_threads; t++)
+        {
+            primes += tasks[t].count;
+            failed |= tasks[t].failed;
+        }
+        free(tasks);
+        free(base.primes);
+        if (failed)
+        {
+            bitset_report(BITSET_ERR_NO_MEMORY, "BitSet_prime_count_mt");
+            return UINT64_MAX;
+        }
+        return primes;
+    }
+#endif
+
+    /* Stack allocator for the scratch sets of the graph kernels. Blocks are kept until the arena is freed. */
+    typedef struct bitset_arena_block
+    {
+        struct bitset_arena_block *next;
+        size_t cap;
+    } bitset_arena_block;
+
+    typedef struct
+    {
+        bitset_arena_block *head;
+        bitset_arena_block *cur;
+        /* words used in "cur" */
+        size_t used;
+        size_t block_words;
+    } bitset_arena;
+
+    typedef struct
+    {
+        bitset_arena_block *cur;
+        size_t used;
+    } bitset_arena_mark;
+
+    bitset_internal uint64_t *bitset_arena_words(bitset_arena_block *b)
+    {
+        return (uint64_t *)(b + 1);
+    }
+
+    /* Returns "n" words, NULL if memory allocation failed */
+    bitset_internal uint64_t *bitset_arena_alloc(bitset_arena *ar, size_t n)
+    {
+        while (ar->cur == NULL || ar->used + n > ar->cur->cap)
+        {
+            bitset_arena_block *next = ar->cur ? ar->cur->next : ar->head;
+            if (next == NULL || next->cap < n)
+            {
+                size_t cap = n > ar->block_words ? n : ar->block_words;
+                bitset_arena_block *b = (bitset_arena_block *)malloc(sizeof(bitset_arena_block) + cap * sizeof(uint64_t));
+                if (b == NULL)
+                {
+                    return NULL;
+                }
+                b->cap = cap;
+                b->next = next;
+                if (ar->cur)
+                {
+                    ar->cur->next = b;
+                }
+                else
+                {
+                    ar->head = b;
+                }
+                next = b;
+            }
+            ar->cur = next;
+            ar->used = 0;
+        }
+        uint64_t *p = bitset_arena_words(ar->cur) + ar->used;
+        ar->used += n;
+        return p;
+    }
+
+    bitset_internal bitset_arena_mark bitset_arena_save(const bitset_arena *ar)
+    {
+        bitset_arena_mark m;
+        m.cur = ar->cur;
+        m.used = ar->used;
+        return m;
+    }
+
+    bitset_internal void bitset_arena_restore(bitset_arena *ar, bitset_arena_mark m)
+    {
+        ar->cur = m.cur;
+        ar->used = m.used;
+    }
+
+    bitset_internal void bitset_arena_free(bitset_arena *ar)
+    {
+        while (ar->head)
+        {
+            bitset_arena_block *next = ar->head->next;
+            free(ar->head);
+            ar->head = next;
+        }
+        ar->cur = NULL;
+        ar->used = 0;
+    }
+
+    typedef struct
+    {
+        /* "n" rows of "words" words */
+        uint64_t *adj;
+        size_t n;
+        size_t words;
+        bitset_arena arena;
+        /* current clique */
+        size_t *r;
+        size_t r_len;
+        /* best clique so far, BitSet_max_clique only */
+        size_t *best;
+        size_t best_len;
+        BitSetCliqueFn fn;
+        void *ctx;
+        /* 0 while running, 1 once "fn" stopped the search, -1 on allocation failure */
+        int status;
+    } bitset_graph;
+
+    /*
+    Copies the adjacency into native words without self loops and bits past "n". "u" and "v" are adjacent when either
+    row has the other's bit, so a one-sided adjacency still gives an undirected graph. Complemented for "complement".
+    */
+    bitset_internal int bitset_graph_init(bitset_graph *g, const BitSet *adj, size_t n, int complement)
+    {
+        memset(g, 0, sizeof(*g));
+        g->n = n;
+        g->words = (n + 63) / 64;
+        g->arena.block_words = 64 * (g->words + 1);
+        g->adj = (uint64_t *)malloc((n > 0 ? n * g->words : 1) * sizeof(uint64_t));
+        g->r = (size_t *)malloc((n ? n : 1) * sizeof(size_t));
+        if (g->adj == NULL || g->r == NULL)
+        {
+            free(g->adj);
+            free(g->r);
+            return 0;
+        }
+        uint64_t tail = n % 64 ? ((uint64_t)1 << (n % 64)) - 1 : ~(uint64_t)0;
+        for (size_t v = 0; v < n; v++)
+        {
+            uint64_t *row = g->adj + v * g->words;
+            size_t aw = BitSet_get_word_len(&adj[v]);
+            for (size_t w = 0; w < g->words; w++)
+            {
+                row[w] = w < aw ? bitset_load_word(adj[v].bits + w * 8) : 0;
+                row[w] &= w + 1 == g->words ? tail : ~(uint64_t)0;
+            }
+        }
+        /* OR in the transpose */
+        for (size_t u = 0; u < n; u++)
+        {
+            for (size_t w = 0; w < g->words; w++)
+            {
+                uint64_t word = g->adj[u * g->words + w];
+                while (word)
+                {
+                    size_t v = w * 64 + bitset_ctz64(word);
+                    g->adj[v * g->words + u / 64] |= (uint64_t)1 << (u % 64);
+                    word &= word - 1;
+                }
+            }
+        }
+        for (size_t v = 0; v < n && complement; v++)
+        {
+            uint64_t *row = g->adj + v * g->words;
+            for (size_t w = 0; w < g->words; w++)
+            {
+                row[w] = ~row[w];
+            }
+            row[g->words - 1] &= tail;
+        }
+        for (size_t v = 0; v < n; v++)
+        {
+            g->adj[v * g->words + v / 64] &= ~((uint64_t)1 << (v % 64));
+        }
+        return 1;
+    }
+
+    bitset_internal void bitset_graph_free(bitset_graph *g)
+    {
+        bitset_arena_free(&g->arena);
+        free(g->adj);
+        free(g->r);
+    }
+
+    bitset_internal int bitset_words_empty(const uint64_t *a, size_t words)
+    {
+        for (size_t w = 0; w < words; w++)
+        {
+            if (a[w])
+            {
+                return 0;
+            }
+        }
+        return 1;
+    }
+
+    bitset_internal size_t bitset_words_and_count(const uint64_t *a, const uint64_t *b, size_t words)
+    {
+        size_t count;
+        BITSET_POPCOUNT_LOOP(count, 0, words, w, a[w] & b[w]);
+        return count;
+    }
+
+    bitset_internal void bitset_bron_kerbosch(bitset_graph *g, const uint64_t *p, const uint64_t *x)
+    {
+        size_t words = g->words;
+        if (bitset_words_empty(p, words))
+        {
+            if (bitset_words_empty(x, words))
+            {
+                g->status = g->fn(g->r, g->r_len, g->ctx) ? 1 : 0;
+            }
+            return;
+        }
+        /* pivot on the vertex of P | X with the most neighbours in P, only its non neighbours need a branch */
+        size_t pivot = 0;
+        size_t most = 0;
+        int found = 0;
+        for (size_t w = 0; w < words; w++)
+        {
+            uint64_t m = p[w] | x[w];
+            while (m)
+            {
+                size_t u = w * 64 + bitset_ctz64(m);
+                size_t c = bitset_words_and_count(p, g->adj + u * words, words);
+                if (!found || c > most)
+                {
+                    pivot = u;
+                    most = c;
+                    found = 1;
+                }
+                m &= m - 1;
+            }
+        }
+        bitset_arena_mark mark = bitset_arena_save(&g->arena);
+        uint64_t *scratch = bitset_arena_alloc(&g->arena, 5 * words);
+        if (scratch == NULL)
+        {
+            g->status = -1;
+            return;
+        }
+        uint64_t *cand = scratch;
+        uint64_t *p2 = scratch + words;
+        uint64_t *x2 = scratch + 2 * words;
+        uint64_t *np = scratch + 3 * words;
+        uint64_t *nx = scratch + 4 * words;
+        const uint64_t *pivot_row = g->adj + pivot * words;
+        for (size_t w = 0; w < words; w++)
+        {
+            cand[w] = p[w] & ~pivot_row[w];
+            p2[w] = p[w];
+            x2[w] = x[w];
+        }
+        for (size_t w = 0; w < words && g->status == 0; w++)
+        {
+            uint64_t m = cand[w];
+            while (m && g->status == 0)
+            {
+                size_t v = w * 64 + bitset_ctz64(m);
+                const uint64_t *row = g->adj + v * words;
+                for (size_t i = 0; i < words; i++)
+                {
+                    np[i] = p2[i] & row[i];
+                    nx[i] = x2[i] & row[i];
+                }
+                g->r[g->r_len++] = v;
+                bitset_bron_kerbosch(g, np, nx);
+                g->r_len--;
+                p2[w] &= ~((uint64_t)1 << (v % 64));
+                x2[w] |= (uint64_t)1 << (v % 64);
+                m &= m - 1;
+            }
+        }
+        bitset_arena_restore(&g->arena, mark);
+    }
+
+    bitset_forced_inline int BitSet_maximal_cliques(const BitSet *adj, size_t n, BitSetCliqueFn fn, void *ctx)
+    {
+        BITSET_ASSERT((adj || n == 0) && fn, "BitSet_maximal_cliques: Argument is NULL");
+        bitset_graph g;
+        if (!bitset_graph_init(&g, adj, n, 0))
+        {
+            bitset_report(BITSET_ERR_NO_MEMORY, "BitSet_maximal_cliques");
+            return -1;
+        }
+        g.fn = fn;
+        g.ctx = ctx;
+        uint64_t *px = bitset_arena_alloc(&g.arena, 2 * g.words + 1);
+        if (px == NULL)
+        {
+            g.status = -1;
+        }
+        else if (n > 0)
+        {
+            memset(px, 0, (2 * g.words + 1) * sizeof(uint64_t));
+            memset(px, 0xFF, g.words * sizeof(uint64_t));
+            if (n % 64)
+            {
+                px[g.words - 1] = ((uint64_t)1 << (n % 64)) - 1;
+            }
+            bitset_bron_kerbosch(&g, px, px + g.words);
+        }
+        bitset_graph_free(&g);
+        if (g.status < 0)
+        {
+            bitset_report(BITSET_ERR_NO_MEMORY, "BitSet_maximal_cliques");
+        }
+        return g.status;
+    }
+
+    /*
+    Greedy coloring of "p" into color classes, each class built by repeatedly taking the lowest vertex left and
+    dropping its neighbours. Vertex order[i] gets color color[i], colors are non decreasing and start at 1.
+    */
+    bitset_internal size_t bitset_color_sort(const bitset_graph *g, const uint64_t *p, uint64_t *q, uint64_t *cls,
+                                             uint64_t *order, uint64_t *color)
+    {
+        size_t words = g->words;
+        size_t k = 0;
+        size_t i = 0;
+        memcpy(q, p, words * sizeof(uint64_t));
+        while (!bitset_words_empty(q, words))
+        {
+            k++;
+            memcpy(cls, q, words * sizeof(uint64_t));
+            for (size_t w = 0; w < words; w++)
+            {
+                while (cls[w])
+                {
+                    size_t v = w * 64 + bitset_ctz64(cls[w]);
+                    const uint64_t *row = g->adj + v * words;
+                    q[w] &= ~((uint64_t)1 << (v % 64));
+                    cls[w] &= ~((uint64_t)1 << (v % 64));
+                    for (size_t j = w; j < words; j++)
+                    {
+                        cls[j] &= ~row[j];
+                    }
+                    order[i] = v;
+                    color[i] = k;
+                    i++;
+                }
+            }
+        }
+        return i;
+    }
+
+    /* Branch and bound over candidates "p", which is consumed */
+    bitset_internal void bitset_max_clique_expand(bitset_graph *g, uint64_t *p)
+    {
+        size_t words = g->words;
+        size_t count = 0;
+        for (size_t w = 0; w < words; w++)
+        {
+            count += bitset_popcount64(p[w]);
+        }
+        bitset_arena_mark mark = bitset_arena_save(&g->arena);
+        uint64_t *scratch = bitset_arena_alloc(&g->arena, 3 * words + 2 * count);
+        if (scratch == NULL)
+        {
+            g->status = -1;
+            return;
+        }
+        uint64_t *np = scratch;
+        uint64_t *order = scratch + 3 * words;
+        uint64_t *color = order + count;
+        bitset_color_sort(g, p, scratch + words, scratch + 2 * words, order, color);
+        /* highest colors first, a vertex colored "c" can extend the clique by at most "c" */
+        for (size_t i = count; i-- > 0 && g->status == 0;)
+        {
+            if (g->r_len + color[i] <= g->best_len)
+            {
+                break;
+            }
+            size_t v = (size_t)order[i];
+            const uint64_t *row = g->adj + v * words;
+            int empty = 1;
+            for (size_t w = 0; w < words; w++)
+            {
+                np[w] = p[w] & row[w];
+                empty &= np[w] == 0;
+            }
+            g->r[g->r_len++] = v;
+            if (empty)
+            {
+                if (g->r_len > g->best_len)
+                {
+                    memcpy(g->best, g->r, g->r_len * sizeof(size_t));
+                    g->best_len = g->r_len;
+                }
+            }
+            else
+            {
+                bitset_max_clique_expand(g, np);
+            }
+            g->r_len--;
+            p[v / 64] &= ~((uint64_t)1 << (v % 64));
+        }
+        bitset_arena_restore(&g->arena, mark);
+    }
+
+    bitset_internal size_t bitset_max_clique(const BitSet *adj, size_t n, size_t *out, int complement)
+    {
+        bitset_graph g;
+        if (!bitset_graph_init(&g, adj, n, complement))
+        {
+            return SIZE_MAX;
+        }
+        g.best = out;
+        uint64_t *p = bitset_arena_alloc(&g.arena, g.words + 1);
+        if (p == NULL)
+        {
+            g.status = -1;
+        }
+        else if (n > 0)
+        {
+            memset(p, 0xFF, g.words * sizeof(uint64_t));
+            if (n % 64)
+            {
+                p[g.words - 1] = ((uint64_t)1 << (n % 64)) - 1;
+            }
+            bitset_max_clique_expand(&g, p);
+        }
+        bitset_graph_free(&g);
+        return g.status < 0 ? SIZE_MAX : g.best_len;
+    }
+
+    bitset_forced_inline size_t BitSet_max_clique(const BitSet *adj, size_t n, size_t *out)
+    {
+        BITSET_ASSERT((adj && out) || n == 0, "BitSet_max_clique: Argument is NULL");
+        size_t size = bitset_max_clique(adj, n, out, 0);
+        if (size == SIZE_MAX)
+        {
+            bitset_report(BITSET_ERR_NO_MEMORY, "BitSet_max_clique");
+        }
+        return size;
+    }
+
+    bitset_forced_inline size_t BitSet_max_independent_set(const BitSet *adj, size_t n, size_t *out)
+    {
+        BITSET_ASSERT((adj && out) || n == 0, "BitSet_max_independent_set: Argument is NULL");
+        size_t size = bitset_max_clique(adj, n, out, 1);
+        if (size == SIZE_MAX)
+        {
+            bitset_report(BITSET_ERR_NO_MEMORY, "BitSet_max_independent_set");
+        }
+        return size;
+    }
+
+    bitset_forced_inline size_t BitSet_greedy_coloring(const BitSet *adj, size_t n, size_t *colors)
+    {
+        BITSET_ASSERT((adj && colors) || n == 0, "BitSet_greedy_coloring: Argument is NULL");
+        bitset_graph g;
+        if (!bitset_graph_init(&g, adj, n, 0))
+        {
+            bitset_report(BITSET_ERR_NO_MEMORY, "BitSet_greedy_coloring");
+            return SIZE_MAX;
+        }
+        /* row "v" of "forbidden" has bit "c" set when a colored neighbour of "v" has color "c", at most "n" colors */
+        uint64_t *scratch = bitset_arena_alloc(&g.arena, (n + 1) * g.words + 2 * n + 1);
+        if (scratch == NULL)
+        {
+            bitset_graph_free(&g);
+            bitset_report(BITSET_ERR_NO_MEMORY, "BitSet_greedy_coloring");
+            return SIZE_MAX;
+        }
+        uint64_t *uncolored = scratch;
+        uint64_t *forbidden = scratch + g.words;
+        uint64_t *saturation = forbidden + n * g.words;
+        uint64_t *degree = saturation + n;
+        memset(forbidden, 0, (n * g.words + n) * sizeof(uint64_t));
+        memset(uncolored, 0xFF, g.words * sizeof(uint64_t));
+        if (n % 64)
+        {
+            uncolored[g.words - 1] = ((uint64_t)1 << (n % 64)) - 1;
+        }
+        for (size_t v = 0; v < n; v++)
+        {
+            degree[v] = bitset_words_and_count(g.adj + v * g.words, uncolored, g.words);
+        }
+        size_t k = 0;
+        for (size_t step = 0; step < n; step++)
+        {
+            /* DSATUR: most distinct neighbour colors first, then most uncolored neighbours */
+            size_t best = SIZE_MAX;
+            for (size_t w = 0; w < g.words; w++)
+            {
+                for (uint64_t word = uncolored[w]; word; word &= word - 1)
+                {
+                    size_t v = w * 64 + bitset_ctz64(word);
+                    if (best == SIZE_MAX || saturation[v] > saturation[best] ||
+                        (saturation[v] == saturation[best] && degree[v] > degree[best]))
+                    {
+                        best = v;
+                    }
+                }
+            }
+            /* smallest color not used by a neighbour */
+            const uint64_t *used = forbidden + best * g.words;
+            size_t color = 0;
+            while (used[color / 64] == ~(uint64_t)0)
+            {
+                color += 64;
+            }
+            color += bitset_ctz64(~used[color / 64]);
+            colors[best] = color;
+            k = color + 1 > k ? color + 1 : k;
+            uncolored[best / 64] &= ~((uint64_t)1 << (best % 64));
+            const uint64_t *row = g.adj + best * g.words;
+            for (size_t w = 0; w < g.words; w++)
+            {
+                for (uint64_t word = row[w] & uncolored[w]; word; word &= word - 1)
+                {
+                    size_t u = w * 64 + bitset_ctz64(word);
+                    uint64_t *fu = forbidden + u * g.words + color / 64;
+                    saturation[u] += (*fu >> (color % 64) & 1) ^ 1;
+                    *fu |= (uint64_t)1 << (color % 64);
+                    degree[u]--;
+                }
+            }
+        }
+        bitset_graph_free(&g);
+        return k;
+    }
+
+    bitset_forced_inline double BitSet_tanimoto(const BitSet *a, const BitSet *b)
+    {
+        BITSET_ASSERT(a && b, "BitSet_tanimoto: BitSet is NULL");
+        size_t aw = BitSet_get_word_len(a);
+        size_t bw = BitSet_get_word_len(b);
+        size_t both = 0;
+        size_t either = 0;
+        for (size_t w = 0; w < (aw > bw ? aw : bw); w++)
+        {
+            uint64_t x = w < aw ? bitset_load_word(a->bits + w * 8) : 0;
+            uint64_t y = w < bw ? bitset_load_word(b->bits + w * 8) : 0;
+            both += bitset_popcount64(x & y);
+            either += bitset_popcount64(x | y);
+        }
+        return either ? (double)both / (double)either : 1.0;
+    }
+
+    bitset_forced_inline void BitSetRows_init(BitSetRows *rows, size_t bit_len)
+    {
+        BITSET_ASSERT(rows, "BitSetRows_init: BitSetRows is NULL");
+        BITSET_ASSERT(bit_len <= UINT32_MAX, "BitSetRows_init: Row length does not fit the popcount table");
+        rows->words = NULL;
+        rows->counts = NULL;
+        rows->stride = ((bit_len + 511) / 512) * 8;
+        rows->bit_len = bit_len;
+        rows->num_rows = 0;
+        rows->capacity = 0;
+    }
+
+    bitset_forced_inline void BitSetRows_free(BitSetRows *rows)
+    {
+        BITSET_ASSERT(rows, "BitSetRows_free: BitSetRows is NULL");
+        bitset_aligned_free(rows->words);
+        free(rows->counts);
+        rows->words = NULL;
+        rows->counts = NULL;
+        rows->num_rows = 0;
+        rows->capacity = 0;
+    }
+
+    bitset_forced_inline BitSetStatus BitSetRows_reserve(BitSetRows *rows, size_t num_rows)
+    {
+        BITSET_ASSERT(rows, "BitSetRows_reserve: BitSetRows is NULL");
+        if (num_rows <= rows->capacity)
+        {
+            return BITSET_OK;
+        }
+        size_t row_bytes = (rows->stride ? rows->stride : 8) * sizeof(uint64_t);
+        if (num_rows > SIZE_MAX / row_bytes)
+        {
+            return bitset_report(BITSET_ERR_NO_MEMORY, "BitSetRows_reserve");
+        }
+        uint64_t *words = (uint64_t *)bitset_aligned_alloc(num_rows * row_bytes, 64);
+        uint32_t *counts = (uint32_t *)realloc(rows->counts, num_rows * sizeof(uint32_t));
+        if (counts != NULL)
+        {
+            rows->counts = counts;
+        }
+        if (words == NULL || counts == NULL)
+        {
+            bitset_aligned_free(words);
+            return bitset_report(BITSET_ERR_NO_MEMORY, "BitSetRows_reserve");
+        }
+        if (rows->num_rows)
+        {
+            memcpy(words, rows->words, rows->num_rows * rows->stride * sizeof(uint64_t));
+        }
+        bitset_aligned_free(rows->words);
+        rows->words = words;
+        rows->capacity = num_rows;
+        return BITSET_OK;
+    }
+
+    bitset_forced_inline size_t BitSetRows_append(BitSetRows *rows, const BitSet *bs)
+    {
+        BITSET_ASSERT(rows && bs, "BitSetRows_append: Argument is NULL");
+        if (rows->num_rows == rows->capacity &&
+            BitSetRows_reserve(rows, rows->capacity ? rows->capacity * 2 : 16) != BITSET_OK)
+        {
+            return SIZE_MAX;
+        }
+        uint64_t *row = rows->words + rows->num_rows * rows->stride;
+        size_t bw = BitSet_get_word_len(bs);
+        size_t count = 0;
+        for (size_t w = 0; w < rows->stride; w++)
+        {
+            row[w] = w < bw && w * 64 < rows->bit_len ? bitset_load_word(bs->bits + w * 8) : 0;
+        }
+        if (rows->bit_len % 64)
+        {
+            row[rows->bit_len / 64] &= ((uint64_t)1 << (rows->bit_len % 64)) - 1;
+        }
+        for (size_t w = 0; w < rows->stride; w++)
+        {
+            count += bitset_popcount64(row[w]);
+        }
+        rows->counts[rows->num_rows] = (uint32_t)count;
+        return rows->num_rows++;
+    }
+
+    bitset_forced_inline size_t BitSetRows_len(const BitSetRows *rows)
+    {
+        BITSET_ASSERT(rows, "BitSetRows_len: BitSetRows is NULL");
+        return rows->num_rows;
+    }
+
+    bitset_forced_inline size_t BitSetRows_count(const BitSetRows *rows, size_t row)
+    {
+        BITSET_ASSERT(rows, "BitSetRows_count: BitSetRows is NULL");
+        BITSET_ASSERT(row < rows->num_rows, "BitSetRows_count: Row out of bounds");
+        return rows->counts[row];
+    }
+
+    bitset_forced_inline void BitSetRows_get(const BitSetRows *rows, size_t row, BitSet *out)
+    {
+        BITSET_ASSERT(rows && out, "BitSetRows_get: Argument is NULL");
+        BITSET_ASSERT(row < rows->num_rows, "BitSetRows_get: Row out of bounds");
+        if (!bitset_reserve(out, rows->bit_len))
+        {
+            BITSET_ASSERT(0, "BitSetRows_get: Memory allocation failed");
+            return;
+        }
+        size_t words = BitSet_get_word_len(out);
+        const uint64_t *src = rows->words + row * rows->stride;
+        for (size_t w = 0; w < words; w++)
+        {
+            bitset_store_word(out->bits + w * 8, src[w]);
+        }
+        bitset_mark_dirty_words(out, words);
+    }
+
+    /* Copies "query" into the row shaped buffer "q", returns its popcount */
+    bitset_internal size_t bitset_rows_fill_query(const BitSetRows *rows, const BitSet *query, uint64_t *q)
+    {
+        size_t qw = BitSet_get_word_len(query);
+        size_t count = 0;
+        for (size_t w = 0; w < rows->stride; w++)
+        {
+            q[w] = w < qw && w * 64 < rows->bit_len ? bitset_load_word(query->bits + w * 8) : 0;
+        }
+        if (rows->bit_len % 64)
+        {
+            q[rows->bit_len / 64] &= ((uint64_t)1 << (rows->bit_len % 64)) - 1;
+        }
+        for (size_t w = 0; w < rows->stride; w++)
+        {
+            count += bitset_popcount64(q[w]);
+        }
+        return count;
+    }
+
+    /* Row shaped copy of "query" in a 64 byte aligned buffer, NULL if memory allocation failed */
+    bitset_internal uint64_t *bitset_rows_query(const BitSetRows *rows, const BitSet *query, size_t *count)
+    {
+        uint64_t *q = (uint64_t *)bitset_aligned_alloc((rows->stride ? rows->stride : 8) * sizeof(uint64_t), 64);
+        *count = q != NULL ? bitset_rows_fill_query(rows, query, q) : 0;
+        return q;
+    }
+
+    /* Higher score first, or lower score first for "lower_first" distances, then lower row */
+    bitset_internal int bitset_hit_better(const BitSetHit *a, const BitSetHit *b, int lower_first)
+    {
+        if (a->score != b->score)
+        {
+            return lower_first ? a->score < b->score : a->score > b->score;
+        }
+        return a->row < b->row;
+    }
+
+    /* "hits" is a heap of "len" entries with the worst hit on top */
+    bitset_internal void bitset_hits_sift_down(BitSetHit *hits, size_t len, size_t i, int lower_first)
+    {
+        for (;;)
+        {
+            size_t worst = i;
+            size_t l = 2 * i + 1;
+            if (l < len && bitset_hit_better(&hits[worst], &hits[l], lower_first))
+            {
+                worst = l;
+            }
+            if (l + 1 < len && bitset_hit_better(&hits[worst], &hits[l + 1], lower_first))
+            {
+                worst = l + 1;
+            }
+            if (worst == i)
+            {
+                return;
+            }
+            BitSetHit tmp = hits[i];
+            hits[i] = hits[worst];
+            hits[worst] = tmp;
+            i = worst;
+        }
+    }
+
+    /* Offers "hit" to the heap of at most "k" entries, returns the new length */
+    bitset_internal size_t bitset_hits_push(BitSetHit *hits, size_t len, size_t k, BitSetHit hit, int lower_first)
+    {
+        if (len < k)
+        {
+            size_t i = len;
+            hits[i] = hit;
+            while (i > 0 && bitset_hit_better(&hits[(i - 1) / 2], &hits[i], lower_first))
+            {
+                BitSetHit tmp = hits[i];
+                hits[i] = hits[(i - 1) / 2];
+                hits[(i - 1) / 2] = tmp;
+                i = (i - 1) / 2;
+            }
+            return len + 1;
+        }
+        if (bitset_hit_better(&hit, &hits[0], lower_first))
+        {
+            hits[0] = hit;
+            bitset_hits_sift_down(hits, len, 0, lower_first);
+        }
+        return len;
+    }
+
+    /* Turns the heap into a list sorted best first */
+    bitset_internal void bitset_hits_sort(BitSetHit *hits, size_t len, int lower_first)
+    {
+        for (size_t end = len; end > 1; end--)
+        {
+            BitSetHit tmp = hits[0];
+            hits[0] = hits[end - 1];
+            hits[end - 1] = tmp;
+            bitset_hits_sift_down(hits, end - 1, 0, lower_first);
+        }
+    }
+
+    /* Tanimoto scan of rows [begin, end) into the heap "hits", returns its length */
+    bitset_internal size_t bitset_tanimoto_scan(const BitSetRows *rows, const uint64_t *q, size_t qc, size_t begin,
+                                                size_t end, double threshold, size_t k, BitSetHit *hits)
+    {
+        size_t len = 0;
+        for (size_t r = begin; r < end; r++)
+        {
+            size_t rc = rows->counts[r];
+            size_t lo = qc < rc ? qc : rc;
+            size_t hi = qc < rc ? rc : qc;
+            double bound = hi ? (double)lo / (double)hi : 1.0;
+            /* a row tying the worst hit loses on its higher index */
+            if (bound < threshold || (len == k && bound <= hits[0].score))
+            {
+                continue;
+            }
+            size_t both = bitset_words_and_count(q, rows->words + r * rows->stride, rows->stride);
+            size_t either = qc + rc - both;
+            BitSetHit hit;
+            hit.row = r;
+            hit.score = either ? (double)both / (double)either : 1.0;
+            if (hit.score >= threshold)
+            {
+                len = bitset_hits_push(hits, len, k, hit, 0);
+            }
+        }
+        return len;
+    }
+
+    bitset_forced_inline size_t BitSetRows_tanimoto_search(const BitSetRows *rows, const BitSet *query, double threshold,
+                                                           size_t k, BitSetHit *out)
+    {
+        BITSET_ASSERT(rows && query && (out || k == 0), "BitSetRows_tanimoto_search: Argument is NULL");
+        if (k == 0)
+        {
+            return 0;
+        }
+        size_t qc;
+        uint64_t *q = bitset_rows_query(rows, query, &qc);
+        if (q == NULL)
+        {
+            bitset_report(BITSET_ERR_NO_MEMORY, "BitSetRows_tanimoto_search");
+            return SIZE_MAX;
+        }
+        size_t len = bitset_tanimoto_scan(rows, q, qc, 0, rows->num_rows, threshold, k, out);
+        bitset_aligned_free(q);
+        bitset_hits_sort(out, len, 0);
+        return len;
+    }
+
+#if defined(BITSET_THREADS)
+    typedef struct
+    {
+        const BitSetRows *rows;
+        const uint64_t *q;
+        size_t qc;
+        size_t begin;
+        size_t end;
+        double threshold;
+        size_t k;
+        BitSetHit *hits;
+        size_t len;
+    } bitset_tanimoto_task;
+
+    bitset_internal void *bitset_tanimoto_worker(void *arg)
+    {
+        bitset_tanimoto_task *t = (bitset_tanimoto_task *)arg;
+        t->len = bitset_tanimoto_scan(t->rows, t->q, t->qc, t->begin, t->end, t->threshold, t->k, t->hits);
+        return NULL;
+    }
+
+    bitset_forced_inline size_t BitSetRows_tanimoto_search_mt(const BitSetRows *rows, const BitSet *query,
+                                                              double threshold, size_t k, BitSetHit *out,
+                                                              size_t num_threads)
+    {
+        BITSET_ASSERT(rows && query && (out || k == 0), "BitSetRows_tanimoto_search_mt: Argument is NULL");
+        if (k == 0)
+        {
+            return 0;
+        }
+        if (num_threads == 0)
+        {
+            num_threads = 1;
+        }
+        if (num_threads > rows->num_rows)
+        {
+            num_threads = rows->num_rows ? rows->num_rows : 1;
+        }
+        size_t qc;
+        uint64_t *q = bitset_rows_query(rows, query, &qc);
+        bitset_tanimoto_task *tasks = (bitset_tanimoto_task *)malloc(num_threads * sizeof(bitset_tanimoto_task));
+        BitSetHit *hits = num_threads <= SIZE_MAX / sizeof(BitSetHit) / k
+                              ? (BitSetHit *)malloc(num_threads * k * sizeof(BitSetHit))
+                              : NULL;
+        if (q == NULL || tasks == NULL || hits == NULL)
+        {
+            bitset_aligned_free(q);
+            free(tasks);
+            free(hits);
+            bitset_report(BITSET_ERR_NO_MEMORY, "BitSetRows_tanimoto_search_mt");
+            return SIZE_MAX;
+        }
+        for (size_t t = 0; t < num_threads; t++)
+        {
+            tasks[t].rows = rows;
+            tasks[t].q = q;
+            tasks[t].qc = qc;
+            tasks[t].begin = rows->num_rows * t / num_threads;
+            tasks[t].end = rows->num_rows * (t + 1) / num_threads;
+            tasks[t].threshold = threshold;
+            tasks[t].k = k;
+            tasks[t].hits = hits + t * k;
+            tasks[t].len = 0;
+        }
+        bitset_run_threads(bitset_tanimoto_worker, tasks, sizeof(bitset_tanimoto_task), num_threads);
+        size_t len = 0;
+        for (size_t t = 0; t < num_threads; t++)
+        {
+            for (size_t i = 0; i < tasks[t].len; i++)
+            {
+                len = bitset_hits_push(out, len, k, tasks[t].hits[i], 0);
+            }
+        }
+        bitset_aligned_free(q);
+        free(tasks);
+        free(hits);
+        bitset_hits_sort(out, len, 0);
+        return len;
+    }
+#endif
+
+    bitset_internal size_t bitset_words_xor_count(const uint64_t *a, const uint64_t *b, size_t words)
+    {
+        size_t count;
+        BITSET_POPCOUNT_LOOP(count, 0, words, w, a[w] ^ b[w]);
+        return count;
+    }
+
+    /* Checks row "r" against the query, returns the new heap length */
+    bitset_internal size_t bitset_hamming_check(const BitSetRows *rows, const uint64_t *q, size_t r, size_t max_distance,
+                                                size_t k, BitSetHit *hits, size_t len)
+    {
+        size_t d = bitset_words_xor_count(q, rows->words + r * rows->stride, rows->stride);
+        if (d <= max_distance)
+        {
+            BitSetHit hit;
+            hit.row = r;
+            hit.score = (double)d;
+            len = bitset_hits_push(hits, len, k, hit, 1);
+        }
+        return len;
+    }
+
+    /* Hamming scan of the rows not in "visited" (NULL for all of them) into the heap "hits", returns its length */
+    bitset_internal size_t bitset_hamming_scan(const BitSetRows *rows, const uint64_t *q, size_t qc,
+                                               BitSetStamped *visited, size_t max_distance, size_t k, BitSetHit *hits,
+                                               size_t len)
+    {
+        for (size_t r = 0; r < rows->num_rows; r++)
+        {
+            size_t rc = rows->counts[r];
+            size_t bound = qc < rc ? rc - qc : qc - rc;
+            /* rows seen by an index search come in any order, so a row tying the worst hit may still win */
+            if (bound > max_distance || (len == k && (double)bound > hits[0].score) ||
+                (visited && BitSetStamped_get(visited, r)))
+            {
+                continue;
+            }
+            len = bitset_hamming_check(rows, q, r, max_distance, k, hits, len);
+        }
+        return len;
+    }
+
+    bitset_forced_inline size_t BitSetRows_hamming_search(const BitSetRows *rows, const BitSet *query,
+                                                          size_t max_distance, size_t k, BitSetHit *out)
+    {
+        BITSET_ASSERT(rows && query && (out || k == 0), "BitSetRows_hamming_search: Argument is NULL");
+        if (k == 0)
+        {
+            return 0;
+        }
+        size_t qc;
+        uint64_t *q = bitset_rows_query(rows, query, &qc);
+        if (q == NULL)
+        {
+            bitset_report(BITSET_ERR_NO_MEMORY, "BitSetRows_hamming_search");
+            return SIZE_MAX;
+        }
+        size_t len = bitset_hamming_scan(rows, q, qc, NULL, max_distance, k, out, 0);
+        bitset_aligned_free(q);
+        bitset_hits_sort(out, len, 1);
+        return len;
+    }
+
+    /* Substring "t" of a row, bits past the row length read as zero */
+    bitset_internal uint32_t bitset_mih_key(const uint64_t *row, size_t t)
+    {
+        size_t bit = t * BITSET_MIH_BITS;
+        return (uint32_t)(row[bit / 64] >> (bit % 64)) & ((1u << BITSET_MIH_BITS) - 1);
+    }
+
+    bitset_forced_inline BitSetStatus BitSetHammingIndex_init(BitSetHammingIndex *idx, const BitSetRows *rows,
+                                                              size_t num_tables)
+    {
+        BITSET_ASSERT(idx && rows, "BitSetHammingIndex_init: Argument is NULL");
+        BITSET_ASSERT(rows->num_rows <= UINT32_MAX, "BitSetHammingIndex_init: Too many rows");
+        size_t keys = (size_t)1 << BITSET_MIH_BITS;
+        size_t substrings = (rows->bit_len + BITSET_MIH_BITS - 1) / BITSET_MIH_BITS;
+        idx->rows = rows;
+        idx->num_tables = num_tables == 0 || num_tables > substrings ? substrings : num_tables;
+        idx->offsets = (uint32_t *)malloc((idx->num_tables * (keys + 1) + 1) * sizeof(uint32_t));
+        idx->ids = (uint32_t *)malloc((idx->num_tables * rows->num_rows + 1) * sizeof(uint32_t));
+        BitSetStamped_init(&idx->visited, rows->num_rows);
+        if (idx->offsets == NULL || idx->ids == NULL || idx->visited.words == NULL)
+        {
+            BitSetHammingIndex_free(idx);
+            return bitset_report(BITSET_ERR_NO_MEMORY, "BitSetHammingIndex_init");
+        }
+        /* counting sort of the rows by substring value, one table at a time */
+        for (size_t t = 0; t < idx->num_tables; t++)
+        {
+            uint32_t *offsets = idx->offsets + t * (keys + 1);
+            uint32_t *ids = idx->ids + t * rows->num_rows;
+            memset(offsets, 0, (keys + 1) * sizeof(uint32_t));
+            for (size_t r = 0; r < rows->num_rows; r++)
+            {
+                offsets[bitset_mih_key(rows->words + r * rows->stride, t) + 1]++;
+            }
+            for (size_t v = 0; v < keys; v++)
+            {
+                offsets[v + 1] += offsets[v];
+            }
+            for (size_t r = 0; r < rows->num_rows; r++)
+            {
+                ids[offsets[bitset_mih_key(rows->words + r * rows->stride, t)]++] = (uint32_t)r;
+            }
+            /* the fill moved every offset to the start of the next bucket */
+            memmove(offsets + 1, offsets, keys * sizeof(uint32_t));
+            offsets[0] = 0;
+        }
+        return BITSET_OK;
+    }
+
+    bitset_forced_inline void BitSetHammingIndex_free(BitSetHammingIndex *idx)
+    {
+        BITSET_ASSERT(idx, "BitSetHammingIndex_free: BitSetHammingIndex is NULL");
+        free(idx->offsets);
+        free(idx->ids);
+        idx->offsets = NULL;
+        idx->ids = NULL;
+        if (idx->visited.words)
+        {
+            BitSetStamped_free(&idx->visited);
+        }
+    }
+
+    /*
+    Probes every table at radius 0, 1, 2 ... After radius "s" every row left has all indexed substrings at
+    distance above "s", so it is at least num_tables * (s + 1) away and the search can stop once the heap is
+    full of closer rows. "visited" must be clear.
+    */
+    bitset_internal size_t bitset_mih_search(const BitSetHammingIndex *idx, BitSetStamped *visited, const uint64_t *q,
+                                             size_t qc, size_t max_distance, size_t k, BitSetHit *hits)
+    {
+        const BitSetRows *rows = idx->rows;
+        size_t m = idx->num_tables;
+        size_t keys = (size_t)1 << BITSET_MIH_BITS;
+        size_t len = 0;
+        /* buckets within radius "s" of a substring, C(BITSET_MIH_BITS, s) */
+        size_t ring = 1;
+        for (size_t s = 0; m > 0 && s <= BITSET_MIH_BITS; s++)
+        {
+            if (m * s > max_distance || (len == k && hits[0].score < (double)(m * s)))
+            {
+                return len;
+            }
+            if (m * ring > rows->num_rows)
+            {
+                break;
+            }
+            for (size_t t = 0; t < m; t++)
+            {
+                const uint32_t *offsets = idx->offsets + t * (keys + 1);
+                const uint32_t *ids = idx->ids + t * rows->num_rows;
+                size_t width = rows->bit_len - t * BITSET_MIH_BITS;
+                width = width < BITSET_MIH_BITS ? width : BITSET_MIH_BITS;
+                if (s > width)
+                {
+                    continue;
+                }
+                uint32_t key = bitset_mih_key(q, t);
+                /* every "width" bit mask with "s" bits set, in increasing order */
+                uint32_t flip = ((uint32_t)1 << s) - 1;
+                while (flip < ((uint32_t)1 << width))
+                {
+                    uint32_t v = key ^ flip;
+                    for (uint32_t i = offsets[v]; i < offsets[v + 1]; i++)
+                    {
+                        if (!BitSetStamped_test_and_set(visited, ids[i]))
+                        {
+                            len = bitset_hamming_check(rows, q, ids[i], max_distance, k, hits, len);
+                        }
+                    }
+                    if (flip == 0)
+                    {
+                        break;
+                    }
+                    uint32_t low = flip & (0u - flip);
+                    uint32_t next = flip + low;
+                    flip = (((next ^ flip) >> 2) / low) | next;
+                }
+            }
+            ring = ring * (BITSET_MIH_BITS - s) / (s + 1);
+        }
+        /* probing further costs more than reading the rows left */
+        return bitset_hamming_scan(rows, q, qc, visited, max_distance, k, hits, len);
+    }
+
+    bitset_forced_inline size_t BitSetHammingIndex_search(BitSetHammingIndex *idx, const BitSet *query,
+                                                          size_t max_distance, size_t k, BitSetHit *out)
+    {
+        BITSET_ASSERT(idx && query && (out || k == 0), "BitSetHammingIndex_search: Argument is NULL");
+        if (k == 0)
+        {
+            return 0;
+        }
+        size_t qc;
+        uint64_t *q = bitset_rows_query(idx->rows, query, &qc);
+        if (q == NULL)
+        {
+            bitset_report(BITSET_ERR_NO_MEMORY, "BitSetHammingIndex_search");
+            return SIZE_MAX;
+        }
+        BitSetStamped_clear_all(&idx->visited);
+        size_t len = bitset_mih_search(idx, &idx->visited, q, qc, max_distance, k, out);
+        bitset_aligned_free(q);
+        bitset_hits_sort(out, len, 1);
+        return len;
+    }
+
+    /* Searches queries [begin, end) with "visited" as scratch, returns 0 or -1 if memory allocation failed */
+    bitset_internal int bitset_mih_batch(const BitSetHammingIndex *idx, BitSetStamped *visited, const BitSet *queries,
+                                         size_t begin, size_t end, size_t max_distance, size_t k, BitSetHit *out,
+                                         size_t *lens)
+    {
+        const BitSetRows *rows = idx->rows;
+        uint64_t *q = (uint64_t *)bitset_aligned_alloc((rows->stride ? rows->stride : 8) * sizeof(uint64_t), 64);
+        if (q == NULL)
+        {
+            return -1;
+        }
+        for (size_t i = begin; i < end; i++)
+        {
+            size_t qc = bitset_rows_fill_query(rows, &queries[i], q);
+            BitSetStamped_clear_all(visited);
+            lens[i] = bitset_mih_search(idx, visited, q, qc, max_distance, k, out + i * k);
+            bitset_hits_sort(out + i * k, lens[i], 1);
+        }
+        bitset_aligned_free(q);
+        return 0;
+    }
+
+    bitset_forced_inline int BitSetHammingIndex_search_batch(BitSetHammingIndex *idx, const BitSet *queries,
+                                                             size_t num_queries, size_t max_distance, size_t k,
+                                                             BitSetHit *out, size_t *lens)
+    {
+        BITSET_ASSERT(idx && (queries || num_queries == 0) && (out || k == 0) && (lens || num_queries == 0),
+                      "BitSetHammingIndex_search_batch: Argument is NULL");
+        if (k == 0)
+        {
+            memset(lens, 0, num_queries * sizeof(size_t));
+            return 0;
+        }
+        if (bitset_mih_batch(idx, &idx->visited, queries, 0, num_queries, max_distance, k, out, lens) != 0)
+        {
+            bitset_report(BITSET_ERR_NO_MEMORY, "BitSetHammingIndex_search_batch");
+            return -1;
+        }
+        return 0;
+    }
+
+#if defined(BITSET_THREADS)
+    typedef struct
+    {
+        const BitSetHammingIndex *idx;
+        const BitSet *queries;
+        size_t begin;
+        size_t end;
+        size_t max_distance;
+        size_t k;
+        BitSetHit *out;
+        size_t *lens;
+        int status;
+    } bitset_mih_task;
+
+    bitset_internal void *bitset_mih_worker(void *arg)
+    {
+        bitset_mih_task *t = (bitset_mih_task *)arg;
+        BitSetStamped visited;
+        BitSetStamped_init(&visited, t->idx->rows->num_rows);
+        if (visited.words == NULL)
+        {
+            t->status = -1;
+            return NULL;
+        }
+        t->status = bitset_mih_batch(t->idx, &visited, t->queries, t->begin, t->end, t->max_distance, t->k, t->out,
+                                     t->lens);
+        BitSetStamped_free(&visited);
+        return NULL;
+    }
+
+    bitset_forced_inline int BitSetHammingIndex_search_batch_mt(const BitSetHammingIndex *idx, const BitSet *queries,
+                                                                size_t num_queries, size_t max_distance, size_t k,
+                                                                BitSetHit *out, size_t *lens, size_t num_threads)
+    {
+        BITSET_ASSERT(idx && (queries || num_queries == 0) && (out || k == 0) && (lens || num_queries == 0),
+                      "BitSetHammingIndex_search_batch_mt: Argument is NULL");
+        if (k == 0 || num_queries == 0)
+        {
+            memset(lens, 0, num_queries * sizeof(size_t));
+            return 0;
+        }
+        if (num_threads == 0)
+        {
+            num_threads = 1;
+        }
+        if (num_threads > num_queries)
+        {
+            num_threads = num_queries;
+        }
+        bitset_mih_task *tasks = (bitset_mih_task *)malloc(num_threads * sizeof(bitset_mih_task));
+        if (tasks == NULL)
+        {
+            bitset_report(BITSET_ERR_NO_MEMORY, "BitSetHammingIndex_search_batch_mt");
+            return -1;
+        }
+        for (size_t t = 0; t < num_threads; t++)
+        {
+            tasks[t].idx = idx;
+            tasks[t].queries = queries;
+            tasks[t].begin = num_queries * t / num_threads;
+            tasks[t].end = num_queries * (t + 1) / num_threads;
+            tasks[t].max_distance = max_distance;
+            tasks[t].k = k;
+            tasks[t].out = out;
+            tasks[t].lens = lens;
+            tasks[t].status = 0;
+        }
+        bitset_run_threads(bitset_mih_worker, tasks, sizeof(bitset_mih_task), num_threads);
+        int status = 0;
+        for (size_t t = 0; t < num_threads; t++)
+        {
+            status |= tasks[t].status;
+        }
+        free(tasks);
+        if (status != 0)
+        {
+            bitset_report(BITSET_ERR_NO_MEMORY, "BitSetHammingIndex_search_batch_mt");
+            return -1;
+        }
+        return 0;
+    }
+#endif
+
+#if defined(BITSET_THREADS)
+    bitset_forced_inline BitSetStatus BitSetConcurrent_init(BitSetConcurrent *c, size_t bit_len)
+    {
+        BITSET_ASSERT(c, "BitSetConcurrent_init: BitSetConcurrent is NULL");
+        size_t word_len = (bit_len + 63) / 64;
+        size_t blocks = (word_len + BITSET_SEQLOCK_BLOCK_WORDS - 1) / BITSET_SEQLOCK_BLOCK_WORDS;
+        c->bit_len = bit_len;
+        c->seq = 0;
+        c->words = (uint64_t *)calloc(word_len ? word_len : 1, sizeof(uint64_t));
+        c->seqs = (size_t *)calloc(blocks ? blocks : 1, sizeof(size_t));
+        if (c->words == NULL || c->seqs == NULL)
+        {
+            BitSetConcurrent_free(c);
+            return bitset_report(BITSET_ERR_NO_MEMORY, "BitSetConcurrent_init");
+        }
+        return BITSET_OK;
+    }
+
+    bitset_forced_inline void BitSetConcurrent_free(BitSetConcurrent *c)
+    {
+        BITSET_ASSERT(c, "BitSetConcurrent_free: BitSetConcurrent is NULL");
+        free(c->words);
+        free(c->seqs);
+        c->words = NULL;
+        c->seqs = NULL;
+        c->bit_len = 0;
+    }
+
+    /* Writer side of the seqlocks. An operation keeps the global counter odd from start to finish and
+       each block counter odd while that block is written. Data words are stored with release and loaded
+       with acquire instead of using standalone fences, which keeps the protocol visible to TSan. */
+    bitset_internal void bitset_seq_write_begin(size_t *seq)
+    {
+        __atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+    }
+
+    bitset_internal void bitset_seq_write_end(size_t *seq)
+    {
+        __atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+    }
+
+    /* Copies block "block" into "out" as of a single point in time, returns the number of words copied. */
+    bitset_internal size_t bitset_seq_read_block(const BitSetConcurrent *c, size_t block, uint64_t *out)
+    {
+        size_t word_len = (c->bit_len + 63) / 64;
+        size_t begin = block * BITSET_SEQLOCK_BLOCK_WORDS;
+        size_t n = word_len - begin < BITSET_SEQLOCK_BLOCK_WORDS ? word_len - begin : BITSET_SEQLOCK_BLOCK_WORDS;
+        for (;;)
+        {
+            size_t seq = __atomic_load_n(&c->seqs[block], __ATOMIC_ACQUIRE);
+            if (seq & 1)
+            {
+                continue;
+            }
+            for (size_t i = 0; i < n; i++)
+            {
+                out[i] = __atomic_load_n(&c->words[begin + i], __ATOMIC_ACQUIRE);
+            }
+            if (__atomic_load_n(&c->seqs[block], __ATOMIC_RELAXED) == seq)
+            {
+                return n;
+            }
+        }
+    }
+
+    bitset_forced_inline unsigned int BitSetConcurrent_get(const BitSetConcurrent *c, size_t index)
+    {
+        BITSET_ASSERT(c, "BitSetConcurrent_get: BitSetConcurrent is NULL");
+        BITSET_ASSERT(index < c->bit_len, "BitSetConcurrent_get: Index out of bounds");
+        return (unsigned int)(__atomic_load_n(&c->words[index / 64], __ATOMIC_RELAXED) >> (index % 64)) & 1;
+    }
+
+    bitset_forced_inline size_t BitSetConcurrent_count(const BitSetConcurrent *c)
+    {
+        BITSET_ASSERT(c, "BitSetConcurrent_count: BitSetConcurrent is NULL");
+        size_t blocks = ((c->bit_len + 63) / 64 + BITSET_SEQLOCK_BLOCK_WORDS - 1) / BITSET_SEQLOCK_BLOCK_WORDS;
+        uint64_t buf[BITSET_SEQLOCK_BLOCK_WORDS];
+        size_t count = 0;
+        for (size_t b = 0; b < blocks; b++)
+        {
+            size_t n = bitset_seq_read_block(c, b, buf);
+            for (size_t i = 0; i < n; i++)
+            {
+                count += bitset_popcount64(buf[i]);
+            }
+        }
+        return count;
+    }
+
+    bitset_forced_inline void BitSetConcurrent_snapshot(const BitSetConcurrent *c, BitSet *dest)
+    {
+        BITSET_ASSERT(c && dest, "BitSetConcurrent_snapshot: Argument is NULL");
+        BITSET_ASSERT(c->bit_len == dest->bit_len, "BitSetConcurrent_snapshot: Length mismatch");
+        size_t word_len = (c->bit_len + 63) / 64;
+        for (;;)
+        {
+            size_t seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+            if (seq & 1)
+            {
+                continue;
+            }
+            for (size_t i = 0; i < word_len; i++)
+            {
+                bitset_store_word(dest->bits + i * 8, __atomic_load_n(&c->words[i], __ATOMIC_ACQUIRE));
+            }
+            if (__atomic_load_n(&c->seq, __ATOMIC_RELAXED) == seq)
+            {
+                break;
+            }
+        }
+        bitset_mark_dirty_range(dest, 0, BitSet_get_byte_len(dest));
+    }
+
+    /* 0 = set, 1 = clear, 2 = flip */
+    bitset_internal void bitset_concurrent_update(BitSetConcurrent *c, size_t index, int op)
+    {
+        BITSET_ASSERT(index < c->bit_len, "BitSetConcurrent: Index out of bounds");
+        size_t w = index / 64;
+        uint64_t bit = (uint64_t)1 << (index % 64);
+        uint64_t word = op == 0 ? c->words[w] | bit : op == 1 ? c->words[w] & ~bit : c->words[w] ^ bit;
+        bitset_seq_write_begin(&c->seq);
+        bitset_seq_write_begin(&c->seqs[w / BITSET_SEQLOCK_BLOCK_WORDS]);
+        __atomic_store_n(&c->words[w], word, __ATOMIC_RELEASE);
+        bitset_seq_write_end(&c->seqs[w / BITSET_SEQLOCK_BLOCK_WORDS]);
+        bitset_seq_write_end(&c->seq);
+    }
+
+    bitset_forced_inline void BitSetConcurrent_set(BitSetConcurrent *c, size_t index)
+    {
+        BITSET_ASSERT(c, "BitSetConcurrent_set: BitSetConcurrent is NULL");
+        bitset_concurrent_update(c, index, 0);
+    }
+
+    bitset_forced_inline void BitSetConcurrent_clear(BitSetConcurrent *c, size_t index)
+    {
+        BITSET_ASSERT(c, "BitSetConcurrent_clear: BitSetConcurrent is NULL");
+        bitset_concurrent_update(c, index, 1);
+    }
+
+    bitset_forced_inline void BitSetConcurrent_flip(BitSetConcurrent *c, size_t index)
+    {
+        BITSET_ASSERT(c, "BitSetConcurrent_flip: BitSetConcurrent is NULL");
+        bitset_concurrent_update(c, index, 2);
+    }
+
+    /* 0 = or, 1 = and, 2 = xor */
+    bitset_internal void bitset_concurrent_bulk(BitSetConcurrent *c, const BitSet *src, int op)
+    {
+        size_t cw = (c->bit_len + 63) / 64;
+        size_t sw = BitSet_get_word_len(src);
+        /* "src" reads as zero past its end, which only changes "c" for AND */
+        size_t word_len = op == 1 || cw < sw ? cw : sw;
+        uint64_t tail = c->bit_len % 64 ? ((uint64_t)1 << (c->bit_len % 64)) - 1 : ~(uint64_t)0;
+        bitset_seq_write_begin(&c->seq);
+        for (size_t begin = 0; begin < word_len; begin += BITSET_SEQLOCK_BLOCK_WORDS)
+        {
+            size_t end = word_len - begin < BITSET_SEQLOCK_BLOCK_WORDS ? word_len : begin + BITSET_SEQLOCK_BLOCK_WORDS;
+            bitset_seq_write_begin(&c->seqs[begin / BITSET_SEQLOCK_BLOCK_WORDS]);
+            for (size_t i = begin; i < end; i++)
+            {
+                uint64_t w = i < sw ? bitset_load_word(src->bits + i * 8) : 0;
+                /* keep the bits past the end of "c" zero */
+                w &= i + 1 == cw ? tail : ~(uint64_t)0;
+                uint64_t word = op == 0 ? c->words[i] | w : op == 1 ? c->words[i] & w : c->words[i] ^ w;
+                __atomic_store_n(&c->words[i], word, __ATOMIC_RELEASE);
+            }
+            bitset_seq_write_end(&c->seqs[begin / BITSET_SEQLOCK_BLOCK_WORDS]);
+        }
+        bitset_seq_write_end(&c->seq);
+    }
+
+    bitset_forced_inline void BitSetConcurrent_or(BitSetConcurrent *c, const BitSet *src)
+    {
+        BITSET_ASSERT(c && src, "BitSetConcurrent_or: Argument is NULL");
+        bitset_concurrent_bulk(c, src, 0);
+    }
+
+    bitset_forced_inline void BitSetConcurrent_and(BitSetConcurrent *c, const BitSet *src)
+    {
+        BITSET_ASSERT(c && src, "BitSetConcurrent_and: Argument is NULL");
+        bitset_concurrent_bulk(c, src, 1);
+    }
+
+    bitset_forced_inline void BitSetConcurrent_xor(BitSetConcurrent *c, const BitSet *src)
+    {
+        BITSET_ASSERT(c && src, "BitSetConcurrent_xor: Argument is NULL");
+        bitset_concurrent_bulk(c, src, 2);
+    }
+
+    /* Number of NUMA nodes, 1 when they cannot be discovered. */
+#if defined(__linux__)
+    /* Calls "add" for every id of a sysfs list such as "0-3,8-11", returns 0 when the file cannot be opened */
+    bitset_internal int bitset_read_id_list(const char *path, void (*add)(unsigned int id, void *ctx), void *ctx)
+    {
+        FILE *f = fopen(path, "r");
+        if (f == NULL)
+        {
+            return 0;
+        }
+        unsigned int first, last;
+        while (fscanf(f, "%u", &first) == 1)
+        {
+            last = first;
+            int c = fgetc(f);
+            if (c == '-' && fscanf(f, "%u", &last) == 1)
+            {
+                c = fgetc(f);
+            }
+            for (unsigned int id = first; id <= last; id++)
+            {
+                add(id, ctx);
+            }
+            if (c != ',')
+            {
+                break;
+            }
+        }
+        fclose(f);
+        return 1;
+    }
+#endif
+
+    typedef struct
+    {
+        int *ids;
+        size_t len;
+        size_t cap;
+    } bitset_node_list;
+
+    bitset_internal void bitset_numa_add_node(unsigned int id, void *ctx)
+    {
+        bitset_node_list *list = (bitset_node_list *)ctx;
+        if (list->ids && list->len < list->cap)
+        {
+            list->ids[list->len] = (int)id;
+        }
+        list->len++;
+    }
+
+    /* Reads the online nodes into bn->node_ids, their ids may have gaps. Without sysfs there is one node 0. */
+    bitset_internal BitSetStatus bitset_numa_read_nodes(BitSetNuma *bn)
+    {
+        bitset_node_list list = {NULL, 0, 0};
+#if defined(__linux__)
+        const char *path = "/sys/devices/system/node/online";
+        if (!bitset_read_id_list(path, bitset_numa_add_node, &list))
+        {
+            path = "/sys/devices/system/node/possible";
+            bitset_read_id_list(path, bitset_numa_add_node, &list);
+        }
+#endif
+        list.cap = list.len ? list.len : 1;
+        list.ids = (int *)malloc(list.cap * sizeof(int));
+        if (list.ids == NULL)
+        {
+            return BITSET_ERR_NO_MEMORY;
+        }
+        list.len = 0;
+#if defined(__linux__)
+        /* a node going offline in between only shortens the list */
+        bitset_read_id_list(path, bitset_numa_add_node, &list);
+#endif
+        if (list.len == 0)
+        {
+            list.ids[0] = 0;
+            list.len = 1;
+        }
+        bn->node_ids = list.ids;
+        bn->num_nodes = list.len < list.cap ? list.len : list.cap;
+        return BITSET_OK;
+    }
+
+#if defined(__linux__) && defined(CPU_SET)
+    bitset_internal void bitset_numa_add_cpu(unsigned int id, void *ctx)
+    {
+        if (id < CPU_SETSIZE)
+        {
+            CPU_SET(id, (cpu_set_t *)ctx);
+        }
+    }
+#endif
+
+    /* Pins the calling thread to the CPUs of "node", does nothing when that is not supported. */
+    bitset_internal void bitset_numa_pin(int node)
+    {
+#if defined(__linux__) && defined(CPU_SET)
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (bitset_read_id_list(path, bitset_numa_add_cpu, &set) && CPU_COUNT(&set) > 0)
+        {
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        }
+#else
+        (void)node;
+#endif
+    }
+
+    typedef struct
+    {
+        BitSetNuma *bn;
+        const BitSetNuma *other;
+        /* index in bn->node_ids */
+        size_t node;
+        /* 0 = allocate, 1 = or, 2 = and, 3 = xor, 4 = count, 5 = for each */
+        int op;
+        /* set bits for count, partitions that could not be allocated for allocate */
+        size_t count;
+        BitSetIndexFn fn;
+        void *ctx;
+        int *cancelled;
+    } bitset_numa_task;
+
+    bitset_internal void *bitset_numa_worker(void *arg)
+    {
+        bitset_numa_task *task = (bitset_numa_task *)arg;
+        BitSetNuma *bn = task->bn;
+        bitset_numa_pin(bn->node_ids[task->node]);
+        for (size_t p = 0; p < bn->num_parts; p++)
+        {
+            if ((size_t)bn->nodes[p] != task->node)
+            {
+                continue;
+            }
+            BitSet *part = &bn->parts[p];
+            /* "other" reads as zero past its last partition, which only changes "bn" for AND */
+            if (task->op >= 1 && task->op <= 3 && p >= task->other->num_parts)
+            {
+                if (task->op == 2)
+                {
+                    BitSet_clear_all(part);
+                }
+                continue;
+            }
+            switch (task->op)
+            {
+            case 0:
+            {
+                size_t bits = bn->bit_len - p * bn->part_bits < bn->part_bits ? bn->bit_len - p * bn->part_bits : bn->part_bits;
+                if (BitSet_try_init(part, bits) != BITSET_OK)
+                {
+                    task->count++;
+                    break;
+                }
+                /* calloc may hand out untouched pages, fault them in from this node */
+                memset(part->bits, 0, BitSet_get_word_len(part) * sizeof(uint64_t));
+                break;
+            }
+            case 1:
+                BitSet_or(part, &task->other->parts[p]);
+                break;
+            case 2:
+                BitSet_and(part, &task->other->parts[p]);
+                break;
+            case 3:
+                BitSet_xor(part, &task->other->parts[p]);
+                break;
+            case 4:
+                task->count += BitSet_count(part);
+                break;
+            default:
+            {
+                size_t word_len = BitSet_get_word_len(part);
+                for (size_t w = 0; w < word_len; w++)
+                {
+                    if (__atomic_load_n(task->cancelled, __ATOMIC_RELAXED))
+                    {
+                        return NULL;
+                    }
+                    uint64_t word = bitset_load_word(part->bits + w * 8);
+                    while (word)
+                    {
+                        if (task->fn(p * bn->part_bits + w * 64 + bitset_ctz64(word), task->ctx))
+                        {
+                            __atomic_store_n(task->cancelled, 1, __ATOMIC_RELAXED);
+                            return NULL;
+                        }
+                        word &= word - 1;
+                    }
+                }
+                break;
+            }
+            }
+        }
+        return NULL;
+    }
+
+    bitset_internal void bitset_numa_task_init(bitset_numa_task *task, BitSetNuma *bn, const BitSetNuma *other, size_t node,
+                                               int op, BitSetIndexFn fn, void *ctx, int *cancelled)
+    {
+        task->bn = bn;
+        task->other = other;
+        task->node = node;
+        task->op = op;
+        task->count = 0;
+        task->fn = fn;
+        task->ctx = ctx;
+        task->cancelled = cancelled;
+    }
+
+    /*
+    Runs "op" with one pinned thread per node, returns the summed count. The calling thread runs node 0 itself, so its
+    affinity mask is put back before returning. Without memory for the task table the nodes run one after another on
+    the calling thread.
+    */
+    bitset_internal size_t bitset_numa_run(BitSetNuma *bn, const BitSetNuma *other, int op, BitSetIndexFn fn, void *ctx, int *cancelled)
+    {
+#if defined(__linux__) && defined(CPU_SET)
+        cpu_set_t saved;
+        int restore = pthread_getaffinity_np(pthread_self(), sizeof(saved), &saved) == 0;
+#endif
+        size_t count = 0;
+        bitset_numa_task *tasks = (bitset_numa_task *)malloc(bn->num_nodes * sizeof(bitset_numa_task));
+        if (tasks == NULL)
+        {
+            bitset_numa_task task;
+            for (size_t n = 0; n < bn->num_nodes; n++)
+            {
+                bitset_numa_task_init(&task, bn, other, n, op, fn, ctx, cancelled);
+                bitset_numa_worker(&task);
+                count += task.count;
+            }
+        }
+        else
+        {
+            for (size_t n = 0; n < bn->num_nodes; n++)
+            {
+                bitset_numa_task_init(&tasks[n], bn, other, n, op, fn, ctx, cancelled);
+            }
+            bitset_run_threads(bitset_numa_worker, tasks, sizeof(bitset_numa_task), bn->num_nodes);
+            for (size_t n = 0; n < bn->num_nodes; n++)
+            {
+                count += tasks[n].count;
+            }
+            free(tasks);
+        }
+#if defined(__linux__) && defined(CPU_SET)
+        if (restore)
+        {
+            pthread_setaffinity_np(pthread_self(), sizeof(saved), &saved);
+        }
+#endif
+        return count;
+    }
+
+    bitset_forced_inline BitSetStatus BitSetNuma_init(BitSetNuma *bn, size_t bit_len, size_t part_bits)
+    {
+        BITSET_ASSERT(bn, "BitSetNuma_init: BitSetNuma is NULL");
+        bn->bit_len = bit_len;
+        bn->parts = NULL;
+        bn->nodes = NULL;
+        bn->num_parts = 0;
+        if (bitset_numa_read_nodes(bn) != BITSET_OK)
+        {
+            return bitset_report(BITSET_ERR_NO_MEMORY, "BitSetNuma_init");
+        }
+        if (part_bits == 0)
+        {
+            part_bits = (bit_len + bn->num_nodes - 1) / bn->num_nodes;
+        }
+        bn->part_bits = part_bits ? (part_bits + 63) / 64 * 64 : 64;
+        bn->num_parts = (bit_len + bn->part_bits - 1) / bn->part_bits;
+        bn->parts = (BitSet *)calloc(bn->num_parts ? bn->num_parts : 1, sizeof(BitSet));
+        bn->nodes = (int *)malloc((bn->num_parts ? bn->num_parts : 1) * sizeof(int));
+        if (bn->parts == NULL || bn->nodes == NULL)
+        {
+            bn->num_parts = 0;
+            BitSetNuma_free(bn);
+            return bitset_report(BITSET_ERR_NO_MEMORY, "BitSetNuma_init");
+        }
+        for (size_t p = 0; p < bn->num_parts; p++)
+        {
+            bn->nodes[p] = (int)(p % bn->num_nodes);
+        }
+        /* the workers count the partitions they could not allocate, those stay zeroed BitSets that free ignores */
+        if (bitset_numa_run(bn, NULL, 0, NULL, NULL, NULL) != 0)
+        {
+            BitSetNuma_free(bn);
+            return bitset_report(BITSET_ERR_NO_MEMORY, "BitSetNuma_init");
+        }
+        return BITSET_OK;
+    }
+
+    bitset_forced_inline void BitSetNuma_free(BitSetNuma *bn)
+    {
+        BITSET_ASSERT(bn, "BitSetNuma_free: BitSetNuma is NULL");
+        for (size_t p = 0; p < bn->num_parts; p++)
+        {
+            BitSet_free(&bn->parts[p]);
+        }
+        free(bn->parts);
+        free(bn->nodes);
+        free(bn->node_ids);
+        bn->parts = NULL;
+        bn->nodes = NULL;
+        bn->node_ids = NULL;
+        bn->num_parts = 0;
+        bn->bit_len = 0;
+    }
+
+    bitset_forced_inline size_t BitSetNuma_num_nodes(const BitSetNuma *bn)
+    {
+        BITSET_ASSERT(bn, "BitSetNuma_num_nodes: BitSetNuma is NULL");
+        return bn->num_nodes;
+    }
+
+    bitset_forced_inline unsigned int BitSetNuma_get(const BitSetNuma *bn, size_t index)
+    {
+        BITSET_ASSERT(bn, "BitSetNuma_get: BitSetNuma is NULL");
+        BITSET_ASSERT(index < bn->bit_len, "BitSetNuma_get: Index out of bounds");
+        return BitSet_get(&bn->parts[index / bn->part_bits], index % bn->part_bits);
+    }
+
+    bitset_forced_inline void BitSetNuma_set(BitSetNuma *bn, size_t index)
+    {
+        BITSET_ASSERT(bn, "BitSetNuma_set: BitSetNuma is NULL");
+        BITSET_ASSERT(index < bn->bit_len, "BitSetNuma_set: Index out of bounds");
+        BitSet_set(&bn->parts[index / bn->part_bits], index % bn->part_bits);
+    }
+
+    bitset_forced_inline void BitSetNuma_clear(BitSetNuma *bn, size_t index)
+    {
+        BITSET_ASSERT(bn, "BitSetNuma_clear: BitSetNuma is NULL");
+        BITSET_ASSERT(index < bn->bit_len, "BitSetNuma_clear: Index out of bounds");
+        BitSet_clear(&bn->parts[index / bn->part_bits], index % bn->part_bits);
+    }
+
+    bitset_forced_inline void BitSetNuma_or(BitSetNuma *dest, const BitSetNuma *src)
+    {
+        BITSET_ASSERT(dest && src, "BitSetNuma_or: BitSetNuma is NULL");
+        BITSET_ASSERT(dest->part_bits == src->part_bits, "BitSetNuma_or: Partition size mismatch");
+        bitset_numa_run(dest, src, 1, NULL, NULL, NULL);
+    }
+
+    bitset_forced_inline void BitSetNuma_and(BitSetNuma *dest, const BitSetNuma *src)
+    {
+        BITSET_ASSERT(dest && src, "BitSetNuma_and: BitSetNuma is NULL");
+        BITSET_ASSERT(dest->part_bits == src->part_bits, "BitSetNuma_and: Partition size mismatch");
+        bitset_numa_run(dest, src, 2, NULL, NULL, NULL);
+    }
+
+    bitset_forced_inline void BitSetNuma_xor(BitSetNuma *dest, const BitSetNuma *src)
+    {
+        BITSET_ASSERT(dest && src, "BitSetNuma_xor: BitSetNuma is NULL");
+        BITSET_ASSERT(dest->part_bits == src->part_bits, "BitSetNuma_xor: Partition size mismatch");
+        bitset_numa_run(dest, src, 3, NULL, NULL, NULL);
+    }
+
+    bitset_forced_inline size_t BitSetNuma_count(const BitSetNuma *bn)
+    {
+        BITSET_ASSERT(bn, "BitSetNuma_count: BitSetNuma is NULL");
+        /* the count and for each workers only read the partitions */
+        return bitset_numa_run((BitSetNuma *)bn, NULL, 4, NULL, NULL, NULL);
+    }
+
+    bitset_forced_inline int BitSetNuma_for_each_set(const BitSetNuma *bn, BitSetIndexFn fn, void *ctx)
+    {
+        BITSET_ASSERT(bn && fn, "BitSetNuma_for_each_set: Argument is NULL");
+        int cancelled = 0;
+        bitset_numa_run((BitSetNuma *)bn, NULL, 5, fn, ctx, &cancelled);
+        return cancelled;
+    }
+#endif /* BITSET_THREADS */
 #ifdef __cplusplus
 }
 #endif
\ No newline at end of file
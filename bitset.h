@@ -1,393 +1,2201 @@
-/**
- * @file bitset.h
- * @author Adam Naghavi (adamnaghavif@gmail.com)
- * @brief A simple bitset implementation in C.
- * @version 0.1
- * @date 2024-06-03
- *
- * @copyright Copyright (c) 2024
- *
- * @warning Do not forget to define BITSET_IMPLEMENTATION before including this header.
- *
- * @note In debug mode, the library will check for NULL pointers and out of bounds indices.
- *
- */
-
-#ifdef __cplusplus
-#pragma once
-extern "C"
-{
-#endif
-
-#ifndef BITSET_H
-#define BITSET_H
-
-#ifdef __GNUC__
-#define bitset_forced_inline __attribute__((always_inline)) static inline
-#elif defined(_MSC_VER)
-#define bitset_forced_inline __forceinline static
-#elif defined(__INTEL_COMPILER)
-#define bitset_forced_inline inline __attribute__((always_inline)) static
-#else
-#define bitset_forced_inline inline static
-#endif
-
-#if defined(_DEBUG) || !defined(NDEBUG) || !defined(__OPTIMIZE__)
-#define BITSET_DEBUG_MODE 1
-#if defined(SIGTRAP)
-#define BITSET_DEBUG_BREAK() raise(SIGTRAP)
-#else
-#define BITSET_DEBUG_BREAK() raise(SIGABRT)
-#endif
-#else
-#define BITSET_DEBUG_MODE 0
-#define BITSET_DEBUG_BREAK() ((void)0)
-#endif
-
-#include <signal.h>
-
-#if BITSET_DEBUG_MODE
-#define BITSET_ASSERT(cond, msg)                         \
-    if (!(cond))                                         \
-    {                                                    \
-        fprintf(stderr, "Validation failed: %s\n", msg); \
-        BITSET_DEBUG_BREAK();                            \
-    }
-#else
-#define BITSET_ASSERT(cond, msg) 
-#endif
-
-#include <stdint.h>
-#include <stdlib.h>
-#include <stdio.h>
-
-    /* Declarations */
-
-    /**
-     * @brief  Dont forget to define BITSET_IMPLEMENTATION before including this header.
-     * 
-     */
-    typedef struct BitSet BitSet;
-
-    /**
-     * @brief Allows for accessing flat arrays as if they were higher dimensional arrays.
-     *   Example:
-     *   size_t index = linear_index({2, 2}, 2, {1, 1});\n
-     *
-     * @param num_dims Number of dimensions.
-     * @param dims Array of length "num_dims" that contains the dimensions.
-     * @param indices Array/vector length of "num_dims" that contains the indices.
-     * @return size_t Linear index.
-     */
-    bitset_forced_inline size_t linear_index(size_t num_dims, const size_t *dims, const size_t *indices);
-
-    /**
-     * @brief Returns a vector "indicies" that is the length of "num_dims"
-     *
-     * @param num_dims Number of dimensions.
-     * @param dims Array of length "num_dims" that contains the dimensions.
-     * @param index Index to convert to a vector.
-     * @param indices Blank array of length "num_dims" to store the result vector.
-     * @return Check indices for the result.
-     */
-    bitset_forced_inline void inverse_linear_index(size_t num_dims, const size_t *dims, size_t index, size_t *indices);
-
-    /**
-     * @brief Calculates the number of bytes needed to store the BitSet.
-     *
-     * @param bs Pointer to BitSet, cannot be NULL.
-     * @return void
-     *
-     * @note Ensure that the BitSet has been properly initialized before calling this function.
-     */
-    bitset_forced_inline size_t BitSet_get_byte_len(const BitSet *bs);
-
-    /**
-     * @brief Do not forget to use BitSet_free.
-     *
-     * @param bs Pointer to BitSet, cannot be NULL.
-     * @param bit_len Number of bits in the BitSet.
-     * @return void
-     *
-     * @note Ensure that BITSET_IMPLEMENTATION is defined before including this header.
-     */
-    bitset_forced_inline void BitSet_init(BitSet *bs, size_t bit_len);
-
-    /**
-     * @brief Free the memory allocated by BitSet_init
-     *
-     * @param bs Pointer to BitSet, cannot be NULL.
-     * @return void
-     *
-     * @note Ensure that the BitSet has been properly initialized before calling this function.
-     */
-    bitset_forced_inline void BitSet_free(BitSet *bs);
-
-    /**
-     * @brief Copy the contents of "src" to "dest". "Dest" should be uninitialized.
-     *
-     * @param dest Pointer to uninitialized BitSet, cannot be NULL.
-     * @param src Pointer to BitSet, cannot be NULL.
-     * @return void
-     *
-     * @note Ensure that the BitSet has been properly initialized before calling this function.
-     */
-    bitset_forced_inline void BitSet_copy_construct(BitSet *dest, const BitSet *src);
-
-    /**
-     * @brief Sets all bits to 1.
-     *
-     * @param bs Pointer to BitSet, cannot be NULL.
-     * @return void
-     *
-     * @note Ensure that the BitSet has been properly initialized before calling this function.
-     */
-    bitset_forced_inline void BitSet_set_all(BitSet *bs);
-
-    /**
-     * @brief Sets all bits to 0.
-     *
-     * @param bs Pointer to BitSet, cannot be NULL.
-     * @return void
-     *
-     * @note Ensure that the BitSet has been properly initialized before calling this function.
-     */
-    bitset_forced_inline void BitSet_clear_all(BitSet *bs);
-
-    /**
-     * @brief Sets bit at "index" to 1.
-     *
-     * @param bs Pointer to BitSet, cannot be NULL.
-     * @param index Bit index.
-     * @return void
-     *
-     * @note Ensure that the BitSet has been properly initialized before calling this function.
-     */
-    bitset_forced_inline void BitSet_set(BitSet *bs, size_t index);
-
-    /**
-     * @brief Sets bit at "index" to 0.
-     *
-     * @param bs
-     * @param index
-     * @return void
-     *
-     * @note Ensure that the BitSet has been properly initialized before calling this function.
-     */
-    bitset_forced_inline void BitSet_clear(BitSet *bs, size_t index);
-
-    /* returns the value of the bit at "index" */
-    /**
-     * @brief Get the value of the bit at "index".
-     *
-     * @param bs Pointer to BitSet, cannot be NULL.
-     * @param index Bit index.
-     * @return 1 or 0.
-     *
-     * @note Ensure that the BitSet has been properly initialized before calling this function.
-     */
-    bitset_forced_inline unsigned int BitSet_get(const BitSet *bs, size_t index);
-
-    /**
-     * @brief Flip the value of a specific bit in a BitSet.
-     *
-     * This function inverts the value of the bit at the specified index in the BitSet.
-     * If the bit is 0, it will be set to 1, and if it is 1, it will be set to 0.
-     *
-     * @param bs Pointer to the BitSet.
-     * @param index Index of the bit to flip.
-     *
-     * @details The function checks if the BitSet pointer is valid and the index is within bounds.
-     * Flipping a bit is performed using the XOR operation.
-     *
-     * @note Ensure that the BitSet has been properly initialized before calling this function.
-     *
-     * @warning The function does not handle cases where the index is out of bounds.
-     */
-    bitset_forced_inline void BitSet_flip(BitSet *bs, size_t index);
-
-    /**
-     * @brief Perform a bitwise OR operation between two BitSets.
-     *
-     * This function performs a bitwise OR operation between the destination BitSet and the source BitSet.
-     * The result is stored in the destination BitSet.
-     *
-     * @param dest Pointer to the destination BitSet.
-     * @param src Pointer to the source BitSet.
-     *
-     * @details The function assumes that both BitSets have been properly initialized and have the same bit length.
-     * The bitwise OR operation is performed byte by byte.
-     *
-     * @note Ensure that both BitSets have the same length for meaningful results.
-     *
-     * @warning The function will use the length of the smaller BitSet if the BitSets have different lengths.
-     */
-    bitset_forced_inline void BitSet_or(BitSet *dest, const BitSet *src);
-
-    /**
-     * @brief Perform a bitwise AND operation between two BitSets.
-     *
-     * This function performs a bitwise AND operation between the destination BitSet and the source BitSet.
-     * The result is stored in the destination BitSet.
-     *
-     * @param dest Pointer to the destination BitSet.
-     * @param src Pointer to the source BitSet.
-     *
-     * @details The function assumes that both BitSets have been properly initialized and have the same bit length.
-     * The bitwise AND operation is performed byte by byte.
-     *
-     * @note Ensure that both BitSets have the same length for meaningful results.
-     *
-     * @warning The function will use the length of the smaller BitSet if the BitSets have different lengths.
-     */
-    bitset_forced_inline void BitSet_and(BitSet *dest, const BitSet *src);
-
-    /**
-     * @brief Perform a bitwise XOR operation between two BitSets.
-     *
-     * This function performs a bitwise XOR operation between the destination BitSet and the source BitSet.
-     * The result is stored in the destination BitSet.
-     *
-     * @param dest Pointer to the destination BitSet.
-     * @param src Pointer to the source BitSet.
-     *
-     * @details The function assumes that both BitSets have been properly initialized and have the same bit length.
-     * The bitwise XOR operation is performed byte by byte.
-     *
-     * @note Ensure that both BitSets have the same length for meaningful results.
-     *
-     * @warning The function will use the length of the smaller BitSet if the BitSets have different lengths.
-     */
-    bitset_forced_inline void BitSet_xor(BitSet *dest, const BitSet *src);
-
-    /**
-     * @brief Perform a bitwise NOT operation on a BitSet.
-     *
-     * This function inverts all bits in the BitSet. Each bit is flipped from 0 to 1 or from 1 to 0.
-     *
-     * @param bs Pointer to the BitSet.
-     *
-     * @details The function assumes that the BitSet has been properly initialized.
-     * The bitwise NOT operation is performed byte by byte.
-     *
-     * @note Ensure that the BitSet has been properly initialized before calling this function.
-     *
-     * @warning The function will use the length of the smaller BitSet if the BitSets have different lengths.
-     */
-    bitset_forced_inline void BitSet_not(BitSet *bs);
-
-    /**
-     * @brief Check if two BitSets are equal.
-     *
-     * This function compares two BitSets and returns 1 if they are equal, and 0 otherwise.
-     *
-     * @param bs1 Pointer to the first BitSet.
-     * @param bs2 Pointer to the second BitSet.
-     *
-     * @return 1 if the BitSets are equal, 0 otherwise.
-     *
-     * @details The function checks if both BitSets have the same length and compares their bits byte by byte.
-     *
-     * @note Ensure that both BitSets have been properly initialized before calling this function.
-     *
-     * @warning The function will use the length of the smaller BitSet if the BitSets have different lengths.
-     */
-    bitset_forced_inline int BitSet_equals(const BitSet *bs1, const BitSet *bs2);
-
-    /**
-     * @brief Print the BitSet.
-     *
-     * This function prints the BitSet to the standard output.
-     *
-     * @param bs Pointer to the BitSet.
-     * @param newline Number of bits to print per line.
-     *
-     * @details The function prints each bit in the BitSet. After printing the specified number of bits,
-     * it prints a newline character.
-     *
-     * @note Ensure that the BitSet has been properly initialized before calling this function.
-     */
-    bitset_forced_inline void BitSet_print(const BitSet *bs, int newline);
-
-    /*  Implementation */
-
-#if defined(BITSET_CPP_WRAPPER) && defined(__cplusplus) && defined(BITSET_IMPLEMENTATION)
-
-    struct BitSetWrapper
-    {
-        BitSet bs;
-        BitSetWrapper() = delete;
-        BitSetWrapper(size_t bit_len)
-        {
-            BitSet_init(&bs, bit_len);
-        }
-        ~BitSetWrapper()
-        {
-            BitSet_free(&bs);
-        }
-        BitSetWrapper(const BitSetWrapper &other)
-        {
-            BitSet_copy_construct(&bs, &other.bs);
-        }
-        BitSetWrapper &operator=(const BitSetWrapper &other)
-        {
-            BitSet_copy_construct(&bs, &other.bs);
-            return *this;
-        }
-        void set(size_t index)
-        {
-            BitSet_set(&bs, index);
-        }
-        void clear(size_t index)
-        {
-            BitSet_clear(&bs, index);
-        }
-        unsigned int get(size_t index)
-        {
-            return BitSet_get(&bs, index);
-        }
-        void flip(size_t index)
-        {
-            BitSet_flip(&bs, index);
-        }
-        void set_all()
-        {
-            BitSet_set_all(&bs);
-        }
-        void clear_all()
-        {
-            BitSet_clear_all(&bs);
-        }
-        void or_op(const BitSetWrapper &other)
-        {
-            BitSet_or(&bs, &other.bs);
-        }
-        void and_op(const BitSetWrapper &other)
-        {
-            BitSet_and(&bs, &other.bs);
-        }
-        void xor_op(const BitSetWrapper &other)
-        {
-            BitSet_xor(&bs, &other.bs);
-        }
-        void not_op()
-        {
-            BitSet_not(&bs);
-        }
-        int equals(const BitSetWrapper &other)
-        {
-            return BitSet_equals(&bs, &other.bs);
-        }
-        void print(int newline)
-        {
-            BitSet_print(&bs, newline);
-        }
-    };
-
-#endif /* BITSET_CPP_WRAPPER */
-
-#endif /* BITSET_H */
-
-#ifdef __cplusplus
-} /* extern "C" */
-#endif
+/**
+ * @file bitset.h
+ * @author Adam Naghavi (adamnaghavif@gmail.com)
+ * @brief A simple bitset implementation in C.
+ * @version 0.1
+ * @date 2024-06-03
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * @warning Do not forget to define BITSET_IMPLEMENTATION before including this header.
+ *
+ * @note In debug mode, the library will check for NULL pointers and out of bounds indices.
+ * See bitset_config.h to force debug mode on or off independently of NDEBUG.
+ *
+ * @note Define BITSET_THREADS to enable the multithreaded variants, they require pthreads.
+ *
+ */
+
+#ifdef __cplusplus
+#pragma once
+extern "C"
+{
+#endif
+
+#ifndef BITSET_H
+#define BITSET_H
+
+#ifdef __GNUC__
+#define bitset_forced_inline __attribute__((always_inline)) static inline
+#elif defined(_MSC_VER)
+#define bitset_forced_inline __forceinline static
+#elif defined(__INTEL_COMPILER)
+#define bitset_forced_inline inline __attribute__((always_inline)) static
+#else
+#define bitset_forced_inline inline static
+#endif
+
+#ifdef _MSC_VER
+#define bitset_internal static __inline
+#else
+#define bitset_internal static inline
+#endif
+
+#include "bitset_config.h"
+
+#include <signal.h>
+
+#if BITSET_DEBUG_MODE
+#if defined(SIGTRAP)
+#define BITSET_DEBUG_BREAK() raise(SIGTRAP)
+#else
+#define BITSET_DEBUG_BREAK() raise(SIGABRT)
+#endif
+#else
+#define BITSET_DEBUG_BREAK() ((void)0)
+#endif
+
+#if BITSET_DEBUG_MODE
+#define BITSET_ASSERT(cond, msg)                         \
+    if (!(cond))                                         \
+    {                                                    \
+        fprintf(stderr, "Validation failed: %s\n", msg); \
+        BITSET_DEBUG_BREAK();                            \
+    }
+#else
+#define BITSET_ASSERT(cond, msg) 
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+/* off_t for BitSet_flush_dirty */
+#include <sys/types.h>
+#endif
+
+    /* Declarations */
+
+    /**
+     * @brief  Dont forget to define BITSET_IMPLEMENTATION before including this header.
+     * 
+     */
+    typedef struct BitSet BitSet;
+
+    /**
+     * @brief Result of the checked functions.
+     *
+     */
+    typedef enum BitSetStatus
+    {
+        BITSET_OK = 0,
+        BITSET_ERR_NULL,
+        BITSET_ERR_OUT_OF_BOUNDS,
+        BITSET_ERR_NO_MEMORY
+    } BitSetStatus;
+
+    /**
+     * @brief Called on every allocation failure before the failing function returns.
+     *
+     * @param status The error, BITSET_ERR_NO_MEMORY.
+     * @param func Name of the failing function.
+     * @param ctx Context pointer given to BitSet_set_error_handler.
+     */
+    typedef void (*BitSetErrorHandler)(BitSetStatus status, const char *func, void *ctx);
+
+    /**
+     * @brief How the _ex functions write whole buffers.
+     *
+     */
+    typedef enum BitSetMemMode
+    {
+        /* libc below BITSET_STREAM_THRESHOLD bytes, non-temporal stores from there on */
+        BITSET_MEM_AUTO = 0,
+        /* always memset / memcpy, the written data stays in cache */
+        BITSET_MEM_LIBC,
+        /* always non-temporal stores that bypass the cache, memset / memcpy when SSE2 is not available */
+        BITSET_MEM_STREAM
+    } BitSetMemMode;
+
+    /**
+     * @brief Copy-on-write BitSet. Storage is split into reference counted pages of BITSET_COW_PAGE_SIZE bytes
+     * that are shared between snapshots and only cloned when written.
+     *
+     */
+    typedef struct BitSetCow BitSetCow;
+
+    /**
+     * @brief Persistent (immutable) BitSet. Versions are 64-ary tries of 64-bit words that share every node
+     * a mutation did not touch.
+     *
+     */
+    typedef struct BitSetPersistent BitSetPersistent;
+
+    /**
+     * @brief Callback invoked with a bit index. Return non zero to stop the iteration.
+     *
+     */
+    typedef int (*BitSetIndexFn)(size_t index, void *ctx);
+
+    /**
+     * @brief Callback invoked with a match of pattern "pattern" ending at text position "end" (inclusive), with
+     * "distance" edits. Return non zero to stop the search.
+     *
+     */
+    typedef int (*BitSetMatchFn)(size_t pattern, size_t end, size_t distance, void *ctx);
+
+    /**
+     * @brief Callback invoked with the "count" vertices of a clique. Return non zero to stop the search.
+     *
+     */
+    typedef int (*BitSetCliqueFn)(const size_t *vertices, size_t count, void *ctx);
+
+    /**
+     * @brief BitSet that gives every writer thread a private shard, merged into a main BitSet on demand.
+     *
+     */
+    typedef struct BitSetSharded BitSetSharded;
+
+    /**
+     * @brief BitSet with a generation stamp per word, so clearing every bit is O(1).
+     *
+     */
+    typedef struct BitSetStamped BitSetStamped;
+
+    /**
+     * @brief Contiguous table of fixed width rows, each 64 byte aligned and stored with its popcount. Meant for
+     * scanning many fingerprints or binary codes against a query.
+     *
+     */
+    typedef struct BitSetRows BitSetRows;
+
+    /**
+     * @brief Multi-index hashing index for Hamming distance searches over a BitSetRows table.
+     *
+     */
+    typedef struct BitSetHammingIndex BitSetHammingIndex;
+
+    /**
+     * @brief A row returned by a BitSetRows search with its similarity to the query, or its distance for
+     * Hamming searches.
+     *
+     */
+    typedef struct
+    {
+        size_t row;
+        double score;
+    } BitSetHit;
+
+#if defined(BITSET_THREADS)
+    /**
+     * @brief BitSet with one writer thread and any number of lock-free reader threads.
+     *
+     */
+    typedef struct BitSetConcurrent BitSetConcurrent;
+
+    /**
+     * @brief BitSet split into partitions that live on, and are processed by threads pinned to, different
+     * NUMA nodes.
+     *
+     */
+    typedef struct BitSetNuma BitSetNuma;
+#endif
+
+    /**
+     * @brief Allows for accessing flat arrays as if they were higher dimensional arrays.
+     *   Example:
+     *   size_t index = linear_index({2, 2}, 2, {1, 1});\n
+     *
+     * @param num_dims Number of dimensions.
+     * @param dims Array of length "num_dims" that contains the dimensions.
+     * @param indices Array/vector length of "num_dims" that contains the indices.
+     * @return size_t Linear index.
+     */
+    bitset_forced_inline size_t linear_index(size_t num_dims, const size_t *dims, const size_t *indices);
+
+    /**
+     * @brief Returns a vector "indicies" that is the length of "num_dims"
+     *
+     * @param num_dims Number of dimensions.
+     * @param dims Array of length "num_dims" that contains the dimensions.
+     * @param index Index to convert to a vector.
+     * @param indices Blank array of length "num_dims" to store the result vector.
+     * @return Check indices for the result.
+     */
+    bitset_forced_inline void inverse_linear_index(size_t num_dims, const size_t *dims, size_t index, size_t *indices);
+
+    /**
+     * @brief Calculates the number of bytes needed to store the BitSet.
+     *
+     * @param bs Pointer to BitSet, cannot be NULL.
+     * @return void
+     *
+     * @note Ensure that the BitSet has been properly initialized before calling this function.
+     */
+    bitset_forced_inline size_t BitSet_get_byte_len(const BitSet *bs);
+
+    /**
+     * @brief Calculates the number of 64-bit words backing the BitSet.
+     *
+     * @param bs Pointer to BitSet, cannot be NULL.
+     * @return size_t Number of words.
+     *
+     * @details Storage is always allocated in whole words and the bytes past "BitSet_get_byte_len" are zero,
+     * so word-wide kernels never have to special case the end of the buffer.
+     */
+    bitset_forced_inline size_t BitSet_get_word_len(const BitSet *bs);
+
+    /**
+     * @brief Do not forget to use BitSet_free.
+     *
+     * @param bs Pointer to BitSet, cannot be NULL.
+     * @param bit_len Number of bits in the BitSet.
+     * @return void
+     *
+     * @note Ensure that BITSET_IMPLEMENTATION is defined before including this header.
+     */
+    bitset_forced_inline void BitSet_init(BitSet *bs, size_t bit_len);
+
+    /**
+     * @brief Free the memory allocated by BitSet_init
+     *
+     * @param bs Pointer to BitSet, cannot be NULL.
+     * @return void
+     *
+     * @note Ensure that the BitSet has been properly initialized before calling this function.
+     */
+    bitset_forced_inline void BitSet_free(BitSet *bs);
+
+    /**
+     * @brief Copy the contents of "src" to "dest". "Dest" should be uninitialized.
+     *
+     * @param dest Pointer to uninitialized BitSet, cannot be NULL.
+     * @param src Pointer to BitSet, cannot be NULL.
+     * @return void
+     *
+     * @note Ensure that the BitSet has been properly initialized before calling this function.
+     */
+    bitset_forced_inline void BitSet_copy_construct(BitSet *dest, const BitSet *src);
+
+    /**
+     * @brief Install a process wide handler for allocation failures, NULL removes it.
+     *
+     * @param handler Function to call, may be NULL.
+     * @param ctx Passed through to "handler".
+     * @return void
+     *
+     * @note Not synchronized, install the handler before other threads use the library.
+     */
+    bitset_forced_inline void BitSet_set_error_handler(BitSetErrorHandler handler, void *ctx);
+
+    /**
+     * @brief Like BitSet_init, but reports allocation failure instead of leaving a NULL buffer behind.
+     *
+     * @param bs Pointer to BitSet, cannot be NULL.
+     * @param bit_len Number of bits in the BitSet.
+     * @return BITSET_OK, BITSET_ERR_NULL or BITSET_ERR_NO_MEMORY.
+     *
+     * @note On failure "bs" is left empty and can be passed to BitSet_free.
+     */
+    bitset_forced_inline BitSetStatus BitSet_try_init(BitSet *bs, size_t bit_len);
+
+    /**
+     * @brief Like BitSet_copy_construct, but reports allocation failure.
+     *
+     * @param dest Pointer to uninitialized BitSet, cannot be NULL.
+     * @param src Pointer to BitSet, cannot be NULL.
+     * @return BITSET_OK, BITSET_ERR_NULL or BITSET_ERR_NO_MEMORY.
+     *
+     * @note On failure "dest" is left empty and can be passed to BitSet_free.
+     */
+    bitset_forced_inline BitSetStatus BitSet_try_copy(BitSet *dest, const BitSet *src);
+
+    /**
+     * @brief Change the length of "bs" to "bit_len" bits, keeping the existing bits. New bits are 0.
+     *
+     * @param bs Pointer to BitSet, cannot be NULL.
+     * @param bit_len New number of bits.
+     * @return BITSET_OK, BITSET_ERR_NULL or BITSET_ERR_NO_MEMORY.
+     *
+     * @note On failure "bs" is unchanged. Dirty tracking stays enabled and the grown part is marked dirty.
+     */
+    bitset_forced_inline BitSetStatus BitSet_try_resize(BitSet *bs, size_t bit_len);
+
+    /**
+     * @brief Sets all bits to 1.
+     *
+     * @param bs Pointer to BitSet, cannot be NULL.
+     * @return void
+     *
+     * @note Ensure that the BitSet has been properly initialized before calling this function.
+     */
+    bitset_forced_inline void BitSet_set_all(BitSet *bs);
+
+    /**
+     * @brief Sets all bits to 0.
+     *
+     * Small buffers are zeroed with memset. On Linux, buffers of at least BITSET_RELEASE_THRESHOLD bytes
+     * return their whole pages to the OS with madvise(MADV_DONTNEED) and fault back in as zero on the next
+     * write. With BitSet_enable_lazy_clear only the pages touched since the last clear are zeroed.
+     *
+     * @param bs Pointer to BitSet, cannot be NULL.
+     * @return void
+     *
+     * @note Ensure that the BitSet has been properly initialized before calling this function.
+     */
+    bitset_forced_inline void BitSet_clear_all(BitSet *bs);
+
+    /**
+     * @brief BitSet_set_all with an explicit write strategy.
+     *
+     * @param bs Pointer to BitSet, cannot be NULL.
+     * @param mode See BitSetMemMode.
+     * @return void
+     */
+    bitset_forced_inline void BitSet_set_all_ex(BitSet *bs, BitSetMemMode mode);
+
+    /**
+     * @brief BitSet_clear_all with an explicit write strategy.
+     *
+     * BITSET_MEM_AUTO keeps the page release of BitSet_clear_all, the other modes always write the buffer.
+     * With lazy clear enabled only the touched pages are zeroed, each run of consecutive touched pages with "mode".
+     *
+     * @param bs Pointer to BitSet, cannot be NULL.
+     * @param mode See BitSetMemMode.
+     * @return void
+     */
+    bitset_forced_inline void BitSet_clear_all_ex(BitSet *bs, BitSetMemMode mode);
+
+    /**
+     * @brief BitSet_copy_construct with an explicit write strategy.
+     *
+     * @param dest Pointer to uninitialized BitSet, cannot be NULL.
+     * @param src Pointer to BitSet, cannot be NULL.
+     * @param mode See BitSetMemMode.
+     * @return void
+     */
+    bitset_forced_inline void BitSet_copy_construct_ex(BitSet *dest, const BitSet *src, BitSetMemMode mode);
+
+    /**
+     * @brief Sets bit at "index" to 1.
+     *
+     * @param bs Pointer to BitSet, cannot be NULL.
+     * @param index Bit index.
+     * @return void
+     *
+     * @note Ensure that the BitSet has been properly initialized before calling this function.
+     */
+    bitset_forced_inline void BitSet_set(BitSet *bs, size_t index);
+
+    /**
+     * @brief Sets bit at "index" to 0.
+     *
+     * @param bs
+     * @param index
+     * @return void
+     *
+     * @note Ensure that the BitSet has been properly initialized before calling this function.
+     */
+    bitset_forced_inline void BitSet_clear(BitSet *bs, size_t index);
+
+    /* returns the value of the bit at "index" */
+    /**
+     * @brief Get the value of the bit at "index".
+     *
+     * @param bs Pointer to BitSet, cannot be NULL.
+     * @param index Bit index.
+     * @return 1 or 0.
+     *
+     * @note Ensure that the BitSet has been properly initialized before calling this function.
+     */
+    bitset_forced_inline unsigned int BitSet_get(const BitSet *bs, size_t index);
+
+    /**
+     * @brief Flip the value of a specific bit in a BitSet.
+     *
+     * This function inverts the value of the bit at the specified index in the BitSet.
+     * If the bit is 0, it will be set to 1, and if it is 1, it will be set to 0.
+     *
+     * @param bs Pointer to the BitSet.
+     * @param index Index of the bit to flip.
+     *
+     * @details The function checks if the BitSet pointer is valid and the index is within bounds.
+     * Flipping a bit is performed using the XOR operation.
+     *
+     * @note Ensure that the BitSet has been properly initialized before calling this function.
+     *
+     * @warning The function does not handle cases where the index is out of bounds.
+     */
+    bitset_forced_inline void BitSet_flip(BitSet *bs, size_t index);
+
+    /**
+     * @brief Get the value of the bit at "index" without any validation, even in debug mode.
+     *
+     * @param bs Pointer to BitSet, must not be NULL.
+     * @param index Bit index, must be in bounds.
+     * @return 1 or 0.
+     */
+    bitset_forced_inline unsigned int BitSet_get_unchecked(const BitSet *bs, size_t index);
+
+    /**
+     * @brief Sets bit at "index" to 1 without any validation, even in debug mode.
+     *
+     * @param bs Pointer to BitSet, must not be NULL.
+     * @param index Bit index, must be in bounds.
+     * @return void
+     *
+     * @warning Only the bit is written, the page is not marked for BitSet_enable_dirty_tracking or
+     * BitSet_enable_lazy_clear. Do not use it on a BitSet with either enabled.
+     */
+    bitset_forced_inline void BitSet_set_unchecked(BitSet *bs, size_t index);
+
+    /**
+     * @brief Sets bit at "index" to 0 without any validation, even in debug mode.
+     *
+     * @param bs Pointer to BitSet, must not be NULL.
+     * @param index Bit index, must be in bounds.
+     * @return void
+     *
+     * @warning Only the bit is written, the page is not marked for BitSet_enable_dirty_tracking or
+     * BitSet_enable_lazy_clear. Do not use it on a BitSet with either enabled.
+     */
+    bitset_forced_inline void BitSet_clear_unchecked(BitSet *bs, size_t index);
+
+    /**
+     * @brief Flip the bit at "index" without any validation, even in debug mode.
+     *
+     * @param bs Pointer to BitSet, must not be NULL.
+     * @param index Bit index, must be in bounds.
+     * @return void
+     *
+     * @warning Only the bit is written, the page is not marked for BitSet_enable_dirty_tracking or
+     * BitSet_enable_lazy_clear. Do not use it on a BitSet with either enabled.
+     */
+    bitset_forced_inline void BitSet_flip_unchecked(BitSet *bs, size_t index);
+
+    /**
+     * @brief Get the value of the bit at "index", always validating the arguments.
+     *
+     * @param bs Pointer to BitSet.
+     * @param index Bit index.
+     * @param out Receives 1 or 0 on success.
+     * @return BITSET_OK, BITSET_ERR_NULL or BITSET_ERR_OUT_OF_BOUNDS. Never raises a signal.
+     */
+    bitset_forced_inline BitSetStatus BitSet_get_checked(const BitSet *bs, size_t index, unsigned int *out);
+
+    /**
+     * @brief Sets bit at "index" to 1, always validating the arguments.
+     *
+     * @param bs Pointer to BitSet.
+     * @param index Bit index.
+     * @return BITSET_OK, BITSET_ERR_NULL or BITSET_ERR_OUT_OF_BOUNDS. Never raises a signal.
+     */
+    bitset_forced_inline BitSetStatus BitSet_set_checked(BitSet *bs, size_t index);
+
+    /**
+     * @brief Sets bit at "index" to 0, always validating the arguments.
+     *
+     * @param bs Pointer to BitSet.
+     * @param index Bit index.
+     * @return BITSET_OK, BITSET_ERR_NULL or BITSET_ERR_OUT_OF_BOUNDS. Never raises a signal.
+     */
+    bitset_forced_inline BitSetStatus BitSet_clear_checked(BitSet *bs, size_t index);
+
+    /**
+     * @brief Flip the bit at "index", always validating the arguments.
+     *
+     * @param bs Pointer to BitSet.
+     * @param index Bit index.
+     * @return BITSET_OK, BITSET_ERR_NULL or BITSET_ERR_OUT_OF_BOUNDS. Never raises a signal.
+     */
+    bitset_forced_inline BitSetStatus BitSet_flip_checked(BitSet *bs, size_t index);
+
+    /**
+     * @brief Perform a bitwise OR operation between two BitSets.
+     *
+     * This function performs a bitwise OR operation between the destination BitSet and the source BitSet.
+     * The result is stored in the destination BitSet.
+     *
+     * @param dest Pointer to the destination BitSet.
+     * @param src Pointer to the source BitSet.
+     *
+     * @details The operation is performed a word at a time. A shorter "src" reads as zero past its end, so every
+     * bit of "dest" is defined by the result. "dest" keeps its length and bits of a longer "src" past it are ignored.
+     * The padding bits past the end of "dest" stay zero.
+     */
+    bitset_forced_inline void BitSet_or(BitSet *dest, const BitSet *src);
+
+    /**
+     * @brief Perform a bitwise AND operation between two BitSets.
+     *
+     * This function performs a bitwise AND operation between the destination BitSet and the source BitSet.
+     * The result is stored in the destination BitSet.
+     *
+     * @param dest Pointer to the destination BitSet.
+     * @param src Pointer to the source BitSet.
+     *
+     * @details The operation is performed a word at a time. A shorter "src" reads as zero past its end, so every
+     * bit of "dest" is defined by the result. "dest" keeps its length and bits of a longer "src" past it are ignored.
+     * The padding bits past the end of "dest" stay zero.
+     */
+    bitset_forced_inline void BitSet_and(BitSet *dest, const BitSet *src);
+
+    /**
+     * @brief Perform a bitwise XOR operation between two BitSets.
+     *
+     * This function performs a bitwise XOR operation between the destination BitSet and the source BitSet.
+     * The result is stored in the destination BitSet.
+     *
+     * @param dest Pointer to the destination BitSet.
+     * @param src Pointer to the source BitSet.
+     *
+     * @details The operation is performed a word at a time. A shorter "src" reads as zero past its end, so every
+     * bit of "dest" is defined by the result. "dest" keeps its length and bits of a longer "src" past it are ignored.
+     * The padding bits past the end of "dest" stay zero.
+     */
+    bitset_forced_inline void BitSet_xor(BitSet *dest, const BitSet *src);
+
+    /**
+     * @brief Perform a bitwise NOT operation on a BitSet.
+     *
+     * This function inverts all bits in the BitSet. Each bit is flipped from 0 to 1 or from 1 to 0.
+     *
+     * @param bs Pointer to the BitSet.
+     *
+     * @details The operation is performed a word at a time. Only the "bit_len" bits are flipped, the padding bits
+     * past the end stay zero so BitSet_count and BitSet_equals see exactly the flipped set.
+     *
+     * @note Ensure that the BitSet has been properly initialized before calling this function.
+     */
+    bitset_forced_inline void BitSet_not(BitSet *bs);
+
+    /**
+     * @brief out = a OR b, in one pass. "a" and "b" are left untouched.
+     *
+     * @param out Pointer to an initialized BitSet, may alias "a" or "b". Its buffer is reused when large enough.
+     * @param a Pointer to BitSet, cannot be NULL.
+     * @param b Pointer to BitSet, cannot be NULL.
+     * @return void
+     *
+     * @note "out" is resized to max(a, b) bits, the shorter input reads as zero past its end.
+     */
+    bitset_forced_inline void BitSet_or_into(BitSet *out, const BitSet *a, const BitSet *b);
+
+    /**
+     * @brief out = a AND b, in one pass. "a" and "b" are left untouched.
+     *
+     * @param out Pointer to an initialized BitSet, may alias "a" or "b". Its buffer is reused when large enough.
+     * @param a Pointer to BitSet, cannot be NULL.
+     * @param b Pointer to BitSet, cannot be NULL.
+     * @return void
+     *
+     * @note "out" is resized to max(a, b) bits, the shorter input reads as zero past its end.
+     */
+    bitset_forced_inline void BitSet_and_into(BitSet *out, const BitSet *a, const BitSet *b);
+
+    /**
+     * @brief out = a XOR b, in one pass. "a" and "b" are left untouched.
+     *
+     * @param out Pointer to an initialized BitSet, may alias "a" or "b". Its buffer is reused when large enough.
+     * @param a Pointer to BitSet, cannot be NULL.
+     * @param b Pointer to BitSet, cannot be NULL.
+     * @return void
+     *
+     * @note "out" is resized to max(a, b) bits, the shorter input reads as zero past its end.
+     */
+    bitset_forced_inline void BitSet_xor_into(BitSet *out, const BitSet *a, const BitSet *b);
+
+    /**
+     * @brief out = NOT a, in one pass. "a" is left untouched and the padding bits of "out" stay zero.
+     *
+     * @param out Pointer to an initialized BitSet, may alias "a". Its buffer is reused when large enough.
+     * @param a Pointer to BitSet, cannot be NULL.
+     * @return void
+     *
+     * @note "out" is resized to the length of "a".
+     */
+    bitset_forced_inline void BitSet_not_into(BitSet *out, const BitSet *a);
+
+    /**
+     * @brief dest = dest AND NOT src, in one pass.
+     *
+     * @param dest Pointer to the destination BitSet, cannot be NULL.
+     * @param src Pointer to the source BitSet, cannot be NULL.
+     * @return void
+     *
+     * @note Like BitSet_and, a shorter "src" reads as zero past its end and "dest" keeps its length.
+     */
+    bitset_forced_inline void BitSet_andnot(BitSet *dest, const BitSet *src);
+
+    /**
+     * @brief out = a AND NOT b, in one pass. "a" and "b" are left untouched.
+     *
+     * @param out Pointer to an initialized BitSet, may alias "a" or "b". Its buffer is reused when large enough.
+     * @param a Pointer to BitSet, cannot be NULL.
+     * @param b Pointer to BitSet, cannot be NULL.
+     * @return void
+     *
+     * @note "out" is resized to max(a, b) bits, the shorter input reads as zero past its end.
+     */
+    bitset_forced_inline void BitSet_andnot_into(BitSet *out, const BitSet *a, const BitSet *b);
+
+    /**
+     * @brief dest = dest OR NOT src, in one pass.
+     *
+     * @param dest Pointer to the destination BitSet, cannot be NULL.
+     * @param src Pointer to the source BitSet, cannot be NULL.
+     * @return void
+     *
+     * @note Like BitSet_and, a shorter "src" reads as zero past its end and "dest" keeps its length.
+     */
+    bitset_forced_inline void BitSet_ornot(BitSet *dest, const BitSet *src);
+
+    /**
+     * @brief out = a OR NOT b, in one pass. "a" and "b" are left untouched.
+     *
+     * @param out Pointer to an initialized BitSet, may alias "a" or "b". Its buffer is reused when large enough.
+     * @param a Pointer to BitSet, cannot be NULL.
+     * @param b Pointer to BitSet, cannot be NULL.
+     * @return void
+     *
+     * @note "out" is resized to max(a, b) bits, the shorter input reads as zero past its end.
+     */
+    bitset_forced_inline void BitSet_ornot_into(BitSet *out, const BitSet *a, const BitSet *b);
+
+    /**
+     * @brief dest = NOT (dest AND src), in one pass.
+     *
+     * @param dest Pointer to the destination BitSet, cannot be NULL.
+     * @param src Pointer to the source BitSet, cannot be NULL.
+     * @return void
+     *
+     * @note Like BitSet_and, a shorter "src" reads as zero past its end and "dest" keeps its length.
+     */
+    bitset_forced_inline void BitSet_nand(BitSet *dest, const BitSet *src);
+
+    /**
+     * @brief out = NOT (a AND b), in one pass. "a" and "b" are left untouched.
+     *
+     * @param out Pointer to an initialized BitSet, may alias "a" or "b". Its buffer is reused when large enough.
+     * @param a Pointer to BitSet, cannot be NULL.
+     * @param b Pointer to BitSet, cannot be NULL.
+     * @return void
+     *
+     * @note "out" is resized to max(a, b) bits, the shorter input reads as zero past its end.
+     */
+    bitset_forced_inline void BitSet_nand_into(BitSet *out, const BitSet *a, const BitSet *b);
+
+    /**
+     * @brief dest = NOT (dest OR src), in one pass.
+     *
+     * @param dest Pointer to the destination BitSet, cannot be NULL.
+     * @param src Pointer to the source BitSet, cannot be NULL.
+     * @return void
+     *
+     * @note Like BitSet_and, a shorter "src" reads as zero past its end and "dest" keeps its length.
+     */
+    bitset_forced_inline void BitSet_nor(BitSet *dest, const BitSet *src);
+
+    /**
+     * @brief out = NOT (a OR b), in one pass. "a" and "b" are left untouched.
+     *
+     * @param out Pointer to an initialized BitSet, may alias "a" or "b". Its buffer is reused when large enough.
+     * @param a Pointer to BitSet, cannot be NULL.
+     * @param b Pointer to BitSet, cannot be NULL.
+     * @return void
+     *
+     * @note "out" is resized to max(a, b) bits, the shorter input reads as zero past its end.
+     */
+    bitset_forced_inline void BitSet_nor_into(BitSet *out, const BitSet *a, const BitSet *b);
+
+    /**
+     * @brief dest = NOT (dest XOR src), in one pass.
+     *
+     * @param dest Pointer to the destination BitSet, cannot be NULL.
+     * @param src Pointer to the source BitSet, cannot be NULL.
+     * @return void
+     *
+     * @note Like BitSet_and, a shorter "src" reads as zero past its end and "dest" keeps its length.
+     */
+    bitset_forced_inline void BitSet_xnor(BitSet *dest, const BitSet *src);
+
+    /**
+     * @brief out = NOT (a XOR b), in one pass. "a" and "b" are left untouched.
+     *
+     * @param out Pointer to an initialized BitSet, may alias "a" or "b". Its buffer is reused when large enough.
+     * @param a Pointer to BitSet, cannot be NULL.
+     * @param b Pointer to BitSet, cannot be NULL.
+     * @return void
+     *
+     * @note "out" is resized to max(a, b) bits, the shorter input reads as zero past its end.
+     */
+    bitset_forced_inline void BitSet_xnor_into(BitSet *out, const BitSet *a, const BitSet *b);
+
+    /**
+     * @brief out = any boolean function of three BitSets, in one pass.
+     *
+     * Bit "(a << 2) | (b << 1) | c" of "imm8" is the result for that combination of input bits, the same truth
+     * table encoding as the AVX-512 vpternlog instruction. For example 0x96 is a ^ b ^ c, 0xE8 is the majority,
+     * 0xCA is "a ? b : c" and 0x80 is a & b & c.
+     *
+     * @param out Pointer to an initialized BitSet, may alias any input. Its buffer is reused when large enough.
+     * @param a Pointer to BitSet, cannot be NULL.
+     * @param b Pointer to BitSet, cannot be NULL.
+     * @param c Pointer to BitSet, cannot be NULL.
+     * @param imm8 Truth table.
+     * @return void
+     *
+     * @note "out" is resized to max(a, b, c) bits, shorter inputs read as zero past their end.
+     */
+    bitset_forced_inline void BitSet_ternary(BitSet *out, const BitSet *a, const BitSet *b, const BitSet *c, uint8_t imm8);
+
+    /**
+     * @brief dest |= src shifted towards higher indices by "shift" bits, in one pass.
+     *
+     * Bit "i" of "src" is ORed into bit "i + shift" of "dest", bits shifted past the end of "dest" are dropped.
+     * The usual subset sum step "reachable |= reachable << w" is BitSet_or_shifted(&reachable, &reachable, w).
+     *
+     * @param dest Pointer to the destination BitSet, cannot be NULL.
+     * @param src Pointer to the source BitSet, may be "dest". A shorter "src" reads as zero past its end.
+     * @param shift Number of bits to shift by.
+     * @return void
+     */
+    bitset_forced_inline void BitSet_or_shifted(BitSet *dest, const BitSet *src, size_t shift);
+
+    /**
+     * @brief Check if two BitSets are equal.
+     *
+     * This function compares two BitSets and returns 1 if they are equal, and 0 otherwise.
+     *
+     * @param bs1 Pointer to the first BitSet.
+     * @param bs2 Pointer to the second BitSet.
+     *
+     * @return 1 if the BitSets are equal, 0 otherwise.
+     *
+     * @details The function checks if both BitSets have the same length and compares their bits word by word.
+     *
+     * @note Ensure that both BitSets have been properly initialized before calling this function.
+     *
+     * @warning BitSets with different lengths are never equal, even if the longer one is zero past the shorter.
+     */
+    bitset_forced_inline int BitSet_equals(const BitSet *bs1, const BitSet *bs2);
+
+    /**
+     * @brief 64 bit hash of the length and the bits, equal BitSets hash equal.
+     *
+     * @param bs Pointer to BitSet, cannot be NULL.
+     * @return uint64_t Hash value, not stable across library versions.
+     */
+    bitset_forced_inline uint64_t BitSet_hash(const BitSet *bs);
+
+    /**
+     * @brief Print the BitSet.
+     *
+     * This function prints the BitSet to the standard output.
+     *
+     * @param bs Pointer to the BitSet.
+     * @param newline Number of bits to print per line.
+     *
+     * @details The function prints each bit in the BitSet. After printing the specified number of bits,
+     * it prints a newline character.
+     *
+     * @note Ensure that the BitSet has been properly initialized before calling this function.
+     */
+    bitset_forced_inline void BitSet_print(const BitSet *bs, int newline);
+
+    /**
+     * @brief Count the number of bits set to 1.
+     *
+     * @param bs Pointer to BitSet, cannot be NULL.
+     * @return size_t Number of set bits.
+     *
+     * @note Ensure that the BitSet has been properly initialized before calling this function.
+     */
+    bitset_forced_inline size_t BitSet_count(const BitSet *bs);
+
+    /**
+     * @brief Write the indices of the set bits, in ascending order, to "out".
+     *
+     * This is the compressed (posting list) form of a BitSet. Use BitSet_count to size "out".
+     *
+     * @param bs Pointer to BitSet, cannot be NULL.
+     * @param out Array that receives at most "max" indices.
+     * @param max Capacity of "out".
+     * @return size_t Number of indices written.
+     *
+     * @note Ensure that the BitSet has been properly initialized before calling this function.
+     */
+    bitset_forced_inline size_t BitSet_to_indices(const BitSet *bs, size_t *out, size_t max);
+
+    /**
+     * @brief Call "fn" with the index of every set bit, in ascending order.
+     *
+     * @param bs Pointer to BitSet, cannot be NULL.
+     * @param fn Callback, return non zero to stop.
+     * @param ctx Passed to "fn".
+     * @return int 1 if "fn" stopped the iteration, 0 otherwise.
+     *
+     * @note Ensure that the BitSet has been properly initialized before calling this function.
+     */
+    bitset_forced_inline int BitSet_for_each_set(const BitSet *bs, BitSetIndexFn fn, void *ctx);
+
+    /**
+     * @brief Get the values of the bits at "n" random indices.
+     *
+     * The batch is walked as a software pipeline: the byte for "idx[i + BITSET_PREFETCH_DISTANCE]" is
+     * prefetched while "idx[i]" is read, so many cache misses are in flight at once instead of one.
+     *
+     * @param bs Pointer to BitSet, cannot be NULL.
+     * @param idx Array of "n" bit indices.
+     * @param n Number of indices.
+     * @param out Array of "n" entries that receive 1 or 0.
+     * @return void
+     */
+    bitset_forced_inline void BitSet_get_many(const BitSet *bs, const size_t *idx, size_t n, uint8_t *out);
+
+    /**
+     * @brief Set the bits at "n" random indices to 1, prefetching ahead like BitSet_get_many.
+     *
+     * @param bs Pointer to BitSet, cannot be NULL.
+     * @param idx Array of "n" bit indices.
+     * @param n Number of indices.
+     * @return void
+     */
+    bitset_forced_inline void BitSet_set_many(BitSet *bs, const size_t *idx, size_t n);
+
+    /**
+     * @brief Set the bits at "n" random indices to 0, prefetching ahead like BitSet_get_many.
+     *
+     * @param bs Pointer to BitSet, cannot be NULL.
+     * @param idx Array of "n" bit indices.
+     * @param n Number of indices.
+     * @return void
+     */
+    bitset_forced_inline void BitSet_clear_many(BitSet *bs, const size_t *idx, size_t n);
+
+    /**
+     * @brief Set the bits at "n" random indices to 1 and report their previous values.
+     *
+     * Indices are processed in order, so a duplicate later in the batch sees the bit set by an earlier one.
+     *
+     * @param bs Pointer to BitSet, cannot be NULL.
+     * @param idx Array of "n" bit indices.
+     * @param n Number of indices.
+     * @param out Array of "n" entries that receive the previous value, 1 or 0.
+     * @return void
+     */
+    bitset_forced_inline void BitSet_test_and_set_many(BitSet *bs, const size_t *idx, size_t n, uint8_t *out);
+
+    /**
+     * @brief Stable radix sort of bit indices by the 4 KB page of storage they fall in.
+     *
+     * Sorting a batch before BitSet_set_many or BitSet_clear_many turns random accesses into a page by page
+     * sweep. The order within a page is kept.
+     *
+     * @param idx Array of "n" bit indices, sorted in place.
+     * @param n Number of indices.
+     * @param scratch Array of "n" entries used as temporary storage.
+     * @return void
+     */
+    bitset_forced_inline void BitSet_sort_indices(size_t *idx, size_t n, size_t *scratch);
+
+    /**
+     * @brief Number of entries BitSet_prefix_counts writes for blocks of "block_bits" bits.
+     *
+     * @param bs Pointer to BitSet, cannot be NULL.
+     * @param block_bits Block size in bits, must be a non zero multiple of 64.
+     * @return size_t Number of blocks plus one.
+     */
+    bitset_forced_inline size_t BitSet_prefix_counts_len(const BitSet *bs, size_t block_bits);
+
+    /**
+     * @brief Exclusive prefix sum of the popcount of every block of "block_bits" bits.
+     *
+     * "out[b]" is the number of set bits before block "b" and the last entry is the total. This gives the
+     * output offset of every block for stream compaction, and is the rank directory used by BitSet_rank.
+     *
+     * @param bs Pointer to BitSet, cannot be NULL.
+     * @param block_bits Block size in bits, must be a non zero multiple of 64.
+     * @param out Array of BitSet_prefix_counts_len entries.
+     * @return void
+     *
+     * @details Blocks are counted a word at a time with four independent accumulators, which compilers
+     * vectorize when a vector popcount instruction is available (for example -mavx512vpopcntdq).
+     */
+    bitset_forced_inline void BitSet_prefix_counts(const BitSet *bs, size_t block_bits, size_t *out);
+
+    /**
+     * @brief Count the set bits before "index" using the directory built by BitSet_prefix_counts.
+     *
+     * @param bs Pointer to BitSet, cannot be NULL.
+     * @param counts Output of BitSet_prefix_counts for the current contents of "bs".
+     * @param block_bits Block size "counts" was built with.
+     * @param index Bit index, may be equal to the length of the BitSet.
+     * @return size_t Number of set bits in [0, index).
+     */
+    bitset_forced_inline size_t BitSet_rank(const BitSet *bs, const size_t *counts, size_t block_bits, size_t index);
+
+    /**
+     * @brief Build one BitSet per distinct value of a dictionary encoded column.
+     *
+     * Row "r" is set in "out[codes[r]]". Instead of calling BitSet_set once per row, the column is walked
+     * in tiles of BITSET_INDEX_TILE_ROWS rows. Each tile is radix partitioned by code, so every output
+     * BitSet receives its words for that tile in one burst while they are hot in cache.
+     *
+     * @param out Array of "num_values" uninitialized BitSets, each is initialized to "num_rows" bits.
+     * @param num_values Number of distinct codes, every code must be less than this.
+     * @param codes Array of "num_rows" dictionary codes.
+     * @param num_rows Number of rows in the column.
+     * @return BitSetStatus BITSET_OK, or BITSET_ERR_NO_MEMORY in which case "out" is left uninitialized.
+     *
+     * @note Free every BitSet in "out" with BitSet_free. Use BitSet_to_indices for a compressed posting list.
+     */
+    bitset_forced_inline BitSetStatus BitSet_build_index(BitSet *out, size_t num_values, const uint32_t *codes, size_t num_rows);
+
+#if defined(BITSET_THREADS)
+    /**
+     * @brief Multithreaded BitSet_build_index.
+     *
+     * The rows are split into "num_threads" ranges on tile boundaries. Tiles are a multiple of 64 rows,
+     * so the threads write disjoint words and no merge pass is required.
+     *
+     * @param out Array of "num_values" uninitialized BitSets, each is initialized to "num_rows" bits.
+     * @param num_values Number of distinct codes, every code must be less than this.
+     * @param codes Array of "num_rows" dictionary codes.
+     * @param num_rows Number of rows in the column.
+     * @param num_threads Number of threads to use, 0 or 1 runs on the calling thread.
+     * @return BitSetStatus BITSET_OK, or BITSET_ERR_NO_MEMORY in which case "out" is left uninitialized.
+     *
+     * @note Requires BITSET_THREADS to be defined and linking with pthreads.
+     */
+    bitset_forced_inline BitSetStatus BitSet_build_index_mt(BitSet *out, size_t num_values, const uint32_t *codes, size_t num_rows, size_t num_threads);
+
+    /**
+     * @brief Multithreaded BitSet_prefix_counts. Threads count disjoint ranges of blocks, then the block
+     * counts are scanned on the calling thread.
+     *
+     * @param bs Pointer to BitSet, cannot be NULL.
+     * @param block_bits Block size in bits, must be a non zero multiple of 64.
+     * @param out Array of BitSet_prefix_counts_len entries.
+     * @param num_threads Number of threads to use, including the calling thread.
+     * @return void
+     */
+    bitset_forced_inline void BitSet_prefix_counts_mt(const BitSet *bs, size_t block_bits, size_t *out, size_t num_threads);
+
+    /**
+     * @brief Multithreaded BitSet_to_indices. The prefix counts give every thread the offset in "out"
+     * where its blocks start, so the threads compact in parallel without coordination.
+     *
+     * @param bs Pointer to BitSet, cannot be NULL.
+     * @param out Array large enough for BitSet_count indices.
+     * @param num_threads Number of threads to use, including the calling thread.
+     * @return size_t Number of indices written.
+     *
+     * @note Falls back to BitSet_to_indices when the per block counts cannot be allocated.
+     */
+    bitset_forced_inline size_t BitSet_to_indices_mt(const BitSet *bs, size_t *out, size_t num_threads);
+
+    /**
+     * @brief Call "fn" with the index of every set bit, from "num_threads" threads.
+     *
+     * The words are split into chunks holding roughly the same number of set bits, so dense and sparse
+     * regions cost the same. Every thread starts with a contiguous range of chunks in its own deque and
+     * takes them from the front. A thread that runs out steals the back half of another thread's range.
+     *
+     * @param bs Pointer to BitSet, cannot be NULL. It must not be modified during the call.
+     * @param fn Callback, return non zero to cancel. It is called concurrently and must be thread safe.
+     * @param ctx Passed to "fn".
+     * @param num_threads Number of threads to use, including the calling thread.
+     * @return int 1 if "fn" cancelled the iteration, 0 otherwise.
+     *
+     * @details A chunk is always processed by one thread in ascending order, chunks run in no particular
+     * order. After a cancellation every thread stops at its next word. When the chunk tables cannot be
+     * allocated the iteration runs on the calling thread alone, like BitSet_for_each_set.
+     */
+    bitset_forced_inline int BitSet_parallel_for_each_set(const BitSet *bs, BitSetIndexFn fn, void *ctx, size_t num_threads);
+#endif /* BITSET_THREADS */
+
+    /**
+     * @brief Initialize an all zero copy-on-write BitSet. Do not forget to use BitSetCow_free.
+     *
+     * @param cow Pointer to uninitialized BitSetCow, cannot be NULL.
+     * @param bit_len Number of bits in the BitSetCow.
+     * @return BitSetStatus BITSET_OK or BITSET_ERR_NO_MEMORY.
+     *
+     * @details Pages are allocated on first write, untouched pages read as zero.
+     */
+    bitset_forced_inline BitSetStatus BitSetCow_init(BitSetCow *cow, size_t bit_len);
+
+    /**
+     * @brief Initialize a copy-on-write BitSet with the contents of "src".
+     *
+     * @param cow Pointer to uninitialized BitSetCow, cannot be NULL.
+     * @param src Pointer to BitSet, cannot be NULL.
+     * @return BitSetStatus BITSET_OK, or BITSET_ERR_NO_MEMORY in which case nothing is left to free.
+     *
+     * @note Pages of "src" that are all zero are not allocated.
+     */
+    bitset_forced_inline BitSetStatus BitSetCow_from_bitset(BitSetCow *cow, const BitSet *src);
+
+    /**
+     * @brief Copy the contents of "src" into a new, uninitialized, BitSet "dest".
+     *
+     * @param dest Pointer to uninitialized BitSet, cannot be NULL.
+     * @param src Pointer to BitSetCow, cannot be NULL.
+     * @return BitSetStatus BITSET_OK, or BITSET_ERR_NO_MEMORY in which case "dest" is left uninitialized.
+     */
+    bitset_forced_inline BitSetStatus BitSetCow_to_bitset(BitSet *dest, const BitSetCow *src);
+
+    /**
+     * @brief Release the pages referenced by "cow". Pages still shared with another snapshot stay alive.
+     *
+     * @param cow Pointer to BitSetCow, cannot be NULL.
+     * @return void
+     */
+    bitset_forced_inline void BitSetCow_free(BitSetCow *cow);
+
+    /**
+     * @brief Make "dest" a snapshot of "src". "Dest" should be uninitialized.
+     *
+     * Only the page table is copied and every page gains a reference, so this costs O(pages) instead of
+     * copying the bits. Pages are cloned lazily when either side writes to them.
+     *
+     * @param dest Pointer to uninitialized BitSetCow, cannot be NULL.
+     * @param src Pointer to BitSetCow, cannot be NULL.
+     * @return BitSetStatus BITSET_OK, or BITSET_ERR_NO_MEMORY in which case "dest" is left uninitialized.
+     *
+     * @note With BITSET_THREADS defined the reference counts are atomic, so snapshots may be handed to other
+     * threads. A single BitSetCow must still not be written by two threads at once.
+     */
+    bitset_forced_inline BitSetStatus BitSetCow_snapshot(BitSetCow *dest, const BitSetCow *src);
+
+    /**
+     * @brief Get the value of the bit at "index".
+     *
+     * @param cow Pointer to BitSetCow, cannot be NULL.
+     * @param index Bit index.
+     * @return 1 or 0.
+     */
+    bitset_forced_inline unsigned int BitSetCow_get(const BitSetCow *cow, size_t index);
+
+    /**
+     * @brief Sets bit at "index" to 1, cloning its page first if it is shared.
+     *
+     * @param cow Pointer to BitSetCow, cannot be NULL.
+     * @param index Bit index.
+     * @return BitSetStatus BITSET_OK, or BITSET_ERR_NO_MEMORY if the page could not be cloned, "cow" is then unchanged.
+     */
+    bitset_forced_inline BitSetStatus BitSetCow_set(BitSetCow *cow, size_t index);
+
+    /**
+     * @brief Sets bit at "index" to 0, cloning its page first if it is shared.
+     *
+     * @param cow Pointer to BitSetCow, cannot be NULL.
+     * @param index Bit index.
+     * @return BitSetStatus BITSET_OK, or BITSET_ERR_NO_MEMORY if the page could not be cloned, "cow" is then unchanged.
+     */
+    bitset_forced_inline BitSetStatus BitSetCow_clear(BitSetCow *cow, size_t index);
+
+    /**
+     * @brief Flip the bit at "index", cloning its page first if it is shared.
+     *
+     * @param cow Pointer to BitSetCow, cannot be NULL.
+     * @param index Bit index.
+     * @return BitSetStatus BITSET_OK, or BITSET_ERR_NO_MEMORY if the page could not be cloned, "cow" is then unchanged.
+     */
+    bitset_forced_inline BitSetStatus BitSetCow_flip(BitSetCow *cow, size_t index);
+
+    /**
+     * @brief Count the number of bits set to 1.
+     *
+     * @param cow Pointer to BitSetCow, cannot be NULL.
+     * @return size_t Number of set bits.
+     */
+    bitset_forced_inline size_t BitSetCow_count(const BitSetCow *cow);
+
+    /**
+     * @brief Initialize an empty (all zero) persistent BitSet. Do not forget to use BitSetPersistent_free.
+     *
+     * @param p Pointer to uninitialized BitSetPersistent, cannot be NULL.
+     * @param bit_len Number of bits in every version.
+     * @return void
+     */
+    bitset_forced_inline void BitSetPersistent_init(BitSetPersistent *p, size_t bit_len);
+
+    /**
+     * @brief Release this version. Nodes shared with other versions stay alive.
+     *
+     * @param p Pointer to BitSetPersistent, cannot be NULL.
+     * @return void
+     */
+    bitset_forced_inline void BitSetPersistent_free(BitSetPersistent *p);
+
+    /**
+     * @brief Make "dest" another handle to the version in "src". "Dest" should be uninitialized. O(1).
+     *
+     * @param dest Pointer to uninitialized BitSetPersistent, cannot be NULL.
+     * @param src Pointer to BitSetPersistent, cannot be NULL.
+     * @return void
+     */
+    bitset_forced_inline void BitSetPersistent_copy(BitSetPersistent *dest, const BitSetPersistent *src);
+
+    /**
+     * @brief Get the value of the bit at "index". O(log64 n).
+     *
+     * @param p Pointer to BitSetPersistent, cannot be NULL.
+     * @param index Bit index.
+     * @return 1 or 0.
+     */
+    bitset_forced_inline unsigned int BitSetPersistent_get(const BitSetPersistent *p, size_t index);
+
+    /**
+     * @brief Create a new version "dest" equal to "src" with bit "index" set to 1. "Dest" should be uninitialized.
+     *
+     * @param dest Pointer to uninitialized BitSetPersistent, cannot be NULL. May be "src" itself, the handle then
+     * moves to the new version like BitSetPersistent_set_mut.
+     * @param src Pointer to BitSetPersistent, cannot be NULL. It is not modified.
+     * @param index Bit index.
+     * @return BitSetStatus BITSET_OK, or BITSET_ERR_NO_MEMORY in which case "dest" is still a valid handle
+     * equal to "src".
+     *
+     * @details Only the O(log64 n) nodes on the path to "index" are copied.
+     */
+    bitset_forced_inline BitSetStatus BitSetPersistent_set(BitSetPersistent *dest, const BitSetPersistent *src, size_t index);
+
+    /**
+     * @brief Create a new version "dest" equal to "src" with bit "index" set to 0. "Dest" should be uninitialized.
+     *
+     * @param dest Pointer to uninitialized BitSetPersistent, cannot be NULL. May be "src" itself, the handle then
+     * moves to the new version like BitSetPersistent_clear_mut.
+     * @param src Pointer to BitSetPersistent, cannot be NULL. It is not modified.
+     * @param index Bit index.
+     * @return BitSetStatus BITSET_OK, or BITSET_ERR_NO_MEMORY in which case "dest" is still a valid handle
+     * equal to "src".
+     */
+    bitset_forced_inline BitSetStatus BitSetPersistent_clear(BitSetPersistent *dest, const BitSetPersistent *src, size_t index);
+
+    /**
+     * @brief Transient set: sets bit "index" to 1 in "p" itself.
+     *
+     * Nodes that are shared with another version are copied, nodes owned only by "p" are modified in place.
+     * A batch of mutations therefore copies each path at most once instead of once per operation.
+     * Other versions never observe the change.
+     *
+     * @param p Pointer to BitSetPersistent, cannot be NULL.
+     * @param index Bit index.
+     * @return BitSetStatus BITSET_OK, or BITSET_ERR_NO_MEMORY in which case "p" keeps its old contents.
+     */
+    bitset_forced_inline BitSetStatus BitSetPersistent_set_mut(BitSetPersistent *p, size_t index);
+
+    /**
+     * @brief Transient clear: sets bit "index" to 0 in "p" itself. See BitSetPersistent_set_mut.
+     *
+     * @param p Pointer to BitSetPersistent, cannot be NULL.
+     * @param index Bit index.
+     * @return BitSetStatus BITSET_OK, or BITSET_ERR_NO_MEMORY in which case "p" keeps its old contents.
+     */
+    bitset_forced_inline BitSetStatus BitSetPersistent_clear_mut(BitSetPersistent *p, size_t index);
+
+    /**
+     * @brief Call "fn" with every index whose bit differs between "a" and "b", in ascending order.
+     *
+     * Subtrees shared by both versions are skipped without being visited, so the cost is proportional to
+     * the nodes written since the versions diverged.
+     *
+     * @param a Pointer to BitSetPersistent, cannot be NULL.
+     * @param b Pointer to BitSetPersistent of the same length, cannot be NULL.
+     * @param fn Callback, return non zero to stop.
+     * @param ctx Passed to "fn".
+     * @return int 1 if "fn" stopped the walk, 0 otherwise.
+     */
+    bitset_forced_inline int BitSetPersistent_diff(const BitSetPersistent *a, const BitSetPersistent *b, BitSetIndexFn fn, void *ctx);
+
+    /**
+     * @brief Encode the difference between two BitSets of the same length as a compact patch.
+     *
+     * The patch holds the bit length followed by runs of changed words. Each run is a varint gap of
+     * unchanged words, a varint run length and the XOR mask of every word in the run. A run of length zero
+     * reaching the last word ends the patch. Its size scales with the number of changed words, not with the
+     * bit length.
+     *
+     * @param old_bs Pointer to the BitSet the patch will be applied to, cannot be NULL.
+     * @param new_bs Pointer to the BitSet the patch produces, cannot be NULL.
+     * @param patch Receives a buffer allocated with malloc, release it with free.
+     * @return size_t Length of the patch in bytes, or SIZE_MAX if memory allocation failed, "*patch" is then NULL.
+     *
+     * @details Unchanged regions are skipped 64 bytes at a time with memcmp, which libc vectorizes.
+     */
+    bitset_forced_inline size_t BitSet_diff(const BitSet *old_bs, const BitSet *new_bs, uint8_t **patch);
+
+    /**
+     * @brief Apply a patch produced by BitSet_diff.
+     *
+     * @param bs Pointer to BitSet equal to the "old_bs" the patch was made from, cannot be NULL.
+     * @param patch Patch bytes.
+     * @param patch_len Length of the patch in bytes.
+     * @return 1 if the patch was applied, 0 if it is malformed or made for a different length.
+     *
+     * @note The whole patch is validated before the first write, so "bs" is unmodified when 0 is returned.
+     */
+    bitset_forced_inline int BitSet_apply_patch(BitSet *bs, const uint8_t *patch, size_t patch_len);
+
+    /**
+     * @brief Start recording which pages of the BitSet are modified.
+     *
+     * Every page starts out clean. From then on BitSet_set, BitSet_clear, BitSet_flip, their _checked forms, the
+     * bulk operations and BitSet_apply_patch flag the BITSET_DIRTY_PAGE_SIZE byte pages they write. The _unchecked
+     * accessors do not.
+     *
+     * @param bs Pointer to BitSet, cannot be NULL.
+     * @return void
+     *
+     * @note The tracking state is not copied by BitSet_copy_construct.
+     */
+    bitset_forced_inline void BitSet_enable_dirty_tracking(BitSet *bs);
+
+    /**
+     * @brief Stop recording modified pages and release the dirty map.
+     *
+     * @param bs Pointer to BitSet, cannot be NULL.
+     * @return void
+     */
+    bitset_forced_inline void BitSet_disable_dirty_tracking(BitSet *bs);
+
+    /**
+     * @brief Make BitSet_clear_all only zero the pages written since the previous clear.
+     *
+     * Shares the page map and the per-write bookkeeping with dirty tracking, so a cycle of clear_all
+     * followed by a few sparse writes costs O(pages touched) plus a one byte scan per page.
+     * Every page counts as touched right after this call.
+     *
+     * @param bs Pointer to BitSet, cannot be NULL.
+     * @return void
+     */
+    bitset_forced_inline void BitSet_enable_lazy_clear(BitSet *bs);
+
+    /**
+     * @brief Go back to clearing the whole buffer in BitSet_clear_all.
+     *
+     * @param bs Pointer to BitSet, cannot be NULL.
+     * @return void
+     */
+    bitset_forced_inline void BitSet_disable_lazy_clear(BitSet *bs);
+
+    /**
+     * @brief Count the pages modified since tracking was enabled or last flushed.
+     *
+     * @param bs Pointer to BitSet, cannot be NULL.
+     * @return size_t Number of dirty pages, 0 if tracking is not enabled.
+     */
+    bitset_forced_inline size_t BitSet_dirty_page_count(const BitSet *bs);
+
+#if defined(__unix__) || defined(__APPLE__)
+    /**
+     * @brief Write only the dirty pages to "fd" and mark them clean.
+     *
+     * Byte "i" of the BitSet is written at file position "offset + i". Adjacent dirty pages are coalesced
+     * into a single pwrite, so the cost is proportional to the churn since the last flush.
+     *
+     * @param bs Pointer to BitSet with dirty tracking enabled, cannot be NULL.
+     * @param fd File descriptor opened for writing.
+     * @param offset File position of the first byte of the BitSet.
+     * @return 1 on success, 0 if a write failed (check errno). Pages that were not written stay dirty.
+     */
+    bitset_forced_inline int BitSet_flush_dirty(BitSet *bs, int fd, off_t offset);
+#endif
+
+    /**
+     * @brief Initialize an all zero sharded BitSet. Do not forget to use BitSetSharded_free.
+     *
+     * Each shard is a private BitSet on its own cache line with dirty tracking enabled. Writers only touch
+     * their own shard, so no cache lines bounce between cores. BitSetSharded_merge folds the dirty pages
+     * of every shard into the main BitSet with a bulk OR.
+     *
+     * @param sh Pointer to uninitialized BitSetSharded, cannot be NULL.
+     * @param bit_len Number of bits.
+     * @param num_shards Number of shards, usually one per writer thread.
+     * @return BitSetStatus BITSET_OK or BITSET_ERR_NO_MEMORY.
+     *
+     * @note Every shard is as large as the main BitSet, so the whole set takes (num_shards + 1) times the
+     * memory of a plain BitSet. That is the price of writes that need no routing or ownership check and of
+     * merges that OR whole pages in place. For sets too large to replicate per thread, split the index range
+     * between the writers instead, for example with BitSetNuma.
+     */
+    bitset_forced_inline BitSetStatus BitSetSharded_init(BitSetSharded *sh, size_t bit_len, size_t num_shards);
+
+    /**
+     * @brief Free the memory allocated by BitSetSharded_init.
+     *
+     * @param sh Pointer to BitSetSharded, cannot be NULL.
+     * @return void
+     */
+    bitset_forced_inline void BitSetSharded_free(BitSetSharded *sh);
+
+    /**
+     * @brief Sets bit at "index" to 1 in shard "shard". Only one thread may write a given shard.
+     *
+     * @param sh Pointer to BitSetSharded, cannot be NULL.
+     * @param shard Shard owned by the calling thread.
+     * @param index Bit index.
+     * @return void
+     */
+    bitset_forced_inline void BitSetSharded_set(BitSetSharded *sh, size_t shard, size_t index);
+
+    /**
+     * @brief OR the pages written in every shard into the main BitSet and reset those shards.
+     *
+     * @param sh Pointer to BitSetSharded, cannot be NULL.
+     * @return void
+     *
+     * @warning No thread may write to a shard during the merge, call it at an epoch boundary.
+     */
+    bitset_forced_inline void BitSetSharded_merge(BitSetSharded *sh);
+
+    /**
+     * @brief The main BitSet, which holds every bit set before the last BitSetSharded_merge.
+     *
+     * @param sh Pointer to BitSetSharded, cannot be NULL.
+     * @return const BitSet* Main BitSet.
+     */
+    bitset_forced_inline const BitSet *BitSetSharded_main(const BitSetSharded *sh);
+
+    /**
+     * @brief Get the value of the bit at "index" in the union of the main BitSet and every shard.
+     *
+     * @param sh Pointer to BitSetSharded, cannot be NULL.
+     * @param index Bit index.
+     * @return 1 or 0.
+     *
+     * @warning No thread may write to a shard during the call, see BitSetSharded_count.
+     */
+    bitset_forced_inline unsigned int BitSetSharded_get(const BitSetSharded *sh, size_t index);
+
+    /**
+     * @brief Count the set bits of the union of the main BitSet and every shard, without merging.
+     *
+     * @param sh Pointer to BitSetSharded, cannot be NULL.
+     * @return size_t Number of set bits.
+     *
+     * @warning Like BitSetSharded_merge, no thread may write to a shard during the call. Shard words are
+     * written with plain stores, so reading them concurrently is a data race, not just a stale result.
+     */
+    bitset_forced_inline size_t BitSetSharded_count(const BitSetSharded *sh);
+
+    /**
+     * @brief Call "fn" with every set bit of the union of the main BitSet and every shard, in ascending order.
+     *
+     * @param sh Pointer to BitSetSharded, cannot be NULL.
+     * @param fn Callback, return non zero to stop.
+     * @param ctx Passed to "fn".
+     * @return int 1 if "fn" stopped the iteration, 0 otherwise.
+     *
+     * @warning No thread may write to a shard during the call, see BitSetSharded_count.
+     */
+    bitset_forced_inline int BitSetSharded_for_each_set(const BitSetSharded *sh, BitSetIndexFn fn, void *ctx);
+
+    /**
+     * @brief Initialize an all zero stamped BitSet. Do not forget to use BitSetStamped_free.
+     *
+     * Every 64 bit word carries the epoch it was last written in and words with an older stamp read as zero.
+     * Meant for visited sets that are cleared between many short, sparse searches.
+     *
+     * @param st Pointer to BitSetStamped, cannot be NULL.
+     * @param bit_len Number of bits.
+     * @return BitSetStatus BITSET_OK or BITSET_ERR_NO_MEMORY.
+     */
+    bitset_forced_inline BitSetStatus BitSetStamped_init(BitSetStamped *st, size_t bit_len);
+
+    /**
+     * @brief Free the memory allocated by BitSetStamped_init.
+     *
+     * @param st Pointer to BitSetStamped, cannot be NULL.
+     * @return void
+     */
+    bitset_forced_inline void BitSetStamped_free(BitSetStamped *st);
+
+    /**
+     * @brief Get the value of the bit at "index".
+     *
+     * @param st Pointer to BitSetStamped, cannot be NULL.
+     * @param index Bit index.
+     * @return 1 or 0.
+     */
+    bitset_forced_inline unsigned int BitSetStamped_get(const BitSetStamped *st, size_t index);
+
+    /**
+     * @brief Sets bit at "index" to 1.
+     *
+     * @param st Pointer to BitSetStamped, cannot be NULL.
+     * @param index Bit index.
+     * @return void
+     */
+    bitset_forced_inline void BitSetStamped_set(BitSetStamped *st, size_t index);
+
+    /**
+     * @brief Sets bit at "index" to 0.
+     *
+     * @param st Pointer to BitSetStamped, cannot be NULL.
+     * @param index Bit index.
+     * @return void
+     */
+    bitset_forced_inline void BitSetStamped_clear(BitSetStamped *st, size_t index);
+
+    /**
+     * @brief Sets bit at "index" to 1 and returns its previous value, the usual "mark visited" step.
+     *
+     * @param st Pointer to BitSetStamped, cannot be NULL.
+     * @param index Bit index.
+     * @return 1 if the bit was already set, 0 otherwise.
+     */
+    bitset_forced_inline unsigned int BitSetStamped_test_and_set(BitSetStamped *st, size_t index);
+
+    /**
+     * @brief Sets all bits to 0 by starting a new epoch.
+     *
+     * O(1), except once every 2^32 - 1 calls when the epoch wraps around and every stamp is reset.
+     *
+     * @param st Pointer to BitSetStamped, cannot be NULL.
+     * @return void
+     */
+    bitset_forced_inline void BitSetStamped_clear_all(BitSetStamped *st);
+
+    /**
+     * @brief Count the set bits.
+     *
+     * @param st Pointer to BitSetStamped, cannot be NULL.
+     * @return size_t Number of set bits.
+     */
+    bitset_forced_inline size_t BitSetStamped_count(const BitSetStamped *st);
+
+    /**
+     * @brief Call "fn" with every set bit in ascending order.
+     *
+     * @param st Pointer to BitSetStamped, cannot be NULL.
+     * @param fn Callback, return non zero to stop.
+     * @param ctx Passed to "fn".
+     * @return int 1 if "fn" stopped the iteration, 0 otherwise.
+     */
+    bitset_forced_inline int BitSetStamped_for_each_set(const BitSetStamped *st, BitSetIndexFn fn, void *ctx);
+
+    /**
+     * @brief Find every exact occurrence of any of "num_patterns" patterns in "text" with bit-parallel Shift-Or.
+     *
+     * The patterns are packed one after another into a single multi-word state vector and advanced together,
+     * one shift with carry across the words per text byte, so there is no limit on the pattern length and
+     * several short patterns share the cost of a word. Empty patterns never match.
+     *
+     * @param text Text bytes.
+     * @param text_len Length of "text".
+     * @param patterns Array of "num_patterns" pattern pointers.
+     * @param pattern_lens Length of each pattern.
+     * @param num_patterns Number of patterns.
+     * @param fn Called as fn(pattern, end, 0, ctx) in text order, return non zero to stop.
+     * @param ctx Passed to "fn".
+     * @return int 1 if "fn" stopped the search, 0 otherwise, -1 if memory allocation failed.
+     */
+    bitset_forced_inline int BitSet_match_exact(const uint8_t *text, size_t text_len, const uint8_t *const *patterns,
+                                                const size_t *pattern_lens, size_t num_patterns, BitSetMatchFn fn,
+                                                void *ctx);
+
+    /**
+     * @brief Find every text position where a substring ending there is within "max_distance" edits of "pattern".
+     *
+     * Myers' bit-vector algorithm in its multi-word block form: each 64 row block of the dynamic programming
+     * column is one word and the blocks pass their bottom horizontal delta up to the next one. O(text_len * m / 64).
+     *
+     * @param text Text bytes.
+     * @param text_len Length of "text".
+     * @param pattern Pattern bytes.
+     * @param pattern_len Length of "pattern", greater than 0.
+     * @param max_distance Largest Levenshtein distance to report.
+     * @param fn Called as fn(0, end, distance, ctx) in text order, return non zero to stop.
+     * @param ctx Passed to "fn".
+     * @return int 1 if "fn" stopped the search, 0 otherwise, -1 if memory allocation failed.
+     */
+    bitset_forced_inline int BitSet_match_approx(const uint8_t *text, size_t text_len, const uint8_t *pattern,
+                                                 size_t pattern_len, size_t max_distance, BitSetMatchFn fn, void *ctx);
+
+    /**
+     * @brief Levenshtein distance between "a" and "b", computed with Myers' multi-word bit-vector algorithm.
+     *
+     * @param a First string.
+     * @param a_len Length of "a".
+     * @param b Second string.
+     * @param b_len Length of "b".
+     * @return size_t The edit distance, SIZE_MAX if memory allocation failed.
+     */
+    bitset_forced_inline size_t BitSet_edit_distance(const uint8_t *a, size_t a_len, const uint8_t *b, size_t b_len);
+
+    /**
+     * @brief Length of the longest common subsequence of "a" and "b", bit-parallel (Allison-Dix, Hyyro).
+     *
+     * One multi-word add with carry per byte of the longer string, O(a_len * b_len / 64).
+     *
+     * @param a First string.
+     * @param a_len Length of "a".
+     * @param b Second string.
+     * @param b_len Length of "b".
+     * @return size_t The LCS length, SIZE_MAX if memory allocation failed.
+     */
+    bitset_forced_inline size_t BitSet_lcs_length(const uint8_t *a, size_t a_len, const uint8_t *b, size_t b_len);
+
+    /**
+     * @brief Sieve the odd numbers of [lo, hi) into "out", bit "i" is 1 when the "i"th odd number of the range is prime.
+     *
+     * The "i"th odd number is (lo | 1) + 2 * i. Segments of BITSET_SIEVE_SEGMENT_BITS bits are pre-filled from a
+     * repeating pattern that already excludes the multiples of 3, 5, 7, 11 and 13, then the remaining primes up
+     * to sqrt(hi) are crossed off segment by segment while it is in cache.
+     *
+     * @param out Pointer to an initialized BitSet, resized to the number of odd numbers in [lo, hi).
+     * @param lo First number of the range.
+     * @param hi One past the last number of the range.
+     * @return void
+     */
+    bitset_forced_inline void BitSet_sieve_odd(BitSet *out, uint64_t lo, uint64_t hi);
+
+    /**
+     * @brief Count the primes in [lo, hi) with a segmented sieve and popcount, using O(sqrt(hi)) memory.
+     *
+     * @param lo First number of the range.
+     * @param hi One past the last number of the range.
+     * @return uint64_t Number of primes, UINT64_MAX if memory allocation failed.
+     */
+    bitset_forced_inline uint64_t BitSet_prime_count(uint64_t lo, uint64_t hi);
+
+    /**
+     * @brief Call "fn" with every prime in [lo, hi) in ascending order, using O(sqrt(hi)) memory.
+     *
+     * @param lo First number of the range.
+     * @param hi One past the last number of the range, must fit a size_t.
+     * @param fn Callback, return non zero to stop.
+     * @param ctx Passed to "fn".
+     * @return int 1 if "fn" stopped the iteration, 0 otherwise, -1 if memory allocation failed.
+     *
+     * @note This stays single threaded: the primes arrive in order and "fn" may stop after the first few,
+     * so sieving ahead on other threads would mostly be wasted. To visit a whole range on several threads,
+     * sieve it with BitSet_sieve_odd_mt and use BitSet_parallel_for_each_set.
+     */
+    bitset_forced_inline int BitSet_for_each_prime(uint64_t lo, uint64_t hi, BitSetIndexFn fn, void *ctx);
+
+#if defined(BITSET_THREADS)
+    /**
+     * @brief BitSet_sieve_odd with the segments split between "num_threads" threads.
+     *
+     * Every thread gets a contiguous run of whole segments, so it writes its own words of "out".
+     *
+     * @param out Pointer to an initialized BitSet, resized to the number of odd numbers in [lo, hi).
+     * @param lo First number of the range.
+     * @param hi One past the last number of the range.
+     * @param num_threads Number of threads, including the calling one.
+     * @return void
+     */
+    bitset_forced_inline void BitSet_sieve_odd_mt(BitSet *out, uint64_t lo, uint64_t hi, size_t num_threads);
+
+    /**
+     * @brief BitSet_prime_count with the segments split between "num_threads" threads.
+     *
+     * @param lo First number of the range.
+     * @param hi One past the last number of the range.
+     * @param num_threads Number of threads, including the calling one.
+     * @return uint64_t Number of primes, UINT64_MAX if memory allocation failed.
+     */
+    bitset_forced_inline uint64_t BitSet_prime_count_mt(uint64_t lo, uint64_t hi, size_t num_threads);
+#endif
+
+    /*
+    Graph kernels. A graph of "n" vertices is given as its adjacency bit matrix, "adj[v]" is the neighbour set of
+    vertex "v" (at least "n" bits, bits past "n" are ignored). The graph is undirected: "u" and "v" are adjacent when
+    either "adj[u]" has bit "v" or "adj[v]" has bit "u", so only one side of each edge needs to be set. Self loops are
+    ignored. Scratch sets come from an internal arena that grows in blocks and is reused level by level, so the
+    recursion itself does not call malloc.
+    */
+
+    /**
+     * @brief Call "fn" with every maximal clique, Bron-Kerbosch with Tomita pivoting.
+     *
+     * @param adj Array of "n" neighbour sets.
+     * @param n Number of vertices.
+     * @param fn Callback, return non zero to stop.
+     * @param ctx Passed to "fn".
+     * @return int 1 if "fn" stopped the search, 0 otherwise, -1 if memory allocation failed.
+     */
+    bitset_forced_inline int BitSet_maximal_cliques(const BitSet *adj, size_t n, BitSetCliqueFn fn, void *ctx);
+
+    /**
+     * @brief Find a maximum clique by branch and bound, pruning with greedy coloring bounds (Tomita MCQ).
+     *
+     * @param adj Array of "n" neighbour sets.
+     * @param n Number of vertices.
+     * @param out Receives the clique vertices, room for "n" entries.
+     * @return size_t Size of the clique, SIZE_MAX if memory allocation failed.
+     */
+    bitset_forced_inline size_t BitSet_max_clique(const BitSet *adj, size_t n, size_t *out);
+
+    /**
+     * @brief Find a maximum independent set, as a maximum clique of the complement graph.
+     *
+     * @param adj Array of "n" neighbour sets.
+     * @param n Number of vertices.
+     * @param out Receives the vertices of the set, room for "n" entries.
+     * @return size_t Size of the set, SIZE_MAX if memory allocation failed.
+     */
+    bitset_forced_inline size_t BitSet_max_independent_set(const BitSet *adj, size_t n, size_t *out);
+
+    /**
+     * @brief Greedy DSATUR coloring. Repeatedly gives the uncolored vertex with the most distinct neighbour colors,
+     * ties broken by the most uncolored neighbours, the smallest color none of its neighbours has.
+     *
+     * The number of colors is an upper bound on the chromatic number and on the size of any clique.
+     *
+     * @param adj Array of "n" neighbour sets.
+     * @param n Number of vertices.
+     * @param colors Receives the color of each vertex, numbered from 0, room for "n" entries.
+     * @return size_t Number of colors used, SIZE_MAX if memory allocation failed.
+     */
+    bitset_forced_inline size_t BitSet_greedy_coloring(const BitSet *adj, size_t n, size_t *colors);
+
+    /**
+     * @brief Tanimoto (Jaccard) similarity, count(a AND b) / count(a OR b).
+     *
+     * @param a Pointer to BitSet, cannot be NULL.
+     * @param b Pointer to BitSet, cannot be NULL.
+     * @return double Similarity in [0, 1], 1 when both are empty. The shorter BitSet reads as zero past its end.
+     */
+    bitset_forced_inline double BitSet_tanimoto(const BitSet *a, const BitSet *b);
+
+    /**
+     * @brief Initialize an empty table of "bit_len" bit rows. Do not forget to use BitSetRows_free.
+     *
+     * Rows are padded to a whole number of 64 byte cache lines.
+     *
+     * @param rows Pointer to BitSetRows, cannot be NULL.
+     * @param bit_len Number of bits per row.
+     * @return void
+     */
+    bitset_forced_inline void BitSetRows_init(BitSetRows *rows, size_t bit_len);
+
+    /**
+     * @brief Free the memory allocated by BitSetRows.
+     *
+     * @param rows Pointer to BitSetRows, cannot be NULL.
+     * @return void
+     */
+    bitset_forced_inline void BitSetRows_free(BitSetRows *rows);
+
+    /**
+     * @brief Make room for "num_rows" rows in total without reallocating.
+     *
+     * @param rows Pointer to BitSetRows, cannot be NULL.
+     * @param num_rows Number of rows.
+     * @return BitSetStatus BITSET_OK or BITSET_ERR_NO_MEMORY.
+     */
+    bitset_forced_inline BitSetStatus BitSetRows_reserve(BitSetRows *rows, size_t num_rows);
+
+    /**
+     * @brief Append a copy of "bs" as a new row.
+     *
+     * @param rows Pointer to BitSetRows, cannot be NULL.
+     * @param bs Pointer to BitSet, cannot be NULL. Bits past the row length are dropped, a shorter BitSet
+     * reads as zero past its end.
+     * @return size_t Index of the new row, SIZE_MAX if memory allocation failed.
+     */
+    bitset_forced_inline size_t BitSetRows_append(BitSetRows *rows, const BitSet *bs);
+
+    /**
+     * @brief Get the number of rows.
+     *
+     * @param rows Pointer to BitSetRows, cannot be NULL.
+     * @return size_t Number of rows.
+     */
+    bitset_forced_inline size_t BitSetRows_len(const BitSetRows *rows);
+
+    /**
+     * @brief Get the number of set bits of row "row".
+     *
+     * @param rows Pointer to BitSetRows, cannot be NULL.
+     * @param row Row index.
+     * @return size_t Number of set bits.
+     */
+    bitset_forced_inline size_t BitSetRows_count(const BitSetRows *rows, size_t row);
+
+    /**
+     * @brief Copy row "row" into "out", which is resized to the row length.
+     *
+     * @param rows Pointer to BitSetRows, cannot be NULL.
+     * @param row Row index.
+     * @param out Pointer to an initialized BitSet. Its buffer is reused when large enough.
+     * @return void
+     */
+    bitset_forced_inline void BitSetRows_get(const BitSetRows *rows, size_t row, BitSet *out);
+
+    /**
+     * @brief Find the "k" rows most similar to "query" by Tanimoto similarity.
+     *
+     * The similarity of a row is at most min(count(query), count(row)) / max(count(query), count(row)), so rows
+     * whose popcount cannot reach "threshold", or beat the k-th best hit found so far, are skipped without
+     * reading them.
+     *
+     * @param rows Pointer to BitSetRows, cannot be NULL.
+     * @param query Pointer to BitSet, cannot be NULL. Read as a row.
+     * @param threshold Rows with a similarity below this are not returned, 0 to return the best "k" rows.
+     * @param k Maximum number of hits.
+     * @param out Array of "k" hits, sorted by decreasing similarity, ties by increasing row.
+     * @return size_t Number of hits written to "out", SIZE_MAX if memory allocation failed.
+     */
+    bitset_forced_inline size_t BitSetRows_tanimoto_search(const BitSetRows *rows, const BitSet *query, double threshold,
+                                                           size_t k, BitSetHit *out);
+
+#if defined(BITSET_THREADS)
+    /**
+     * @brief BitSetRows_tanimoto_search with the rows split between "num_threads" threads, each keeping its own
+     * top "k" hits that are merged at the end. The result is the same as the single threaded search.
+     *
+     * @param rows Pointer to BitSetRows, cannot be NULL.
+     * @param query Pointer to BitSet, cannot be NULL.
+     * @param threshold Rows with a similarity below this are not returned.
+     * @param k Maximum number of hits.
+     * @param out Array of "k" hits, sorted by decreasing similarity, ties by increasing row.
+     * @param num_threads Number of threads, 0 is treated as 1.
+     * @return size_t Number of hits written to "out", SIZE_MAX if memory allocation failed.
+     */
+    bitset_forced_inline size_t BitSetRows_tanimoto_search_mt(const BitSetRows *rows, const BitSet *query,
+                                                              double threshold, size_t k, BitSetHit *out,
+                                                              size_t num_threads);
+#endif
+
+    /**
+     * @brief Find the "k" rows nearest to "query" by Hamming distance, scanning every row.
+     *
+     * Rows with |count(query) - count(row)| above "max_distance", or above the k-th best distance found so far,
+     * are skipped without reading them.
+     *
+     * @param rows Pointer to BitSetRows, cannot be NULL.
+     * @param query Pointer to BitSet, cannot be NULL. Read as a row.
+     * @param max_distance Rows farther than this are not returned, SIZE_MAX for no limit.
+     * @param k Maximum number of hits.
+     * @param out Array of "k" hits, "score" is the distance, sorted by increasing distance, ties by increasing row.
+     * @return size_t Number of hits written to "out", SIZE_MAX if memory allocation failed.
+     */
+    bitset_forced_inline size_t BitSetRows_hamming_search(const BitSetRows *rows, const BitSet *query,
+                                                          size_t max_distance, size_t k, BitSetHit *out);
+
+    /**
+     * @brief Build a multi-index hashing index over "rows". Do not forget to use BitSetHammingIndex_free.
+     *
+     * Rows are cut into 16 bit substrings and the first "num_tables" of them get a table from substring value
+     * to rows, in compressed (CSR) form. Two rows within distance "d" agree within floor(d / num_tables) bits on
+     * at least one indexed substring, so a search probes the buckets around the query substrings at growing
+     * radius and only computes full distances for the rows found there.
+     *
+     * @param idx Pointer to uninitialized BitSetHammingIndex, cannot be NULL.
+     * @param rows Pointer to BitSetRows, cannot be NULL. Must outlive the index and not change, rebuild the index
+     * after appending rows. At most UINT32_MAX rows.
+     * @param num_tables Number of substrings to index, 0 or more than the row has to index all of them. Fewer
+     * tables use less memory but filter less.
+     * @return BitSetStatus BITSET_OK or BITSET_ERR_NO_MEMORY.
+     */
+    bitset_forced_inline BitSetStatus BitSetHammingIndex_init(BitSetHammingIndex *idx, const BitSetRows *rows,
+                                                              size_t num_tables);
+
+    /**
+     * @brief Free the memory allocated by BitSetHammingIndex_init.
+     *
+     * @param idx Pointer to BitSetHammingIndex, cannot be NULL.
+     * @return void
+     */
+    bitset_forced_inline void BitSetHammingIndex_free(BitSetHammingIndex *idx);
+
+    /**
+     * @brief Find the "k" rows nearest to "query" by Hamming distance. Same result as BitSetRows_hamming_search.
+     *
+     * Once probing the next radius would touch more buckets than there are rows, the rows not seen yet are
+     * scanned instead.
+     *
+     * @param idx Pointer to BitSetHammingIndex, cannot be NULL.
+     * @param query Pointer to BitSet, cannot be NULL. Read as a row.
+     * @param max_distance Rows farther than this are not returned, SIZE_MAX for no limit.
+     * @param k Maximum number of hits.
+     * @param out Array of "k" hits, "score" is the distance, sorted by increasing distance, ties by increasing row.
+     * @return size_t Number of hits written to "out", SIZE_MAX if memory allocation failed.
+     *
+     * @warning Uses scratch state of the index, do not search the same index from several threads at once. Use
+     * BitSetHammingIndex_search_batch_mt instead.
+     */
+    bitset_forced_inline size_t BitSetHammingIndex_search(BitSetHammingIndex *idx, const BitSet *query,
+                                                          size_t max_distance, size_t k, BitSetHit *out);
+
+    /**
+     * @brief BitSetHammingIndex_search for each of "num_queries" queries.
+     *
+     * @param idx Pointer to BitSetHammingIndex, cannot be NULL.
+     * @param queries Array of "num_queries" BitSets.
+     * @param num_queries Number of queries.
+     * @param max_distance Rows farther than this are not returned, SIZE_MAX for no limit.
+     * @param k Maximum number of hits per query.
+     * @param out Array of "num_queries" * "k" hits, the hits of query "i" start at out + i * k.
+     * @param lens Array of "num_queries" entries, receives the number of hits of every query.
+     * @return int 0 on success, -1 if memory allocation failed.
+     */
+    bitset_forced_inline int BitSetHammingIndex_search_batch(BitSetHammingIndex *idx, const BitSet *queries,
+                                                             size_t num_queries, size_t max_distance, size_t k,
+                                                             BitSetHit *out, size_t *lens);
+
+#if defined(BITSET_THREADS)
+    /**
+     * @brief BitSetHammingIndex_search_batch with the queries split between "num_threads" threads, each with
+     * its own scratch state.
+     *
+     * @param idx Pointer to BitSetHammingIndex, cannot be NULL.
+     * @param queries Array of "num_queries" BitSets.
+     * @param num_queries Number of queries.
+     * @param max_distance Rows farther than this are not returned, SIZE_MAX for no limit.
+     * @param k Maximum number of hits per query.
+     * @param out Array of "num_queries" * "k" hits, the hits of query "i" start at out + i * k.
+     * @param lens Array of "num_queries" entries, receives the number of hits of every query.
+     * @param num_threads Number of threads, 0 is treated as 1.
+     * @return int 0 on success, -1 if memory allocation failed.
+     */
+    bitset_forced_inline int BitSetHammingIndex_search_batch_mt(const BitSetHammingIndex *idx, const BitSet *queries,
+                                                                size_t num_queries, size_t max_distance, size_t k,
+                                                                BitSetHit *out, size_t *lens, size_t num_threads);
+#endif
+
+#if defined(BITSET_THREADS)
+    /**
+     * @brief Initialize an all zero concurrent BitSet. Do not forget to use BitSetConcurrent_free.
+     *
+     * Every BITSET_SEQLOCK_BLOCK_WORDS words are guarded by a sequence counter, and a global counter
+     * covers the whole set. Readers never block the writer. They retry only when the block (or, for
+     * BitSetConcurrent_snapshot, the set) they read was written meanwhile.
+     *
+     * @param c Pointer to uninitialized BitSetConcurrent, cannot be NULL.
+     * @param bit_len Number of bits.
+     * @return BitSetStatus BITSET_OK or BITSET_ERR_NO_MEMORY.
+     *
+     * @note Only one thread may call the writer functions (set, clear, flip, or, and, xor) at a time.
+     */
+    bitset_forced_inline BitSetStatus BitSetConcurrent_init(BitSetConcurrent *c, size_t bit_len);
+
+    /**
+     * @brief Free the memory allocated by BitSetConcurrent_init. No other thread may be using "c".
+     *
+     * @param c Pointer to BitSetConcurrent, cannot be NULL.
+     * @return void
+     */
+    bitset_forced_inline void BitSetConcurrent_free(BitSetConcurrent *c);
+
+    /**
+     * @brief Reader: get the value of the bit at "index". Wait-free.
+     *
+     * @param c Pointer to BitSetConcurrent, cannot be NULL.
+     * @param index Bit index.
+     * @return 1 or 0.
+     */
+    bitset_forced_inline unsigned int BitSetConcurrent_get(const BitSetConcurrent *c, size_t index);
+
+    /**
+     * @brief Reader: count the set bits. Every block is read consistently, but blocks may come from
+     * different points in time.
+     *
+     * @param c Pointer to BitSetConcurrent, cannot be NULL.
+     * @return size_t Number of set bits.
+     */
+    bitset_forced_inline size_t BitSetConcurrent_count(const BitSetConcurrent *c);
+
+    /**
+     * @brief Reader: copy a consistent view of the whole set into "dest".
+     *
+     * @param c Pointer to BitSetConcurrent, cannot be NULL.
+     * @param dest Pointer to initialized BitSet of the same length, cannot be NULL.
+     * @return void
+     *
+     * @warning The copy is retried until no write overlaps it, so under constant writes to a large set
+     * prefer BitSetConcurrent_count or per block reads.
+     */
+    bitset_forced_inline void BitSetConcurrent_snapshot(const BitSetConcurrent *c, BitSet *dest);
+
+    /**
+     * @brief Writer: sets bit at "index" to 1.
+     *
+     * @param c Pointer to BitSetConcurrent, cannot be NULL.
+     * @param index Bit index.
+     * @return void
+     */
+    bitset_forced_inline void BitSetConcurrent_set(BitSetConcurrent *c, size_t index);
+
+    /**
+     * @brief Writer: sets bit at "index" to 0.
+     *
+     * @param c Pointer to BitSetConcurrent, cannot be NULL.
+     * @param index Bit index.
+     * @return void
+     */
+    bitset_forced_inline void BitSetConcurrent_clear(BitSetConcurrent *c, size_t index);
+
+    /**
+     * @brief Writer: flip the bit at "index".
+     *
+     * @param c Pointer to BitSetConcurrent, cannot be NULL.
+     * @param index Bit index.
+     * @return void
+     */
+    bitset_forced_inline void BitSetConcurrent_flip(BitSetConcurrent *c, size_t index);
+
+    /**
+     * @brief Writer: bitwise OR "src" into "c", for example to publish a batch built in a private BitSet.
+     *
+     * @param c Pointer to BitSetConcurrent, cannot be NULL.
+     * @param src Pointer to BitSet, cannot be NULL.
+     * @return void
+     *
+     * @note Like BitSet_or, a shorter "src" reads as zero past its end and "c" keeps its length.
+     */
+    bitset_forced_inline void BitSetConcurrent_or(BitSetConcurrent *c, const BitSet *src);
+
+    /**
+     * @brief Writer: bitwise AND "src" into "c".
+     *
+     * @param c Pointer to BitSetConcurrent, cannot be NULL.
+     * @param src Pointer to BitSet, cannot be NULL.
+     * @return void
+     *
+     * @note Like BitSet_and, a shorter "src" reads as zero past its end and "c" keeps its length.
+     */
+    bitset_forced_inline void BitSetConcurrent_and(BitSetConcurrent *c, const BitSet *src);
+
+    /**
+     * @brief Writer: bitwise XOR "src" into "c".
+     *
+     * @param c Pointer to BitSetConcurrent, cannot be NULL.
+     * @param src Pointer to BitSet, cannot be NULL.
+     * @return void
+     *
+     * @note Like BitSet_xor, a shorter "src" reads as zero past its end and "c" keeps its length.
+     */
+    bitset_forced_inline void BitSetConcurrent_xor(BitSetConcurrent *c, const BitSet *src);
+
+    /**
+     * @brief Initialize an all zero NUMA partitioned BitSet. Do not forget to use BitSetNuma_free.
+     *
+     * The bits are cut into partitions of "part_bits" bits that are assigned to the nodes round robin.
+     * Pass 0 for range partitioning (one contiguous partition per node), or a small size such as a few
+     * pages worth of bits to interleave. Each partition is allocated and zeroed by a thread pinned to its
+     * node, so first touch places its pages there.
+     *
+     * @param bn Pointer to uninitialized BitSetNuma, cannot be NULL.
+     * @param bit_len Number of bits.
+     * @param part_bits Bits per partition rounded up to a multiple of 64, or 0 for one partition per node.
+     * @return BitSetStatus BITSET_OK or BITSET_ERR_NO_MEMORY.
+     *
+     * @details Nodes are read from /sys/devices/system/node/online, their ids may have gaps. Threads are
+     * only pinned when the CPU_SET macros are available (define _GNU_SOURCE before the first include),
+     * otherwise and on other systems everything behaves as a single node.
+     */
+    bitset_forced_inline BitSetStatus BitSetNuma_init(BitSetNuma *bn, size_t bit_len, size_t part_bits);
+
+    /**
+     * @brief Free the memory allocated by BitSetNuma_init.
+     *
+     * @param bn Pointer to BitSetNuma, cannot be NULL.
+     * @return void
+     */
+    bitset_forced_inline void BitSetNuma_free(BitSetNuma *bn);
+
+    /**
+     * @brief Number of NUMA nodes the partitions are spread over.
+     *
+     * @param bn Pointer to BitSetNuma, cannot be NULL.
+     * @return size_t Number of nodes.
+     */
+    bitset_forced_inline size_t BitSetNuma_num_nodes(const BitSetNuma *bn);
+
+    /**
+     * @brief Get the value of the bit at "index".
+     *
+     * @param bn Pointer to BitSetNuma, cannot be NULL.
+     * @param index Bit index.
+     * @return 1 or 0.
+     */
+    bitset_forced_inline unsigned int BitSetNuma_get(const BitSetNuma *bn, size_t index);
+
+    /**
+     * @brief Sets bit at "index" to 1.
+     *
+     * @param bn Pointer to BitSetNuma, cannot be NULL.
+     * @param index Bit index.
+     * @return void
+     */
+    bitset_forced_inline void BitSetNuma_set(BitSetNuma *bn, size_t index);
+
+    /**
+     * @brief Sets bit at "index" to 0.
+     *
+     * @param bn Pointer to BitSetNuma, cannot be NULL.
+     * @param index Bit index.
+     * @return void
+     */
+    bitset_forced_inline void BitSetNuma_clear(BitSetNuma *bn, size_t index);
+
+    /**
+     * @brief Bitwise OR "src" into "dest", every partition on a thread pinned to its node.
+     *
+     * @param dest Pointer to BitSetNuma, cannot be NULL.
+     * @param src Pointer to BitSetNuma initialized with the same partition size, cannot be NULL.
+     * @return void
+     *
+     * @note Like BitSet_or, a shorter "src" reads as zero past its end and "dest" keeps its length. With
+     * part_bits 0 the partition size depends on the length, so pass it explicitly to mix lengths.
+     */
+    bitset_forced_inline void BitSetNuma_or(BitSetNuma *dest, const BitSetNuma *src);
+
+    /**
+     * @brief Bitwise AND "src" into "dest", every partition on a thread pinned to its node.
+     *
+     * @param dest Pointer to BitSetNuma, cannot be NULL.
+     * @param src Pointer to BitSetNuma initialized with the same partition size, cannot be NULL.
+     * @return void
+     *
+     * @note Like BitSet_and, a shorter "src" reads as zero past its end and "dest" keeps its length. With
+     * part_bits 0 the partition size depends on the length, so pass it explicitly to mix lengths.
+     */
+    bitset_forced_inline void BitSetNuma_and(BitSetNuma *dest, const BitSetNuma *src);
+
+    /**
+     * @brief Bitwise XOR "src" into "dest", every partition on a thread pinned to its node.
+     *
+     * @param dest Pointer to BitSetNuma, cannot be NULL.
+     * @param src Pointer to BitSetNuma initialized with the same partition size, cannot be NULL.
+     * @return void
+     *
+     * @note Like BitSet_xor, a shorter "src" reads as zero past its end and "dest" keeps its length. With
+     * part_bits 0 the partition size depends on the length, so pass it explicitly to mix lengths.
+     */
+    bitset_forced_inline void BitSetNuma_xor(BitSetNuma *dest, const BitSetNuma *src);
+
+    /**
+     * @brief Count the set bits, every partition on a thread pinned to its node.
+     *
+     * @param bn Pointer to BitSetNuma, cannot be NULL.
+     * @return size_t Number of set bits.
+     */
+    bitset_forced_inline size_t BitSetNuma_count(const BitSetNuma *bn);
+
+    /**
+     * @brief Call "fn" with every set bit, every partition on a thread pinned to its node.
+     *
+     * @param bn Pointer to BitSetNuma, cannot be NULL.
+     * @param fn Callback, return non zero to cancel. It is called concurrently and must be thread safe.
+     * @param ctx Passed to "fn".
+     * @return int 1 if "fn" cancelled the iteration, 0 otherwise.
+     *
+     * @details Each partition is visited in ascending order by one thread.
+     */
+    bitset_forced_inline int BitSetNuma_for_each_set(const BitSetNuma *bn, BitSetIndexFn fn, void *ctx);
+#endif /* BITSET_THREADS */
+
+    /*  Implementation */
+
+#if defined(BITSET_CPP_WRAPPER) && defined(__cplusplus) && defined(BITSET_IMPLEMENTATION)
+
+    struct BitSetWrapper
+    {
+        BitSet bs;
+        BitSetWrapper() = delete;
+        BitSetWrapper(size_t bit_len)
+        {
+            BitSet_init(&bs, bit_len);
+        }
+        ~BitSetWrapper()
+        {
+            BitSet_free(&bs);
+        }
+        BitSetWrapper(const BitSetWrapper &other)
+        {
+            BitSet_copy_construct(&bs, &other.bs);
+        }
+        BitSetWrapper &operator=(const BitSetWrapper &other)
+        {
+            BitSet_copy_construct(&bs, &other.bs);
+            return *this;
+        }
+        void set(size_t index)
+        {
+            BitSet_set(&bs, index);
+        }
+        void clear(size_t index)
+        {
+            BitSet_clear(&bs, index);
+        }
+        unsigned int get(size_t index)
+        {
+            return BitSet_get(&bs, index);
+        }
+        void flip(size_t index)
+        {
+            BitSet_flip(&bs, index);
+        }
+        void set_all()
+        {
+            BitSet_set_all(&bs);
+        }
+        void clear_all()
+        {
+            BitSet_clear_all(&bs);
+        }
+        static BitSetWrapper or_of(const BitSetWrapper &a, const BitSetWrapper &b)
+        {
+            BitSetWrapper out(0);
+            BitSet_or_into(&out.bs, &a.bs, &b.bs);
+            return out;
+        }
+        static BitSetWrapper and_of(const BitSetWrapper &a, const BitSetWrapper &b)
+        {
+            BitSetWrapper out(0);
+            BitSet_and_into(&out.bs, &a.bs, &b.bs);
+            return out;
+        }
+        static BitSetWrapper xor_of(const BitSetWrapper &a, const BitSetWrapper &b)
+        {
+            BitSetWrapper out(0);
+            BitSet_xor_into(&out.bs, &a.bs, &b.bs);
+            return out;
+        }
+        void or_op(const BitSetWrapper &other)
+        {
+            BitSet_or(&bs, &other.bs);
+        }
+        void and_op(const BitSetWrapper &other)
+        {
+            BitSet_and(&bs, &other.bs);
+        }
+        void xor_op(const BitSetWrapper &other)
+        {
+            BitSet_xor(&bs, &other.bs);
+        }
+        void not_op()
+        {
+            BitSet_not(&bs);
+        }
+        int equals(const BitSetWrapper &other)
+        {
+            return BitSet_equals(&bs, &other.bs);
+        }
+        void print(int newline)
+        {
+            BitSet_print(&bs, newline);
+        }
+        size_t count()
+        {
+            return BitSet_count(&bs);
+        }
+    };
+
+#endif /* BITSET_CPP_WRAPPER */
+
+#endif /* BITSET_H */
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
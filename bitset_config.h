@@ -0,0 +1,92 @@
+/**
+ * @file bitset_config.h
+ * @author Adam Naghavi (adamnaghavif@gmail.com)
+ * @brief Compile time configuration for bitset.h.
+ * @version 0.1
+ * @date 2024-06-03
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * @note Every setting can be overridden by defining it before including bitset.h, or by pointing
+ * BITSET_USER_CONFIG at a header that defines them.
+ *
+ */
+
+#ifndef BITSET_CONFIG_H
+#define BITSET_CONFIG_H
+
+#ifdef BITSET_USER_CONFIG
+#include BITSET_USER_CONFIG
+#endif
+
+/*
+ * Validation of the checked-by-default functions (BitSet_get, BitSet_set, ...).
+ * 1 checks for NULL pointers and out of bounds indices and raises a signal, 0 compiles the checks out.
+ * By default it follows the build flags, define it to 0 so a release build that misses NDEBUG or
+ * optimization still gets the minimal hot path. The _unchecked functions never validate and the
+ * _checked functions always do, whatever this is set to.
+ */
+#ifndef BITSET_DEBUG_MODE
+#if defined(_DEBUG) || !defined(NDEBUG) || !defined(__OPTIMIZE__)
+#define BITSET_DEBUG_MODE 1
+#else
+#define BITSET_DEBUG_MODE 0
+#endif
+#endif
+
+/* Rows per tile in BitSet_build_index, must be a multiple of 64. */
+#ifndef BITSET_INDEX_TILE_ROWS
+#define BITSET_INDEX_TILE_ROWS 4096
+#endif
+
+/* Maximum number of radix buckets per tile in BitSet_build_index. */
+#ifndef BITSET_INDEX_RADIX
+#define BITSET_INDEX_RADIX 1024
+#endif
+
+/* Bytes of storage covered by one dirty flag when dirty tracking is enabled. */
+#ifndef BITSET_DIRTY_PAGE_SIZE
+#define BITSET_DIRTY_PAGE_SIZE 4096
+#endif
+
+/* Words guarded by one sequence counter in a BitSetConcurrent. */
+#ifndef BITSET_SEQLOCK_BLOCK_WORDS
+#define BITSET_SEQLOCK_BLOCK_WORDS 8
+#endif
+
+/* Chunks per thread in BitSet_parallel_for_each_set, more chunks give the work stealing finer grain. */
+#ifndef BITSET_PARALLEL_CHUNKS_PER_THREAD
+#define BITSET_PARALLEL_CHUNKS_PER_THREAD 16
+#endif
+
+/* Block size in bits that BitSet_to_indices_mt splits its work on, must be a multiple of 64. */
+#ifndef BITSET_COMPACT_BLOCK_BITS
+#define BITSET_COMPACT_BLOCK_BITS 65536
+#endif
+
+/* How many indices ahead the batched accessors prefetch. */
+#ifndef BITSET_PREFETCH_DISTANCE
+#define BITSET_PREFETCH_DISTANCE 16
+#endif
+
+/* Bytes per shared page of a BitSetCow, must be a multiple of 8. */
+#ifndef BITSET_COW_PAGE_SIZE
+#define BITSET_COW_PAGE_SIZE 4096
+#endif
+
+/* Byte length from which BitSet_clear_all hands whole pages back to the OS instead of writing zeros. */
+#ifndef BITSET_RELEASE_THRESHOLD
+#define BITSET_RELEASE_THRESHOLD (1 << 20)
+#endif
+
+/* Byte length from which BITSET_MEM_AUTO fills and copies with non-temporal stores, pick it above the LLC size. */
+#ifndef BITSET_STREAM_THRESHOLD
+#define BITSET_STREAM_THRESHOLD (32 << 20)
+#endif
+
+/* Bits sieved at a time by the prime functions, sized to stay in L1/L2. Must be a multiple of 64. */
+#ifndef BITSET_SIEVE_SEGMENT_BITS
+#define BITSET_SIEVE_SEGMENT_BITS (1 << 18)
+#endif
+
+#endif /* BITSET_CONFIG_H */
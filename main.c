@@ -1,44 +1,1757 @@
-/**
- * @file main.c
- * @author Adam Naghavi
- * @brief Test the bitset implementation.
- * @version 0.1
- * @date 2024-06-03
- * 
- * @copyright Copyright (c) 2024
- * 
- */
-
-#define BITSET_IMPLEMENTATION
-#include "bitset.h"
-#include <stdlib.h>
-#include <stdio.h>
-
-
-int main(void)
-{
-    BitSet bs;
-    BitSet_init(&bs, 100);
-    srand(0);
-    // for (size_t i = 0; i < 100; i++)
-    // {
-    //     if (rand() % 2)
-    //     {
-    //         BitSet_set(&bs, i);
-    //     }
-    // }
-    size_t dims[] = {2,2};
-    size_t num_dims = sizeof(dims) / sizeof(dims[0]);
-    size_t vec[] = {1,1};
-    BitSet_set(&bs, linear_index(num_dims,dims,vec));
-    BitSet_print(&bs,10);
-    putc('\n', stdout);
-    BitSet bs2;
-    BitSet_copy_construct(&bs2, &bs);
-    BitSet_print(&bs2,10);
-
-    BitSet_free(&bs);
-    BitSet_free(&bs2);
-
-    return 0;
-}
\ No newline at end of file
+/**
+ * @file main.c
+ * @author Adam Naghavi
+ * @brief Test the bitset implementation.
+ * @version 0.1
+ * @date 2024-06-03
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * Build and run:
+ *   cc -std=c11 -O2 -DBITSET_THREADS main.c -o bitset_test -lpthread && ./bitset_test
+ * The concurrent stress test is also meant to be run under ThreadSanitizer, add -g -fsanitize=thread.
+ */
+
+#define BITSET_IMPLEMENTATION
+#include "bitset.c"
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <time.h>
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// Uniform enough for the test sizes, rand() alone stops at 32767 on some platforms.
+static size_t random_index(size_t n)
+{
+    return ((size_t)rand() * (RAND_MAX + (size_t)1) + (size_t)rand()) % n;
+}
+
+#define COW_BITS 100000
+#define COW_WRITES 3000
+#define COW_ROUNDS 4
+
+// Random set / clear / flip on a copy-on-write BitSet and on a snapshot of it, each against its own byte array.
+static void test_cow(void)
+{
+    unsigned char *ref = (unsigned char *)calloc(COW_BITS, 1);
+    unsigned char *snap_ref = (unsigned char *)malloc(COW_BITS);
+    BitSetCow cow, snap;
+    BitSetCow_init(&cow, COW_BITS);
+    srand(4);
+    for (int round = 0; round < COW_ROUNDS; round++)
+    {
+        BitSetCow_snapshot(&snap, &cow);
+        memcpy(snap_ref, ref, COW_BITS);
+        for (int i = 0; i < COW_WRITES; i++)
+        {
+            // alternate the writer, so pages are cloned from both sides
+            BitSetCow *target = i % 2 ? &snap : &cow;
+            unsigned char *target_ref = i % 2 ? snap_ref : ref;
+            size_t index = random_index(COW_BITS);
+            switch (rand() % 3)
+            {
+            case 0:
+                BitSetCow_set(target, index);
+                target_ref[index] = 1;
+                break;
+            case 1:
+                BitSetCow_clear(target, index);
+                target_ref[index] = 0;
+                break;
+            default:
+                BitSetCow_flip(target, index);
+                target_ref[index] ^= 1;
+            }
+        }
+        size_t count = 0, snap_count = 0;
+        for (size_t i = 0; i < COW_BITS; i++)
+        {
+            assert(BitSetCow_get(&cow, i) == ref[i] && BitSetCow_get(&snap, i) == snap_ref[i]);
+            count += ref[i];
+            snap_count += snap_ref[i];
+        }
+        assert(BitSetCow_count(&cow) == count && BitSetCow_count(&snap) == snap_count);
+        (void)count;
+        (void)snap_count;
+        BitSetCow_free(&snap);
+    }
+
+    // round trip through a plain BitSet
+    BitSet plain;
+    BitSetCow_to_bitset(&plain, &cow);
+    BitSetCow copy;
+    BitSetCow_from_bitset(&copy, &plain);
+    for (size_t i = 0; i < COW_BITS; i++)
+    {
+        assert(BitSet_get(&plain, i) == ref[i] && BitSetCow_get(&copy, i) == ref[i]);
+    }
+
+    printf("cow: %d snapshots of %d bits, %zu bits set\n", COW_ROUNDS, COW_BITS, BitSetCow_count(&cow));
+    BitSet_free(&plain);
+    BitSetCow_free(&copy);
+    BitSetCow_free(&cow);
+    free(ref);
+    free(snap_ref);
+}
+
+#define PERSISTENT_BITS 100000
+#define PERSISTENT_VERSIONS 8
+#define PERSISTENT_WRITES 500
+
+typedef struct
+{
+    const unsigned char *a;
+    const unsigned char *b;
+    size_t next;
+    size_t visited;
+    size_t stop_after;
+} persistent_diff_check;
+
+// Checks that BitSetPersistent_diff reports the next index where the two reference arrays differ.
+static int persistent_diff_visit(size_t index, void *ctx)
+{
+    persistent_diff_check *check = (persistent_diff_check *)ctx;
+    while (check->a[check->next] == check->b[check->next])
+    {
+        check->next++;
+    }
+    assert(index == check->next);
+    (void)index;
+    check->next++;
+    check->visited++;
+    return check->visited == check->stop_after;
+}
+
+// A chain of persistent versions, each made from the previous one with random writes, against a byte array per
+// version. Older versions must keep their bits, and diff must report exactly the indices that differ.
+static void test_persistent(void)
+{
+    unsigned char *ref = (unsigned char *)calloc((size_t)PERSISTENT_VERSIONS * PERSISTENT_BITS, 1);
+    BitSetPersistent versions[PERSISTENT_VERSIONS];
+    BitSetPersistent_init(&versions[0], PERSISTENT_BITS);
+    srand(5);
+    for (size_t v = 1; v < PERSISTENT_VERSIONS; v++)
+    {
+        unsigned char *cur = ref + v * PERSISTENT_BITS;
+        memcpy(cur, cur - PERSISTENT_BITS, PERSISTENT_BITS);
+        // the first write makes the new version, the rest are transient writes to it
+        size_t index = random_index(PERSISTENT_BITS);
+        BitSetPersistent_set(&versions[v], &versions[v - 1], index);
+        cur[index] = 1;
+        for (int i = 1; i < PERSISTENT_WRITES; i++)
+        {
+            // clustered writes, so some versions share whole subtrees and some paths are written twice
+            index = (v * 9973 + random_index(PERSISTENT_BITS / 8)) % PERSISTENT_BITS;
+            if (rand() % 3)
+            {
+                BitSetPersistent_set_mut(&versions[v], index);
+                cur[index] = 1;
+            }
+            else
+            {
+                BitSetPersistent_clear_mut(&versions[v], index);
+                cur[index] = 0;
+            }
+        }
+    }
+    for (size_t v = 0; v < PERSISTENT_VERSIONS; v++)
+    {
+        for (size_t i = 0; i < PERSISTENT_BITS; i++)
+        {
+            assert(BitSetPersistent_get(&versions[v], i) == ref[v * PERSISTENT_BITS + i]);
+        }
+    }
+
+    size_t differences = 0;
+    for (size_t a = 0; a < PERSISTENT_VERSIONS; a++)
+    {
+        for (size_t b = 0; b < PERSISTENT_VERSIONS; b++)
+        {
+            persistent_diff_check check = {ref + a * PERSISTENT_BITS, ref + b * PERSISTENT_BITS, 0, 0, SIZE_MAX};
+            int stopped = BitSetPersistent_diff(&versions[a], &versions[b], persistent_diff_visit, &check);
+            assert(stopped == 0);
+            // nothing may differ past the last reported index
+            for (size_t i = check.next; i < PERSISTENT_BITS; i++)
+            {
+                assert(check.a[i] == check.b[i]);
+            }
+            size_t differences_before = differences;
+            differences += check.visited;
+
+            // stopping after the first index
+            check.next = 0;
+            check.visited = 0;
+            check.stop_after = 1;
+            stopped = BitSetPersistent_diff(&versions[a], &versions[b], persistent_diff_visit, &check);
+            assert(stopped == (check.visited == 1) && (check.visited == 1) == (differences_before != differences));
+            (void)stopped;
+            (void)differences_before;
+        }
+    }
+
+    // the non transient clear on a second handle leaves the version it started from alone
+    const BitSetPersistent *last = &versions[PERSISTENT_VERSIONS - 1];
+    unsigned char *last_ref = ref + (PERSISTENT_VERSIONS - 1) * PERSISTENT_BITS;
+    unsigned char *cleared_ref = (unsigned char *)malloc(PERSISTENT_BITS);
+    memcpy(cleared_ref, last_ref, PERSISTENT_BITS);
+    size_t index = 0;
+    while (!last_ref[index])
+    {
+        index++;
+    }
+    cleared_ref[index] = 0;
+    BitSetPersistent handle, cleared;
+    BitSetPersistent_copy(&handle, last);
+    BitSetPersistent_clear(&cleared, &handle, index);
+    assert(BitSetPersistent_get(&cleared, index) == 0 && BitSetPersistent_get(last, index) == 1);
+    persistent_diff_check check = {cleared_ref, last_ref, 0, 0, SIZE_MAX};
+    BitSetPersistent_diff(&cleared, last, persistent_diff_visit, &check);
+    assert(check.visited == 1);
+    BitSetPersistent_free(&cleared);
+    BitSetPersistent_free(&handle);
+    free(cleared_ref);
+
+    printf("persistent: %d versions, %zu differing bits over all pairs\n", PERSISTENT_VERSIONS, differences);
+    for (size_t v = 0; v < PERSISTENT_VERSIONS; v++)
+    {
+        BitSetPersistent_free(&versions[v]);
+    }
+    free(ref);
+}
+
+#define PATCH_BITS 50000
+
+// BitSet_diff / BitSet_apply_patch round trips from sparse to dense changes, and rejection of every truncation of
+// a patch and of a patch made for another length, which must leave the target untouched.
+static void test_patch(void)
+{
+    BitSet old_bs, new_bs, target;
+    BitSet_init(&old_bs, PATCH_BITS);
+    BitSet_init(&new_bs, PATCH_BITS);
+    BitSet_init(&target, PATCH_BITS);
+    srand(6);
+    for (size_t i = 0; i < PATCH_BITS; i++)
+    {
+        if (rand() % 4 == 0)
+        {
+            BitSet_set(&old_bs, i);
+        }
+    }
+    size_t flips[] = {0, 1, 10, 1000, PATCH_BITS};
+    size_t total_len = 0;
+    for (size_t f = 0; f < sizeof(flips) / sizeof(flips[0]); f++)
+    {
+        BitSet_clear_all(&new_bs);
+        BitSet_or(&new_bs, &old_bs);
+        for (size_t i = 0; i < flips[f]; i++)
+        {
+            BitSet_flip(&new_bs, random_index(PATCH_BITS));
+        }
+        uint8_t *patch;
+        size_t len = BitSet_diff(&old_bs, &new_bs, &patch);
+        assert(len != SIZE_MAX);
+        total_len += len;
+
+        BitSet_clear_all(&target);
+        BitSet_or(&target, &old_bs);
+        int applied = BitSet_apply_patch(&target, patch, len);
+        assert(applied && BitSet_equals(&target, &new_bs));
+        for (size_t i = 0; i < PATCH_BITS; i++)
+        {
+            assert(BitSet_get(&target, i) == BitSet_get(&new_bs, i));
+        }
+
+        for (size_t cut = 0; cut < len; cut++)
+        {
+            BitSet_clear_all(&target);
+            BitSet_or(&target, &old_bs);
+            applied = BitSet_apply_patch(&target, patch, cut);
+            assert(!applied && BitSet_equals(&target, &old_bs));
+        }
+        (void)applied;
+        free(patch);
+    }
+
+    BitSet shorter;
+    BitSet_init(&shorter, PATCH_BITS - 1);
+    uint8_t *patch;
+    size_t len = BitSet_diff(&shorter, &shorter, &patch);
+    int applied = BitSet_apply_patch(&target, patch, len);
+    assert(!applied);
+    (void)applied;
+    free(patch);
+
+    printf("patch: %zu bytes for %zu flip rounds of %d bits\n", total_len, sizeof(flips) / sizeof(flips[0]), PATCH_BITS);
+    BitSet_free(&shorter);
+    BitSet_free(&old_bs);
+    BitSet_free(&new_bs);
+    BitSet_free(&target);
+}
+
+#define SHARDED_BITS 200000
+#define SHARDED_SHARDS 4
+#define SHARDED_EPOCHS 5
+#define SHARDED_WRITES 2000
+
+typedef struct
+{
+    const unsigned char *ref;
+    size_t next;
+    size_t visited;
+} sharded_visit_check;
+
+static int sharded_visit(size_t index, void *ctx)
+{
+    sharded_visit_check *check = (sharded_visit_check *)ctx;
+    while (!check->ref[check->next])
+    {
+        check->next++;
+    }
+    assert(index == check->next);
+    (void)index;
+    check->next++;
+    check->visited++;
+    return 0;
+}
+
+// Writes spread over the shards of a BitSetSharded, checked against a byte array before and after each merge.
+static void test_sharded(void)
+{
+    unsigned char *ref = (unsigned char *)calloc(SHARDED_BITS, 1);
+    BitSetSharded sh;
+    BitSetSharded_init(&sh, SHARDED_BITS, SHARDED_SHARDS);
+    srand(7);
+    size_t count = 0;
+    for (int epoch = 0; epoch < SHARDED_EPOCHS; epoch++)
+    {
+        for (int i = 0; i < SHARDED_WRITES; i++)
+        {
+            // later epochs write into a narrower range, so shards overlap each other and the main set
+            size_t index = random_index(SHARDED_BITS / (size_t)(epoch + 1));
+            BitSetSharded_set(&sh, (size_t)rand() % SHARDED_SHARDS, index);
+            count += !ref[index];
+            ref[index] = 1;
+        }
+        // the union is visible before the merge
+        assert(BitSetSharded_count(&sh) == count);
+        sharded_visit_check check = {ref, 0, 0};
+        BitSetSharded_for_each_set(&sh, sharded_visit, &check);
+        assert(check.visited == count);
+
+        BitSetSharded_merge(&sh);
+        const BitSet *main_bs = BitSetSharded_main(&sh);
+        assert(BitSet_count(main_bs) == count && BitSetSharded_count(&sh) == count);
+        for (size_t i = 0; i < SHARDED_BITS; i++)
+        {
+            assert(BitSet_get(main_bs, i) == ref[i] && BitSetSharded_get(&sh, i) == ref[i]);
+        }
+        (void)main_bs;
+    }
+
+    printf("sharded: %d shards, %d epochs, %zu bits set\n", SHARDED_SHARDS, SHARDED_EPOCHS, count);
+    BitSetSharded_free(&sh);
+    free(ref);
+}
+
+#define PREFIX_BITS 100003
+
+// Block prefix counts, rank and stream compaction against a running count, for a length that is not a multiple of
+// any block size and blocks from one word to a page.
+static void test_prefix_counts(void)
+{
+    BitSet bs;
+    BitSet_init(&bs, PREFIX_BITS);
+    srand(9);
+    for (size_t i = 0; i < PREFIX_BITS; i++)
+    {
+        if (rand() % (i < PREFIX_BITS / 2 ? 3 : 40) == 0)
+        {
+            BitSet_set(&bs, i);
+        }
+    }
+    // naive rank of every index and the positions of the set bits
+    size_t *rank = (size_t *)malloc((PREFIX_BITS + 1) * sizeof(size_t));
+    size_t *indices = (size_t *)malloc(PREFIX_BITS * sizeof(size_t));
+    size_t *out = (size_t *)malloc(PREFIX_BITS * sizeof(size_t));
+    size_t count = 0;
+    for (size_t i = 0; i < PREFIX_BITS; i++)
+    {
+        rank[i] = count;
+        if (BitSet_get(&bs, i))
+        {
+            indices[count++] = i;
+        }
+    }
+    rank[PREFIX_BITS] = count;
+
+    size_t block_sizes[] = {64, 512, 4096};
+    for (size_t b = 0; b < sizeof(block_sizes) / sizeof(block_sizes[0]); b++)
+    {
+        size_t block_bits = block_sizes[b];
+        size_t len = BitSet_prefix_counts_len(&bs, block_bits);
+        assert(len == (PREFIX_BITS + block_bits - 1) / block_bits + 1);
+        size_t *counts = (size_t *)malloc(len * sizeof(size_t));
+        BitSet_prefix_counts(&bs, block_bits, counts);
+        for (size_t k = 0; k + 1 < len; k++)
+        {
+            assert(counts[k] == rank[k * block_bits]);
+        }
+        assert(counts[len - 1] == count);
+        for (size_t i = 0; i <= PREFIX_BITS; i++)
+        {
+            assert(BitSet_rank(&bs, counts, block_bits, i) == rank[i]);
+        }
+#if defined(BITSET_THREADS)
+        size_t *mt_counts = (size_t *)malloc(len * sizeof(size_t));
+        for (size_t threads = 1; threads <= 4; threads++)
+        {
+            BitSet_prefix_counts_mt(&bs, block_bits, mt_counts, threads);
+            assert(memcmp(mt_counts, counts, len * sizeof(size_t)) == 0);
+        }
+        free(mt_counts);
+#endif
+        free(counts);
+    }
+
+    size_t written = BitSet_to_indices(&bs, out, PREFIX_BITS);
+    assert(written == count && memcmp(out, indices, count * sizeof(size_t)) == 0);
+    (void)written;
+#if defined(BITSET_THREADS)
+    for (size_t threads = 1; threads <= 8; threads++)
+    {
+        memset(out, 0, PREFIX_BITS * sizeof(size_t));
+        written = BitSet_to_indices_mt(&bs, out, threads);
+        assert(written == count && memcmp(out, indices, count * sizeof(size_t)) == 0);
+    }
+#endif
+
+    printf("prefix counts: %zu of %d bits set, rank checked at every index\n", count, PREFIX_BITS);
+    free(rank);
+    free(indices);
+    free(out);
+    BitSet_free(&bs);
+}
+
+#define BATCH_BITS 1000000
+#define BATCH_MAX 20000
+
+// Batched gets and writes against a byte array, for batches shorter and longer than the prefetch distance and with
+// duplicate indices, which test_and_set_many must see in order.
+static void test_batch(void)
+{
+    unsigned char *ref = (unsigned char *)calloc(BATCH_BITS, 1);
+    size_t *idx = (size_t *)malloc(BATCH_MAX * sizeof(size_t));
+    uint8_t *out = (uint8_t *)malloc(BATCH_MAX);
+    BitSet bs;
+    BitSet_init(&bs, BATCH_BITS);
+    srand(10);
+    size_t batch_sizes[] = {0, 1, 7, 100, BATCH_MAX};
+    for (size_t b = 0; b < sizeof(batch_sizes) / sizeof(batch_sizes[0]); b++)
+    {
+        size_t n = batch_sizes[b];
+        for (size_t i = 0; i < n; i++)
+        {
+            // every fourth index repeats an earlier one
+            idx[i] = i % 4 == 3 ? idx[(size_t)rand() % i] : random_index(BATCH_BITS);
+        }
+
+        BitSet_test_and_set_many(&bs, idx, n, out);
+        for (size_t i = 0; i < n; i++)
+        {
+            assert(out[i] == ref[idx[i]]);
+            ref[idx[i]] = 1;
+        }
+
+        // clear a third of them again, then read everything back
+        BitSet_clear_many(&bs, idx, n / 3);
+        for (size_t i = 0; i < n / 3; i++)
+        {
+            ref[idx[i]] = 0;
+        }
+        BitSet_get_many(&bs, idx, n, out);
+        for (size_t i = 0; i < n; i++)
+        {
+            assert(out[i] == ref[idx[i]]);
+        }
+
+        BitSet_set_many(&bs, idx, n / 2);
+        for (size_t i = 0; i < n / 2; i++)
+        {
+            ref[idx[i]] = 1;
+        }
+    }
+    size_t count = 0;
+    for (size_t i = 0; i < BATCH_BITS; i++)
+    {
+        assert(BitSet_get(&bs, i) == ref[i]);
+        count += ref[i];
+    }
+    assert(BitSet_count(&bs) == count);
+
+    printf("batch: %zu bits set by batches of up to %d indices\n", count, BATCH_MAX);
+    BitSet_free(&bs);
+    free(ref);
+    free(idx);
+    free(out);
+}
+
+#define LAZY_BITS 1000000
+#define LAZY_ROUNDS 50
+#define LAZY_WRITES 40
+
+// clear_all with lazy clear enabled against a BitSet cleared in full, after sparse writes through the single bit,
+// batched and bulk paths, and while dirty tracking is switched on and off on the same page map.
+static void test_lazy_clear(void)
+{
+    BitSet lazy, ref, sparse;
+    BitSet_init(&lazy, LAZY_BITS);
+    BitSet_init(&ref, LAZY_BITS);
+    BitSet_init(&sparse, LAZY_BITS);
+    // bits written before enabling must still be cleared
+    for (size_t i = 0; i < LAZY_BITS; i += 4099)
+    {
+        BitSet_set(&lazy, i);
+    }
+    BitSet_enable_lazy_clear(&lazy);
+    srand(11);
+    size_t idx[LAZY_WRITES];
+    for (int r = 0; r < LAZY_ROUNDS; r++)
+    {
+        BitSet_clear_all(&lazy);
+        BitSet_clear_all_ex(&ref, BITSET_MEM_LIBC);
+        assert(BitSet_count(&lazy) == 0);
+        if (r == 10)
+        {
+            BitSet_enable_dirty_tracking(&lazy);
+        }
+        if (r == 20)
+        {
+            BitSet_disable_dirty_tracking(&lazy);
+        }
+        for (int i = 0; i < LAZY_WRITES; i++)
+        {
+            idx[i] = random_index(LAZY_BITS);
+        }
+        switch (r % 3)
+        {
+        case 0:
+            for (int i = 0; i < LAZY_WRITES; i++)
+            {
+                BitSet_flip(&lazy, idx[i]);
+                BitSet_flip(&ref, idx[i]);
+            }
+            break;
+        case 1:
+            BitSet_set_many(&lazy, idx, LAZY_WRITES);
+            BitSet_set_many(&ref, idx, LAZY_WRITES);
+            break;
+        default:
+            BitSet_clear_all(&sparse);
+            for (int i = 0; i < LAZY_WRITES; i++)
+            {
+                BitSet_set(&sparse, idx[i]);
+            }
+            BitSet_or(&lazy, &sparse);
+            BitSet_or(&ref, &sparse);
+        }
+        assert(BitSet_equals(&lazy, &ref));
+    }
+    BitSet_clear_all(&lazy);
+    for (size_t i = 0; i < LAZY_BITS; i++)
+    {
+        assert(BitSet_get(&lazy, i) == 0);
+    }
+
+    printf("lazy clear: %d rounds of %d writes over %d bits\n", LAZY_ROUNDS, LAZY_WRITES, LAZY_BITS);
+    BitSet_free(&lazy);
+    BitSet_free(&ref);
+    BitSet_free(&sparse);
+}
+
+// Whole buffer fills and copies in every BitSetMemMode, on lengths with a partial last word and one just above
+// BITSET_STREAM_THRESHOLD so BITSET_MEM_AUTO takes the non-temporal path, against a bit by bit copy.
+static void test_stream(void)
+{
+    size_t lens[] = {1, 100, 4099, (size_t)BITSET_STREAM_THRESHOLD * 8 + 77};
+    BitSetMemMode modes[] = {BITSET_MEM_AUTO, BITSET_MEM_LIBC, BITSET_MEM_STREAM};
+    double stream_seconds = 0;
+    double libc_seconds = 0;
+    for (size_t l = 0; l < sizeof(lens) / sizeof(lens[0]); l++)
+    {
+        size_t len = lens[l];
+        BitSet src, ref;
+        BitSet_init(&src, len);
+        BitSet_init(&ref, len);
+        for (size_t i = 0; i < len; i += 1 + i % 97)
+        {
+            BitSet_set(&src, i);
+            BitSet_set(&ref, i);
+        }
+        size_t count = BitSet_count(&src);
+        for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++)
+        {
+            double start = now_seconds();
+            BitSet copy;
+            BitSet_copy_construct_ex(&copy, &src, modes[m]);
+            double seconds = now_seconds() - start;
+            stream_seconds += l == 3 && modes[m] == BITSET_MEM_STREAM ? seconds : 0;
+            libc_seconds += l == 3 && modes[m] == BITSET_MEM_LIBC ? seconds : 0;
+            assert(BitSet_equals(&copy, &ref) && BitSet_count(&copy) == count);
+            for (size_t i = 0; i < len; i += len > 100000 ? 4093 : 1)
+            {
+                assert(BitSet_get(&copy, i) == BitSet_get(&ref, i));
+            }
+
+            // bits past the length must stay clear, count and equals look at whole words
+            BitSet_set_all_ex(&copy, modes[m]);
+            assert(BitSet_count(&copy) == len && BitSet_get(&copy, 0) == 1 && BitSet_get(&copy, len - 1) == 1);
+            BitSet_clear_all_ex(&copy, modes[m]);
+            assert(BitSet_count(&copy) == 0);
+            BitSet_free(&copy);
+        }
+        (void)count;
+        BitSet_free(&src);
+        BitSet_free(&ref);
+    }
+
+    printf("stream: copy of %d MB %.2f ms streamed, %.2f ms libc\n", BITSET_STREAM_THRESHOLD >> 20, stream_seconds * 1e3,
+           libc_seconds * 1e3);
+}
+
+typedef struct
+{
+    void (*in_place)(BitSet *dest, const BitSet *src);
+    void (*into)(BitSet *out, const BitSet *a, const BitSet *b);
+    // bit "(a << 1) | b" is the result for that pair of input bits
+    unsigned int table;
+} logic_op;
+
+static unsigned int bit_or_zero(const BitSet *bs, size_t i)
+{
+    return i < bs->bit_len ? BitSet_get(bs, i) : 0;
+}
+
+// Checks every bit of "out" and, through the count, that nothing leaked past its length.
+static void check_logic(const BitSet *out, size_t len, const BitSet *a, const BitSet *b, const BitSet *c,
+                        unsigned int table)
+{
+    assert(out->bit_len == len);
+    size_t count = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        unsigned int row = bit_or_zero(a, i) << 1 | bit_or_zero(b, i);
+        row = c ? row << 1 | bit_or_zero(c, i) : row;
+        unsigned int expected = (table >> row) & 1;
+        assert(BitSet_get(out, i) == expected);
+        count += expected;
+    }
+    assert(BitSet_count(out) == count);
+    (void)out;
+    (void)count;
+}
+
+// The fused two and three input operations against their truth tables, on every pair of lengths so that the
+// shorter input reads as zero, and with the output aliasing an input.
+static void test_logic(void)
+{
+    logic_op ops[] = {{BitSet_andnot, BitSet_andnot_into, 0x4}, {BitSet_ornot, BitSet_ornot_into, 0xD},
+                      {BitSet_nand, BitSet_nand_into, 0x7},     {BitSet_nor, BitSet_nor_into, 0x1},
+                      {BitSet_xnor, BitSet_xnor_into, 0x9}};
+    size_t lens[] = {1, 130, 1000};
+    BitSet sets[3];
+    srand(12);
+    for (size_t l = 0; l < 3; l++)
+    {
+        BitSet_init(&sets[l], lens[l]);
+        for (size_t i = 0; i < lens[l]; i++)
+        {
+            if (rand() % 2)
+            {
+                BitSet_set(&sets[l], i);
+            }
+        }
+    }
+    BitSet out, dest;
+    BitSet_init(&out, 1);
+    size_t checked = 0;
+    for (size_t o = 0; o < sizeof(ops) / sizeof(ops[0]); o++)
+    {
+        for (size_t x = 0; x < 3; x++)
+        {
+            for (size_t y = 0; y < 3; y++)
+            {
+                const BitSet *a = &sets[x], *b = &sets[y];
+                size_t len = lens[x] > lens[y] ? lens[x] : lens[y];
+                ops[o].into(&out, a, b);
+                check_logic(&out, len, a, b, NULL, ops[o].table);
+
+                // in place, "dest" keeps its length
+                BitSet_copy_construct(&dest, a);
+                ops[o].in_place(&dest, b);
+                check_logic(&dest, lens[x], a, b, NULL, ops[o].table);
+
+                // "out" aliasing the first input
+                BitSet_free(&dest);
+                BitSet_copy_construct(&dest, a);
+                ops[o].into(&dest, &dest, b);
+                check_logic(&dest, len, a, b, NULL, ops[o].table);
+                BitSet_free(&dest);
+                checked++;
+            }
+        }
+    }
+
+    // every truth table on inputs of three different lengths, once with "out" aliasing "b"
+    for (unsigned int imm8 = 0; imm8 < 256; imm8++)
+    {
+        BitSet_ternary(&out, &sets[2], &sets[0], &sets[1], (uint8_t)imm8);
+        check_logic(&out, lens[2], &sets[2], &sets[0], &sets[1], imm8);
+        BitSet_copy_construct(&dest, &sets[1]);
+        BitSet_ternary(&dest, &sets[0], &dest, &sets[2], (uint8_t)imm8);
+        check_logic(&dest, lens[2], &sets[0], &sets[1], &sets[2], imm8);
+        BitSet_free(&dest);
+        checked++;
+    }
+
+    printf("logic: %zu operation and length combinations checked\n", checked);
+    BitSet_free(&out);
+    for (size_t l = 0; l < 3; l++)
+    {
+        BitSet_free(&sets[l]);
+    }
+}
+
+#define SHIFT_BITS 5000
+
+// BitSet_or_shifted against a byte array, with shifts around word boundaries and past the end, from a shorter
+// source and from "dest" itself, which is the subset sum step.
+static void test_or_shifted(void)
+{
+    unsigned char *ref = (unsigned char *)malloc(SHIFT_BITS);
+    BitSet dest, src;
+    BitSet_init(&src, SHIFT_BITS / 3);
+    srand(13);
+    for (size_t i = 0; i < SHIFT_BITS / 3; i++)
+    {
+        if (rand() % 5 == 0)
+        {
+            BitSet_set(&src, i);
+        }
+    }
+    size_t shifts[] = {0, 1, 63, 64, 65, 130, SHIFT_BITS - 1, SHIFT_BITS, SHIFT_BITS + 64};
+    for (size_t s = 0; s < sizeof(shifts) / sizeof(shifts[0]); s++)
+    {
+        BitSet_init(&dest, SHIFT_BITS);
+        memset(ref, 0, SHIFT_BITS);
+        for (size_t i = 0; i < SHIFT_BITS; i += 7)
+        {
+            BitSet_set(&dest, i);
+            ref[i] = 1;
+        }
+        BitSet_or_shifted(&dest, &src, shifts[s]);
+        for (size_t i = 0; i < SHIFT_BITS / 3 && i + shifts[s] < SHIFT_BITS; i++)
+        {
+            ref[i + shifts[s]] |= (unsigned char)BitSet_get(&src, i);
+        }
+        for (size_t i = 0; i < SHIFT_BITS; i++)
+        {
+            assert(BitSet_get(&dest, i) == ref[i]);
+        }
+        BitSet_free(&dest);
+    }
+
+    // subset sums, "dest" is its own source and must be read as it was before the call
+    size_t weights[] = {3, 64, 5, 129, 1000, 7, 64, 2047};
+    BitSet_init(&dest, SHIFT_BITS);
+    BitSet_set(&dest, 0);
+    memset(ref, 0, SHIFT_BITS);
+    ref[0] = 1;
+    for (size_t w = 0; w < sizeof(weights) / sizeof(weights[0]); w++)
+    {
+        BitSet_or_shifted(&dest, &dest, weights[w]);
+        for (size_t i = SHIFT_BITS; i-- > weights[w];)
+        {
+            ref[i] |= ref[i - weights[w]];
+        }
+        for (size_t i = 0; i < SHIFT_BITS; i++)
+        {
+            assert(BitSet_get(&dest, i) == ref[i]);
+        }
+    }
+
+    printf("or_shifted: %zu subset sums below %d\n", BitSet_count(&dest), SHIFT_BITS);
+    BitSet_free(&dest);
+    BitSet_free(&src);
+    free(ref);
+}
+
+#define PRIME_LIMIT 1200000
+#define PRIME_SMALL 200
+
+typedef struct
+{
+    const unsigned char *composite;
+    uint64_t next;
+} prime_visit_check;
+
+static int prime_visit(size_t p, void *ctx)
+{
+    prime_visit_check *check = (prime_visit_check *)ctx;
+    while (check->composite[check->next])
+    {
+        check->next++;
+    }
+    assert(p == check->next);
+    (void)p;
+    check->next++;
+    return 0;
+}
+
+// The segmented sieve functions against a byte array Eratosthenes sieve, on every small range so 0, 1, 2 and the
+// presieved primes are covered, and on a range of several segments.
+static void test_primes(void)
+{
+    unsigned char *composite = (unsigned char *)calloc(PRIME_LIMIT + 1, 1);
+    composite[0] = composite[1] = 1;
+    for (size_t p = 2; p * p <= PRIME_LIMIT; p++)
+    {
+        for (size_t q = p * p; !composite[p] && q <= PRIME_LIMIT; q += p)
+        {
+            composite[q] = 1;
+        }
+    }
+    BitSet sieve;
+    BitSet_init(&sieve, 1);
+    static uint64_t ranges[PRIME_SMALL * PRIME_SMALL / 2 + 1][2];
+    size_t num_ranges = 0;
+    for (uint64_t lo = 0; lo < PRIME_SMALL; lo++)
+    {
+        for (uint64_t hi = lo; hi < PRIME_SMALL; hi += 1 + hi % 3)
+        {
+            ranges[num_ranges][0] = lo;
+            ranges[num_ranges][1] = hi;
+            num_ranges++;
+        }
+    }
+    ranges[num_ranges][0] = 999;
+    ranges[num_ranges][1] = PRIME_LIMIT;
+    num_ranges++;
+    uint64_t total = 0;
+    for (size_t r = 0; r < num_ranges; r++)
+    {
+        uint64_t lo = ranges[r][0], hi = ranges[r][1];
+        uint64_t count = 0;
+        for (uint64_t n = lo; n < hi; n++)
+        {
+            count += !composite[n];
+        }
+        uint64_t primes = BitSet_prime_count(lo, hi);
+        assert(primes == count);
+        total += primes;
+
+        BitSet_sieve_odd(&sieve, lo, hi);
+        uint64_t first = lo | 1;
+        assert(sieve.bit_len == (hi > first ? (hi - first + 1) / 2 : 0));
+        for (size_t i = 0; i < sieve.bit_len; i++)
+        {
+            assert(BitSet_get(&sieve, i) == !composite[first + 2 * i]);
+        }
+        (void)first;
+
+        prime_visit_check check = {composite, lo};
+        int stopped = BitSet_for_each_prime(lo, hi, prime_visit, &check);
+        assert(stopped == 0);
+        (void)stopped;
+        for (uint64_t n = check.next; n < hi; n++)
+        {
+            assert(composite[n]);
+        }
+#if defined(BITSET_THREADS)
+        if (r % 97 == 0 || r == num_ranges - 1)
+        {
+            BitSet mt_sieve;
+            BitSet_init(&mt_sieve, 1);
+            for (size_t threads = 1; threads <= 4; threads++)
+            {
+                primes = BitSet_prime_count_mt(lo, hi, threads);
+                assert(primes == count);
+                BitSet_sieve_odd_mt(&mt_sieve, lo, hi, threads);
+                assert(BitSet_equals(&mt_sieve, &sieve));
+            }
+            BitSet_free(&mt_sieve);
+        }
+#endif
+    }
+
+    printf("primes: %zu ranges, %llu primes counted\n", num_ranges, (unsigned long long)total);
+    BitSet_free(&sieve);
+    free(composite);
+}
+
+#define GRAPH_MAX 14
+
+static int graph_adjacent(const BitSet *adj, size_t u, size_t v)
+{
+    return u != v && (BitSet_get(&adj[u], v) || BitSet_get(&adj[v], u));
+}
+
+// 1 if every pair of vertices in "mask" is adjacent ("want" = 1) or none is ("want" = 0)
+static int graph_uniform(const BitSet *adj, size_t n, uint32_t mask, int want)
+{
+    for (size_t u = 0; u < n; u++)
+    {
+        for (size_t v = u + 1; v < n; v++)
+        {
+            if ((mask >> u & 1) && (mask >> v & 1) && graph_adjacent(adj, u, v) != want)
+            {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+// Maximum clique, maximum independent set and DSATUR on random graphs of up to GRAPH_MAX vertices against a brute
+// force over every vertex subset. Edges are stored on one side only, the kernels must treat them as undirected.
+static void test_graph(void)
+{
+    BitSet adj[GRAPH_MAX];
+    size_t out[GRAPH_MAX];
+    size_t colors[GRAPH_MAX];
+    srand(14);
+    size_t graphs = 0;
+    for (size_t n = 0; n <= GRAPH_MAX; n++)
+    {
+        for (int density = 10; density <= 90; density += 20)
+        {
+            // every other graph is bipartite, DSATUR colors those with at most two colors
+            int bipartite = density % 20 == 10;
+            for (size_t v = 0; v < n; v++)
+            {
+                BitSet_init(&adj[v], GRAPH_MAX);
+            }
+            for (size_t u = 0; u < n; u++)
+            {
+                for (size_t v = u + 1; v < n; v++)
+                {
+                    if ((!bipartite || u % 2 != v % 2) && rand() % 100 < density)
+                    {
+                        BitSet_set(rand() % 2 ? &adj[u] : &adj[v], rand() % 2 ? v : u);
+                    }
+                }
+            }
+
+            size_t max_clique = 0, max_independent = 0;
+            for (uint32_t mask = 0; mask < (uint32_t)1 << n; mask++)
+            {
+                size_t size = (size_t)bitset_popcount64(mask);
+                if (size > max_clique && graph_uniform(adj, n, mask, 1))
+                {
+                    max_clique = size;
+                }
+                if (size > max_independent && graph_uniform(adj, n, mask, 0))
+                {
+                    max_independent = size;
+                }
+            }
+
+            size_t size = BitSet_max_clique(adj, n, out);
+            assert(size == max_clique);
+            uint32_t mask = 0;
+            for (size_t i = 0; i < size; i++)
+            {
+                mask |= (uint32_t)1 << out[i];
+            }
+            assert(graph_uniform(adj, n, mask, 1));
+
+            size = BitSet_max_independent_set(adj, n, out);
+            assert(size == max_independent);
+            mask = 0;
+            for (size_t i = 0; i < size; i++)
+            {
+                mask |= (uint32_t)1 << out[i];
+            }
+            assert(graph_uniform(adj, n, mask, 0));
+            (void)mask;
+
+            size_t num_colors = BitSet_greedy_coloring(adj, n, colors);
+            assert(num_colors >= max_clique && (!bipartite || num_colors <= 2));
+            for (size_t u = 0; u < n; u++)
+            {
+                assert(colors[u] < num_colors);
+                for (size_t v = 0; v < n; v++)
+                {
+                    assert(!graph_adjacent(adj, u, v) || colors[u] != colors[v]);
+                }
+            }
+            (void)num_colors;
+
+            for (size_t v = 0; v < n; v++)
+            {
+                BitSet_free(&adj[v]);
+            }
+            graphs++;
+        }
+    }
+
+    printf("graph: %zu graphs of up to %d vertices checked by brute force\n", graphs, GRAPH_MAX);
+}
+
+#define HAMMING_ROWS 5000
+#define HAMMING_BITS 256
+#define HAMMING_CENTERS 50
+#define HAMMING_K 8
+
+// Hamming index search against the linear scan, and the linear scan against a brute force over BitSet_xor_into
+// distances, at several radii and table counts.
+static void test_hamming_index(void)
+{
+    BitSet *sets = (BitSet *)malloc(HAMMING_ROWS * sizeof(BitSet));
+    size_t *distances = (size_t *)malloc(HAMMING_ROWS * sizeof(size_t));
+    unsigned char *taken = (unsigned char *)malloc(HAMMING_ROWS);
+    BitSet centers[HAMMING_CENTERS];
+    BitSetRows rows;
+    BitSetRows_init(&rows, HAMMING_BITS);
+    srand(15);
+    // rows are noisy copies of a few centers, so near rows share substrings with the queries
+    for (size_t c = 0; c < HAMMING_CENTERS; c++)
+    {
+        BitSet_init(&centers[c], HAMMING_BITS);
+        for (size_t i = 0; i < HAMMING_BITS; i++)
+        {
+            if (rand() % 2)
+            {
+                BitSet_set(&centers[c], i);
+            }
+        }
+    }
+    for (size_t r = 0; r < HAMMING_ROWS; r++)
+    {
+        BitSet_init(&sets[r], HAMMING_BITS);
+        BitSet_or(&sets[r], &centers[random_index(HAMMING_CENTERS)]);
+        size_t flips = random_index(16);
+        for (size_t i = 0; i < flips; i++)
+        {
+            BitSet_flip(&sets[r], random_index(HAMMING_BITS));
+        }
+        BitSetRows_append(&rows, &sets[r]);
+    }
+
+    static const size_t radii[] = {SIZE_MAX, 0, 8, 24};
+    static const size_t tables[] = {0, 2};
+    BitSetHit hits[HAMMING_K], expected[HAMMING_K];
+    BitSet diff;
+    BitSet_init(&diff, HAMMING_BITS);
+    size_t searches = 0;
+    for (size_t t = 0; t < sizeof(tables) / sizeof(tables[0]); t++)
+    {
+        BitSetHammingIndex idx;
+        BitSetStatus status = BitSetHammingIndex_init(&idx, &rows, tables[t]);
+        assert(status == BITSET_OK);
+        (void)status;
+        for (size_t q = 0; q < 20; q++)
+        {
+            // a third of the queries are rows of the table, the rest are centers with a few bits flipped
+            BitSet query;
+            BitSet_init(&query, HAMMING_BITS);
+            BitSet_or(&query, q % 3 ? &centers[random_index(HAMMING_CENTERS)] : &sets[random_index(HAMMING_ROWS)]);
+            size_t flips = q % 3 ? random_index(12) : 0;
+            for (size_t i = 0; i < flips; i++)
+            {
+                BitSet_flip(&query, random_index(HAMMING_BITS));
+            }
+            for (size_t r = 0; r < HAMMING_ROWS; r++)
+            {
+                BitSet_xor_into(&diff, &query, &sets[r]);
+                distances[r] = BitSet_count(&diff);
+            }
+
+            for (size_t d = 0; d < sizeof(radii) / sizeof(radii[0]); d++)
+            {
+                size_t max_distance = radii[d];
+                // brute force: repeatedly take the nearest untaken row within the radius, lowest row on ties
+                memset(taken, 0, HAMMING_ROWS);
+                size_t m = 0;
+                for (; m < HAMMING_K; m++)
+                {
+                    size_t best = SIZE_MAX;
+                    for (size_t r = 0; r < HAMMING_ROWS; r++)
+                    {
+                        if (!taken[r] && distances[r] <= max_distance &&
+                            (best == SIZE_MAX || distances[r] < distances[best]))
+                        {
+                            best = r;
+                        }
+                    }
+                    if (best == SIZE_MAX)
+                    {
+                        break;
+                    }
+                    taken[best] = 1;
+                    expected[m].row = best;
+                    expected[m].score = (double)distances[best];
+                }
+
+                size_t n = BitSetRows_hamming_search(&rows, &query, max_distance, HAMMING_K, hits);
+                assert(n == m);
+                for (size_t i = 0; i < n; i++)
+                {
+                    assert(hits[i].row == expected[i].row && hits[i].score == expected[i].score);
+                }
+                (void)n;
+                (void)expected;
+
+                size_t idx_n = BitSetHammingIndex_search(&idx, &query, max_distance, HAMMING_K, hits);
+                assert(idx_n == m);
+                for (size_t i = 0; i < idx_n; i++)
+                {
+                    assert(hits[i].row == expected[i].row && hits[i].score == expected[i].score);
+                }
+                (void)idx_n;
+                searches++;
+            }
+            BitSet_free(&query);
+        }
+        BitSetHammingIndex_free(&idx);
+    }
+
+    BitSet_free(&diff);
+    for (size_t c = 0; c < HAMMING_CENTERS; c++)
+    {
+        BitSet_free(&centers[c]);
+    }
+    for (size_t r = 0; r < HAMMING_ROWS; r++)
+    {
+        BitSet_free(&sets[r]);
+    }
+    BitSetRows_free(&rows);
+    free(taken);
+    free(distances);
+    free(sets);
+
+    printf("hamming index: %zu searches equal to the linear scan and the brute force\n", searches);
+}
+
+#define STAMPED_BITS 1000000
+#define STAMPED_ROUNDS 2000
+#define STAMPED_WRITES 16
+
+// Sparse set / clear_all cycles on BitSetStamped against a BitSet cleared with memset, plus the epoch wraparound.
+static void test_stamped(void)
+{
+    BitSetStamped st;
+    BitSetStamped_init(&st, STAMPED_BITS);
+    BitSet bs;
+    BitSet_init(&bs, STAMPED_BITS);
+    size_t indices[STAMPED_WRITES];
+
+    double stamped_seconds = 0;
+    double memset_seconds = 0;
+    srand(1);
+    for (int r = 0; r < STAMPED_ROUNDS; r++)
+    {
+        for (int i = 0; i < STAMPED_WRITES; i++)
+        {
+            indices[i] = ((size_t)rand() * (RAND_MAX + (size_t)1) + (size_t)rand()) % STAMPED_BITS;
+        }
+
+        double start = now_seconds();
+        BitSetStamped_clear_all(&st);
+        for (int i = 0; i < STAMPED_WRITES; i++)
+        {
+            BitSetStamped_set(&st, indices[i]);
+        }
+        stamped_seconds += now_seconds() - start;
+
+        start = now_seconds();
+        BitSet_clear_all_ex(&bs, BITSET_MEM_LIBC);
+        for (int i = 0; i < STAMPED_WRITES; i++)
+        {
+            BitSet_set(&bs, indices[i]);
+        }
+        memset_seconds += now_seconds() - start;
+
+        assert(BitSetStamped_count(&st) == BitSet_count(&bs));
+        for (int i = 0; i < STAMPED_WRITES; i++)
+        {
+            assert(BitSetStamped_get(&st, indices[i]) == 1);
+        }
+    }
+
+    // a word stamped with epoch 1 long ago must not come back to life when the epoch wraps around to 1
+    BitSetStamped_clear_all(&st);
+    st.words[0].stamp = 1;
+    st.words[0].bits = ~(uint64_t)0;
+    st.epoch = UINT32_MAX - 1;
+    BitSetStamped_set(&st, 64);
+    BitSetStamped_clear_all(&st);
+    assert(st.epoch == UINT32_MAX && BitSetStamped_count(&st) == 0);
+    BitSetStamped_set(&st, 128);
+    BitSetStamped_clear_all(&st);
+    assert(st.epoch == 1);
+    assert(BitSetStamped_count(&st) == 0 && BitSetStamped_get(&st, 0) == 0 && BitSetStamped_get(&st, 128) == 0);
+    assert(BitSetStamped_test_and_set(&st, 3) == 0 && BitSetStamped_count(&st) == 1);
+
+    printf("stamped: clear_all + %d sets %.2f us stamped, %.2f us memset\n", STAMPED_WRITES,
+           stamped_seconds * 1e6 / STAMPED_ROUNDS, memset_seconds * 1e6 / STAMPED_ROUNDS);
+    BitSet_free(&bs);
+    BitSetStamped_free(&st);
+}
+
+#define MATCH_TEXT 20000
+#define MATCH_MAX_HITS (MATCH_TEXT * 3)
+#define MATCH_PATTERN 100
+
+typedef struct
+{
+    size_t count;
+    size_t pattern[MATCH_MAX_HITS];
+    size_t end[MATCH_MAX_HITS];
+    size_t distance[MATCH_MAX_HITS];
+} match_hits;
+
+static int match_collect(size_t pattern, size_t end, size_t distance, void *ctx)
+{
+    match_hits *hits = (match_hits *)ctx;
+    assert(hits->count < MATCH_MAX_HITS);
+    hits->pattern[hits->count] = pattern;
+    hits->end[hits->count] = end;
+    hits->distance[hits->count] = distance;
+    hits->count++;
+    return 0;
+}
+
+static size_t min_size(size_t a, size_t b)
+{
+    return a < b ? a : b;
+}
+
+// Textbook O(n * m) dynamic programming. With "search" set row 0 is all zeros, so a match may start anywhere in
+// "text", and every text position whose last row is within "max_distance" is reported through "hits".
+static size_t naive_edit_distance(const uint8_t *pattern, size_t m, const uint8_t *text, size_t n, int search,
+                                  size_t max_distance, match_hits *hits)
+{
+    size_t *col = (size_t *)malloc((m + 1) * sizeof(size_t));
+    for (size_t i = 0; i <= m; i++)
+    {
+        col[i] = i;
+    }
+    for (size_t j = 0; j < n; j++)
+    {
+        size_t diag = col[0];
+        col[0] = search ? 0 : j + 1;
+        for (size_t i = 1; i <= m; i++)
+        {
+            size_t up = col[i];
+            col[i] = min_size(min_size(col[i] + 1, col[i - 1] + 1), diag + (pattern[i - 1] != text[j]));
+            diag = up;
+        }
+        if (hits && col[m] <= max_distance)
+        {
+            match_collect(0, j, col[m], hits);
+        }
+    }
+    size_t distance = col[m];
+    free(col);
+    return distance;
+}
+
+// Shift-Or and Myers against a naive scan and DP on random text over a small alphabet, so there are many matches.
+static void test_matching(void)
+{
+    static uint8_t text[MATCH_TEXT];
+    static match_hits hits, expected;
+    srand(2);
+    for (size_t i = 0; i < MATCH_TEXT; i++)
+    {
+        text[i] = (uint8_t)('a' + rand() % 3);
+    }
+
+    // one short pattern, one taken from the text and one longer than a word
+    uint8_t short_pattern[] = "abca";
+    uint8_t long_pattern[MATCH_PATTERN];
+    for (size_t i = 0; i < MATCH_PATTERN; i++)
+    {
+        long_pattern[i] = (uint8_t)('a' + rand() % 3);
+    }
+    // plant one exact copy of the long pattern and one with every tenth byte changed
+    memcpy(text + 9000, long_pattern, MATCH_PATTERN);
+    memcpy(text + 5000, long_pattern, MATCH_PATTERN);
+    for (size_t i = 0; i < MATCH_PATTERN; i += 10)
+    {
+        text[5000 + i] = 'd';
+    }
+    const uint8_t *patterns[] = {short_pattern, text + 1234, long_pattern};
+    size_t pattern_lens[] = {4, 70, MATCH_PATTERN};
+
+    hits.count = 0;
+    int stopped = BitSet_match_exact(text, MATCH_TEXT, patterns, pattern_lens, 3, match_collect, &hits);
+    assert(stopped == 0);
+    size_t k = 0;
+    for (size_t end = 0; end < MATCH_TEXT; end++)
+    {
+        for (size_t p = 0; p < 3; p++)
+        {
+            if (end + 1 >= pattern_lens[p] && memcmp(text + end + 1 - pattern_lens[p], patterns[p], pattern_lens[p]) == 0)
+            {
+                assert(k < hits.count && hits.pattern[k] == p && hits.end[k] == end);
+                k++;
+            }
+        }
+    }
+    assert(k == hits.count && k > 0);
+
+    // approximate search with Myers, a 100 byte pattern spans two words
+    size_t max_distance = 30;
+    hits.count = 0;
+    double start = now_seconds();
+    stopped = BitSet_match_approx(text, MATCH_TEXT, long_pattern, MATCH_PATTERN, max_distance, match_collect, &hits);
+    double myers_seconds = now_seconds() - start;
+    assert(stopped == 0);
+    (void)stopped;
+    expected.count = 0;
+    start = now_seconds();
+    naive_edit_distance(long_pattern, MATCH_PATTERN, text, MATCH_TEXT, 1, max_distance, &expected);
+    double naive_seconds = now_seconds() - start;
+    assert(hits.count == expected.count && hits.count > 0);
+    for (size_t i = 0; i < hits.count; i++)
+    {
+        assert(hits.end[i] == expected.end[i] && hits.distance[i] == expected.distance[i]);
+    }
+
+    // edit distance, including the empty string and strings that cross word boundaries
+    size_t lens[] = {0, 1, 63, 64, 65, 200};
+    for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); i++)
+    {
+        for (size_t j = 0; j < sizeof(lens) / sizeof(lens[0]); j++)
+        {
+            size_t distance = BitSet_edit_distance(text + 17, lens[i], text + 500, lens[j]);
+            assert(distance == naive_edit_distance(text + 17, lens[i], text + 500, lens[j], 0, 0, NULL));
+            (void)distance;
+        }
+    }
+    assert(BitSet_edit_distance(text, 300, text, 300) == 0);
+
+    printf("matching: %zu approximate matches, Myers %.2f ms, naive DP %.2f ms\n", hits.count, myers_seconds * 1e3,
+           naive_seconds * 1e3);
+}
+
+#define TANIMOTO_ROWS 20000
+#define TANIMOTO_BITS 1024
+#define TANIMOTO_K 10
+
+// Top-k Tanimoto search against a brute force scan with BitSet_tanimoto, and the threaded search against the
+// single threaded one.
+static void test_tanimoto(void)
+{
+    BitSet *sets = (BitSet *)malloc(TANIMOTO_ROWS * sizeof(BitSet));
+    double *scores = (double *)malloc(TANIMOTO_ROWS * sizeof(double));
+    unsigned char *taken = (unsigned char *)malloc(TANIMOTO_ROWS);
+    BitSetRows rows;
+    BitSetRows_init(&rows, TANIMOTO_BITS);
+    srand(3);
+    // densities from 1% to 50%, so the popcount bound skips a good share of the rows
+    for (size_t r = 0; r < TANIMOTO_ROWS; r++)
+    {
+        BitSet_init(&sets[r], TANIMOTO_BITS);
+        int density = 1 + rand() % 50;
+        for (size_t i = 0; i < TANIMOTO_BITS; i++)
+        {
+            if (rand() % 100 < density)
+            {
+                BitSet_set(&sets[r], i);
+            }
+        }
+        BitSetRows_append(&rows, &sets[r]);
+    }
+
+    BitSetHit hits[TANIMOTO_K], expected[TANIMOTO_K];
+    double search_seconds = 0;
+    double brute_seconds = 0;
+    for (size_t q = 0; q < 20; q++)
+    {
+        // half the queries are rows of the table, half are rows with a few bits flipped
+        BitSet query;
+        BitSet_init(&query, TANIMOTO_BITS);
+        BitSet_or(&query, &sets[(q * 7919) % TANIMOTO_ROWS]);
+        for (size_t i = 0; q % 2 && i < 20; i++)
+        {
+            BitSet_flip(&query, (size_t)rand() % TANIMOTO_BITS);
+        }
+        double threshold = q % 4 < 2 ? 0.0 : 0.3;
+
+        double start = now_seconds();
+        size_t n = BitSetRows_tanimoto_search(&rows, &query, threshold, TANIMOTO_K, hits);
+        search_seconds += now_seconds() - start;
+
+        start = now_seconds();
+        size_t m = 0;
+        for (size_t r = 0; r < TANIMOTO_ROWS; r++)
+        {
+            scores[r] = BitSet_tanimoto(&query, &sets[r]);
+            taken[r] = 0;
+        }
+        // decreasing similarity, ties by increasing row
+        for (; m < TANIMOTO_K; m++)
+        {
+            size_t best = SIZE_MAX;
+            for (size_t r = 0; r < TANIMOTO_ROWS; r++)
+            {
+                if (!taken[r] && scores[r] >= threshold && (best == SIZE_MAX || scores[r] > scores[best]))
+                {
+                    best = r;
+                }
+            }
+            if (best == SIZE_MAX)
+            {
+                break;
+            }
+            taken[best] = 1;
+            expected[m].row = best;
+            expected[m].score = scores[best];
+        }
+        brute_seconds += now_seconds() - start;
+
+        assert(n == m);
+        for (size_t i = 0; i < n; i++)
+        {
+            assert(hits[i].row == expected[i].row && hits[i].score == expected[i].score);
+        }
+        (void)expected;
+#if defined(BITSET_THREADS)
+        BitSetHit mt_hits[TANIMOTO_K];
+        for (size_t threads = 1; threads <= 4; threads++)
+        {
+            size_t mt_n = BitSetRows_tanimoto_search_mt(&rows, &query, threshold, TANIMOTO_K, mt_hits, threads);
+            assert(mt_n == n);
+            for (size_t i = 0; i < mt_n; i++)
+            {
+                assert(mt_hits[i].row == hits[i].row && mt_hits[i].score == hits[i].score);
+            }
+        }
+#endif
+        BitSet_free(&query);
+    }
+
+    printf("tanimoto: top %d of %d rows, search %.2f ms, brute force %.2f ms per query\n", TANIMOTO_K, TANIMOTO_ROWS,
+           search_seconds * 1e3 / 20, brute_seconds * 1e3 / 20);
+    for (size_t r = 0; r < TANIMOTO_ROWS; r++)
+    {
+        BitSet_free(&sets[r]);
+    }
+    free(sets);
+    free(scores);
+    free(taken);
+    BitSetRows_free(&rows);
+}
+
+#if defined(BITSET_THREADS)
+#define PARALLEL_BITS 1000000
+
+typedef struct
+{
+    unsigned char *visits;
+    size_t count;
+    size_t cancel_at;
+} parallel_visit;
+
+static int parallel_visit_fn(size_t index, void *ctx)
+{
+    parallel_visit *v = (parallel_visit *)ctx;
+    __atomic_fetch_add(&v->visits[index], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&v->count, 1, __ATOMIC_RELAXED);
+    return index == v->cancel_at;
+}
+
+static int parallel_cancel_fn(size_t index, void *ctx)
+{
+    (void)index;
+    __atomic_fetch_add((size_t *)ctx, 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+// BitSet_parallel_for_each_set must call "fn" exactly once per set bit for any thread count, on a set with dense
+// and empty regions so the chunks are uneven, and must report a cancellation.
+static void test_parallel_for_each(void)
+{
+    BitSet bs;
+    BitSet_init(&bs, PARALLEL_BITS);
+    srand(8);
+    for (size_t i = 0; i < PARALLEL_BITS; i++)
+    {
+        // a dense first tenth, then sparse bits
+        if (i < PARALLEL_BITS / 10 ? rand() % 2 : rand() % 500 == 0)
+        {
+            BitSet_set(&bs, i);
+        }
+    }
+    size_t count = BitSet_count(&bs);
+    parallel_visit v;
+    v.visits = (unsigned char *)malloc(PARALLEL_BITS);
+    for (size_t threads = 1; threads <= 8; threads++)
+    {
+        memset(v.visits, 0, PARALLEL_BITS);
+        v.count = 0;
+        v.cancel_at = SIZE_MAX;
+        int cancelled = BitSet_parallel_for_each_set(&bs, parallel_visit_fn, &v, threads);
+        assert(cancelled == 0 && v.count == count);
+        for (size_t i = 0; i < PARALLEL_BITS; i++)
+        {
+            assert(v.visits[i] == BitSet_get(&bs, i));
+        }
+
+        // cancel on the last set bit, which has to be reached for the call to report it
+        size_t last = PARALLEL_BITS - 1;
+        while (!BitSet_get(&bs, last))
+        {
+            last--;
+        }
+        v.count = 0;
+        v.cancel_at = last;
+        cancelled = BitSet_parallel_for_each_set(&bs, parallel_visit_fn, &v, threads);
+        assert(cancelled == 1 && v.visits[last] == 2);
+        (void)cancelled;
+    }
+
+    // a callback that always cancels stops every thread at its first bit
+    v.count = 0;
+    int cancelled = BitSet_parallel_for_each_set(&bs, parallel_cancel_fn, &v.count, 4);
+    assert(cancelled == 1 && v.count <= 4);
+    (void)cancelled;
+
+    printf("parallel: %zu set bits visited with 1 to 8 threads\n", count);
+    free(v.visits);
+    BitSet_free(&bs);
+}
+
+#define CONCURRENT_BITS 100000
+#define CONCURRENT_READERS 3
+
+typedef struct
+{
+    BitSetConcurrent *c;
+    int *stop;
+    size_t snapshots;
+    size_t reads;
+    double read_seconds;
+} concurrent_reader;
+
+static void *concurrent_reader_main(void *arg)
+{
+    concurrent_reader *r = (concurrent_reader *)arg;
+    BitSet view;
+    BitSet_init(&view, CONCURRENT_BITS);
+    size_t index = 0;
+    while (!__atomic_load_n(r->stop, __ATOMIC_ACQUIRE))
+    {
+        // the writer only ever flips every bit at once, a consistent view is all zeros or all ones
+        BitSetConcurrent_snapshot(r->c, &view);
+        size_t count = BitSet_count(&view);
+        assert(count == 0 || count == CONCURRENT_BITS);
+        (void)count;
+        r->snapshots++;
+
+        double start = now_seconds();
+        unsigned int sum = 0;
+        for (int i = 0; i < 1000; i++)
+        {
+            sum += BitSetConcurrent_get(r->c, index);
+            index = (index + 7919) % CONCURRENT_BITS;
+        }
+        r->read_seconds += now_seconds() - start;
+        r->reads += 1000;
+        (void)sum;
+    }
+    BitSet_free(&view);
+    return NULL;
+}
+
+// One writer flips the whole set with bulk XORs while readers take snapshots and time single bit reads.
+static void test_concurrent(void)
+{
+    BitSetConcurrent c;
+    BitSetConcurrent_init(&c, CONCURRENT_BITS);
+    BitSet ones;
+    BitSet_init(&ones, CONCURRENT_BITS);
+    BitSet_set_all(&ones);
+
+    // bulk ops follow the BitSet semantics, a shorter source reads as zero past its end
+    BitSet low;
+    BitSet_init(&low, 64);
+    BitSet_set_all(&low);
+    BitSetConcurrent_set(&c, 200);
+    BitSetConcurrent_set(&c, 3);
+    BitSetConcurrent_and(&c, &low);
+    assert(BitSetConcurrent_get(&c, 3) == 1 && BitSetConcurrent_get(&c, 200) == 0);
+    BitSetConcurrent_clear(&c, 3);
+    BitSet_free(&low);
+
+    int stop = 0;
+    concurrent_reader readers[CONCURRENT_READERS];
+    pthread_t threads[CONCURRENT_READERS];
+    for (int i = 0; i < CONCURRENT_READERS; i++)
+    {
+        readers[i].c = &c;
+        readers[i].stop = &stop;
+        readers[i].snapshots = 0;
+        readers[i].reads = 0;
+        readers[i].read_seconds = 0;
+        pthread_create(&threads[i], NULL, concurrent_reader_main, &readers[i]);
+    }
+    size_t writes = 0;
+    double start = now_seconds();
+    while (now_seconds() - start < 0.5)
+    {
+        BitSetConcurrent_xor(&c, &ones);
+        writes++;
+    }
+    // leave an even number of flips so the set ends empty
+    if (writes % 2)
+    {
+        BitSetConcurrent_xor(&c, &ones);
+    }
+    __atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+    size_t snapshots = 0;
+    size_t reads = 0;
+    double read_seconds = 0;
+    for (int i = 0; i < CONCURRENT_READERS; i++)
+    {
+        pthread_join(threads[i], NULL);
+        snapshots += readers[i].snapshots;
+        reads += readers[i].reads;
+        read_seconds += readers[i].read_seconds;
+    }
+    assert(BitSetConcurrent_count(&c) == 0);
+
+    // reader latency without a writer, for comparison
+    double idle_start = now_seconds();
+    unsigned int sum = 0;
+    for (size_t i = 0; i < reads; i++)
+    {
+        sum += BitSetConcurrent_get(&c, (i * 7919) % CONCURRENT_BITS);
+    }
+    double idle_seconds = now_seconds() - idle_start;
+    (void)sum;
+
+    printf("concurrent: %zu bulk writes, %zu consistent snapshots\n", writes, snapshots);
+    printf("concurrent: get %.1f ns under writes, %.1f ns idle\n",
+           reads ? read_seconds * 1e9 / (double)reads : 0.0, reads ? idle_seconds * 1e9 / (double)reads : 0.0);
+    BitSet_free(&ones);
+    BitSetConcurrent_free(&c);
+}
+
+#define NUMA_BITS ((size_t)1 << 27)
+#define NUMA_ROUNDS 20
+
+// Bulk ops on the node partitioned layout against a plain BitSet allocated by one thread.
+static void test_numa(void)
+{
+#if defined(__linux__)
+    cpu_set_t before, after;
+    CPU_ZERO(&before);
+    CPU_ZERO(&after);
+    pthread_getaffinity_np(pthread_self(), sizeof(before), &before);
+#endif
+    BitSetNuma a, b;
+    BitSetNuma_init(&a, NUMA_BITS, 0);
+    BitSetNuma_init(&b, NUMA_BITS, 0);
+    BitSet x, y;
+    BitSet_init(&x, NUMA_BITS);
+    BitSet_init(&y, NUMA_BITS);
+    for (size_t i = 0; i < NUMA_BITS; i += 3)
+    {
+        BitSetNuma_set(&b, i);
+        BitSet_set(&y, i);
+    }
+
+    double start = now_seconds();
+    size_t numa_count = 0;
+    for (int r = 0; r < NUMA_ROUNDS; r++)
+    {
+        BitSetNuma_xor(&a, &b);
+        numa_count += BitSetNuma_count(&a);
+    }
+    double numa_seconds = now_seconds() - start;
+
+    start = now_seconds();
+    size_t single_count = 0;
+    for (int r = 0; r < NUMA_ROUNDS; r++)
+    {
+        BitSet_xor(&x, &y);
+        single_count += BitSet_count(&x);
+    }
+    double single_seconds = now_seconds() - start;
+    assert(numa_count == single_count);
+    (void)numa_count;
+    (void)single_count;
+
+#if defined(__linux__)
+    // the calling thread runs node 0 itself and must not stay pinned to it
+    pthread_getaffinity_np(pthread_self(), sizeof(after), &after);
+    assert(CPU_EQUAL(&before, &after));
+#endif
+    printf("numa: %zu nodes, xor+count %.2f ms partitioned, %.2f ms single node\n", BitSetNuma_num_nodes(&a),
+           numa_seconds * 1e3 / NUMA_ROUNDS, single_seconds * 1e3 / NUMA_ROUNDS);
+    BitSetNuma_free(&a);
+    BitSetNuma_free(&b);
+    BitSet_free(&x);
+    BitSet_free(&y);
+}
+#endif
+
+int main(void)
+{
+    BitSet bs;
+    BitSet_init(&bs, 100);
+    srand(0);
+    // for (size_t i = 0; i < 100; i++)
+    // {
+    //     if (rand() % 2)
+    //     {
+    //         BitSet_set(&bs, i);
+    //     }
+    // }
+    size_t dims[] = {2,2};
+    size_t num_dims = sizeof(dims) / sizeof(dims[0]);
+    size_t vec[] = {1,1};
+    BitSet_set(&bs, linear_index(num_dims,dims,vec));
+    BitSet_print(&bs,10);
+    putc('\n', stdout);
+    BitSet bs2;
+    BitSet_copy_construct(&bs2, &bs);
+    BitSet_print(&bs2,10);
+
+    BitSet_free(&bs);
+    BitSet_free(&bs2);
+
+    test_cow();
+    test_persistent();
+    test_patch();
+    test_sharded();
+    test_prefix_counts();
+    test_batch();
+    test_lazy_clear();
+    test_stream();
+    test_logic();
+    test_or_shifted();
+    test_primes();
+    test_graph();
+    test_hamming_index();
+    test_stamped();
+    test_matching();
+    test_tanimoto();
+
+#if defined(BITSET_THREADS)
+    test_parallel_for_each();
+    test_concurrent();
+    test_numa();
+#endif
+
+    return 0;
+}